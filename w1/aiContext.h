@@ -0,0 +1,12 @@
+#pragma once
+
+struct Time;
+class SpatialHash;
+
+// World singletons AI reads every turn, gathered once per turn in process_turn
+// and passed down to states and transitions instead of querying them on every call.
+struct AIContext
+{
+  const Time *time = nullptr;
+  const SpatialHash *spatialHash = nullptr;
+};
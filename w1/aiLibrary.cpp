@@ -1,6 +1,8 @@
 #include "aiLibrary.h"
 #include <flecs.h>
 #include "ecsTypes.h"
+#include "math.h"
+#include "transitionPredicates.h"
 #include <bx/rng.h>
 #include <cfloat>
 #include <cmath>
@@ -12,18 +14,9 @@ class AttackEnemyState : public State
 public:
   void enter() const override {}
   void exit() const override {}
-  void act(float/* dt*/, flecs::world &/*ecs*/, flecs::entity /*entity*/) const override {}
+  void act(float/* dt*/, flecs::world &/*ecs*/, flecs::entity /*entity*/, const AIContext &/*ctx*/) const override {}
 };
 
-template<typename T>
-T sqr(T a){ return a*a; }
-
-template<typename T, typename U>
-static float dist_sq(const T &lhs, const U &rhs) { return float(sqr(lhs.x - rhs.x) + sqr(lhs.y - rhs.y)); }
-
-template<typename T, typename U>
-static float dist(const T &lhs, const U &rhs) { return sqrtf(dist_sq(lhs, rhs)); }
-
 template<typename T, typename U>
 static int move_towards(const T &from, const U &to)
 {
@@ -48,52 +41,20 @@ static int inverse_move(int move)
 template<typename Callable>
 static void on_closest_enemy_pos(flecs::world &ecs, flecs::entity entity, Callable c)
 {
-  static auto enemiesQuery = ecs.query<const Position, const Team>();
-  entity.set([&](const Position &pos, const Team &t, Action &a)
+  entity.set([&](const Position &pos, const WorldInfo &info, Action &a)
   {
-    flecs::entity closestEnemy;
-    float closestDist = FLT_MAX;
-    Position closestPos;
-    enemiesQuery.each([&](flecs::entity enemy, const Position &epos, const Team &et)
-    {
-      if (t.team == et.team)
-        return;
-      float curDist = dist(epos, pos);
-      if (curDist < closestDist)
-      {
-        closestDist = curDist;
-        closestPos = epos;
-        closestEnemy = enemy;
-      }
-    });
-    if (ecs.is_valid(closestEnemy))
-      c(a, pos, closestPos);
+    if (ecs.is_valid(info.closestEnemy))
+      c(a, pos, info.closestEnemyPos);
   });
 }
 
 template<typename Callable>
 static void on_closest_ally_pos(flecs::world &ecs, flecs::entity entity, Callable c)
 {
-  static auto enemiesQuery = ecs.query<const Position, const Team>();
-  entity.set([&](const Position &pos, const Team &t, Action &a)
+  entity.set([&](const Position &pos, const WorldInfo &info, Action &a)
   {
-    flecs::entity closestAlly;
-    float closestDist = FLT_MAX;
-    Position closestPos;
-    enemiesQuery.each([&](flecs::entity ally, const Position &apos, const Team &at)
-    {
-      if (t.team != at.team)
-        return;
-      float curDist = dist(apos, pos);
-      if (curDist < closestDist && curDist > FLT_EPSILON)
-      {
-        closestDist = curDist;
-        closestPos = apos;
-        closestAlly = ally;
-      }
-    });
-    if (ecs.is_valid(closestAlly))
-      c(a, pos, closestPos);
+    if (info.numAllies > 0 && ecs.is_valid(info.allies[0].ally))
+      c(a, pos, info.allies[0].pos);
   });
 }
 
@@ -102,7 +63,7 @@ class MoveToEnemyState : public State
 public:
   void enter() const override {}
   void exit() const override {}
-  void act(float/* dt*/, flecs::world &ecs, flecs::entity entity) const override
+  void act(float/* dt*/, flecs::world &ecs, flecs::entity entity, const AIContext &/*ctx*/) const override
   {
     on_closest_enemy_pos(ecs, entity, [&](Action &a, const Position &pos, const Position &enemy_pos)
     {
@@ -116,7 +77,7 @@ class MoveToAllyState : public State
 public:
   void enter() const override {}
   void exit() const override {}
-  void act(float/* dt*/, flecs::world &ecs, flecs::entity entity) const override
+  void act(float/* dt*/, flecs::world &ecs, flecs::entity entity, const AIContext &/*ctx*/) const override
   {
     on_closest_ally_pos(ecs, entity, [&](Action &a, const Position &pos, const Position &ally_pos)
     {
@@ -130,7 +91,7 @@ public:
 // public:
 //   void enter() const override {}
 //   void exit() const override {}
-//   void act(float/* dt*/, flecs::world &ecs, flecs::entity entity) const override
+//   void act(float/* dt*/, flecs::world &ecs, flecs::entity entity, const AIContext &ctx) const override
 //   {
 //     on_closest_ally_pos(ecs, entity, [&](Action &a, const Position &pos, const Position &ally_pos)
 //     {
@@ -145,7 +106,7 @@ public:
   FleeFromEnemyState() {}
   void enter() const override {}
   void exit() const override {}
-  void act(float/* dt*/, flecs::world &ecs, flecs::entity entity) const override
+  void act(float/* dt*/, flecs::world &ecs, flecs::entity entity, const AIContext &/*ctx*/) const override
   {
     on_closest_enemy_pos(ecs, entity, [&](Action &a, const Position &pos, const Position &enemy_pos)
     {
@@ -161,7 +122,7 @@ public:
   PatrolState(float dist) : patrolDist(dist) {}
   void enter() const override {}
   void exit() const override {}
-  void act(float/* dt*/, flecs::world &ecs, flecs::entity entity) const override
+  void act(float/* dt*/, flecs::world &ecs, flecs::entity entity, const AIContext &/*ctx*/) const override
   {
     entity.set([&](const Position &pos, const PatrolPos &ppos, Action &a)
     {
@@ -181,7 +142,7 @@ class NopState : public State
 public:
   void enter() const override {}
   void exit() const override {}
-  void act(float/* dt*/, flecs::world &ecs, flecs::entity entity) const override {}
+  void act(float/* dt*/, flecs::world &ecs, flecs::entity entity, const AIContext &/*ctx*/) const override {}
 };
 
 class HealState : public State
@@ -191,16 +152,12 @@ public:
   HealState(float power) : healPower(power) {} 
   void enter() const override {}
   void exit() const override {}
-  void act(float /*dt*/, flecs::world &ecs, flecs::entity entity) const override
+  void act(float /*dt*/, flecs::world &ecs, flecs::entity entity, const AIContext &ctx) const override
   {
     entity.each<Targets>([&](flecs::entity tar) {
       entity.remove<Targets>(tar);
     });
-    static auto globalTime = ecs.query<Time>();
-    float cur_time = 0.f;
-    globalTime.each([&](flecs::entity /*e*/, Time &gtime){
-      cur_time = gtime.time;
-    });
+    const float cur_time = get_global_time(ctx);
     
     entity.set([&](Action &a, Ability &ability)
     {
@@ -220,29 +177,19 @@ public:
   AllyHealState(float power, float dist) : healPower(power), healDist(dist) {} 
   void enter() const override {}
   void exit() const override {}
-  void act(float /*dt*/, flecs::world &ecs, flecs::entity entity) const override
+  void act(float /*dt*/, flecs::world &ecs, flecs::entity entity, const AIContext &ctx) const override
   {
     entity.remove<Targets>();
-    static auto globalTime = ecs.query<Time>();
-    float cur_time = 0.f;
-    globalTime.each([&](flecs::entity /*e*/, Time &gtime){
-      cur_time = gtime.time;
-    });
+    const float cur_time = get_global_time(ctx);
     
-    static auto alliesQuery = ecs.query<const Position, const Team>();
-    entity.set([&](const Position &pos, const Team &t, Action &a, Ability &ability)
+    entity.set([&](Action &a, Ability &ability)
     {
-      alliesQuery.each([&](flecs::entity ally, const Position &apos, const Team &at)
+      for_each_ally_within(entity, ctx, healDist, [&](const SpatialHash::Neighbour &ally)
       {
-        if (t.team != at.team)
-          return;
-        float curDist = dist(apos, pos);
-        if (curDist <= healDist && curDist > FLT_EPSILON) {
-          a.action = EA_HEAL;
-          ability.power = healPower;
-          ability.lastAbilityUsage = cur_time;
-          entity.add<Targets>(ally);
-        }
+        a.action = EA_HEAL;
+        ability.power = healPower;
+        ability.lastAbilityUsage = cur_time;
+        entity.add<Targets>(ally.entity);
       });
     });
   }
@@ -255,7 +202,7 @@ public:
   MoveToState(Position tgt) : target_pos(tgt) {}
   void enter() const override {}
   void exit() const override {}
-  void act(float/* dt*/, flecs::world &ecs, flecs::entity entity) const override
+  void act(float/* dt*/, flecs::world &ecs, flecs::entity entity, const AIContext &/*ctx*/) const override
   {
     entity.set([&](const Position &pos, Action &a, Activity& activ)
     {
@@ -273,7 +220,7 @@ public:
   SomeActivityState(float dur, Actions a) : duration(dur), action(a) {}
   void enter() const override {}
   void exit() const override {}
-  void act(float dt, flecs::world &ecs, flecs::entity entity) const override
+  void act(float dt, flecs::world &ecs, flecs::entity entity, const AIContext &/*ctx*/) const override
   {
     entity.set([&](const Position &pos, Action &a, Activity &activ)
     {
@@ -300,171 +247,6 @@ public:
 //---------------------------------------transitions---------------------------------------
 
 
-class EnemyAvailableTransition : public StateTransition
-{
-  float triggerDist;
-public:
-  EnemyAvailableTransition(float in_dist) : triggerDist(in_dist) {}
-  bool isAvailable(flecs::world &ecs, flecs::entity entity) const override
-  {
-    static auto enemiesQuery = ecs.query<const Position, const Team>();
-    bool enemiesFound = false;
-    entity.get([&](const Position &pos, const Team &t)
-    {
-      enemiesQuery.each([&](flecs::entity /*enemy*/, const Position &epos, const Team &et)
-      {
-        if (t.team == et.team)
-          return;
-        float curDist = dist(epos, pos);
-        enemiesFound |= curDist <= triggerDist;
-      });
-    });
-    return enemiesFound;
-  }
-};
-
-class AllyAvailableTransition : public StateTransition
-{
-  float triggerDist;
-public:
-  AllyAvailableTransition(float in_dist) : triggerDist(in_dist) {}
-  bool isAvailable(flecs::world &ecs, flecs::entity entity) const override
-  {
-    static auto alliesQuery = ecs.query<const Position, const Team>();
-    bool alliesFound = false;
-    entity.get([&](const Position &pos, const Team &t)
-    {
-      alliesQuery.each([&](flecs::entity /*ally*/, const Position &apos, const Team &at)
-      {
-        if (t.team != at.team)
-          return;
-        float curDist = dist(apos, pos);
-        alliesFound |= (curDist <= triggerDist && curDist > FLT_EPSILON);
-      });
-    });
-    return alliesFound;
-  }
-};
-
-class HitpointsLessThanTransition : public StateTransition
-{
-  float threshold;
-public:
-  HitpointsLessThanTransition(float in_thres) : threshold(in_thres) {}
-  bool isAvailable(flecs::world &ecs, flecs::entity entity) const override
-  {
-    bool hitpointsThresholdReached = false;
-    entity.get([&](const Hitpoints &hp)
-    {
-      hitpointsThresholdReached |= hp.hitpoints < threshold;
-    });
-    return hitpointsThresholdReached;
-  }
-};
-
-class AllyHitpointsLessThanTransition : public StateTransition
-{
-  float threshold;
-  float triggerDist;
-public:
-  AllyHitpointsLessThanTransition(float in_thres, float in_dist) : threshold(in_thres), triggerDist(in_dist) {}
-  bool isAvailable(flecs::world &ecs, flecs::entity entity) const override
-  {
-    bool hitpointsThresholdReached = false;
-    static auto alliesQuery = ecs.query<const Position, const Team, const Hitpoints>();
-    entity.get([&](const Position &pos, const Team &t)
-    {
-      alliesQuery.each([&](flecs::entity /*ally*/, const Position &apos, const Team &at, const Hitpoints &ahp)
-      {
-        if (t.team != at.team)
-          return;
-        float curDist = dist(apos, pos);
-        hitpointsThresholdReached |= (curDist <= triggerDist && curDist > FLT_EPSILON && ahp.hitpoints < threshold);
-      });
-    });
-    return hitpointsThresholdReached;
-  }
-};
-
-class AbilityAvailableTransition : public StateTransition
-{
-  float cooldown;
-public:
-  AbilityAvailableTransition(float cd) : cooldown(cd) {}
-  bool isAvailable(flecs::world &ecs, flecs::entity entity) const override
-  {
-    bool abilityAvailable = false;
-    
-    static auto globalTime = ecs.query<Time>();
-    float cur_time = 0.f;
-    globalTime.each([&](flecs::entity /*e*/, Time &gtime){
-      cur_time = gtime.time;
-    });
-
-    entity.get([&](const Ability &ability)
-    {
-      abilityAvailable |= (ability.lastAbilityUsage + cooldown) < cur_time;
-    });
-    return abilityAvailable;
-  }
-};
-
-class NearTransition : public StateTransition
-{
-  Position position;
-  float triggerDist;
-public:
-  NearTransition(Position pos, float dist) : position(pos), triggerDist(dist) {}
-  bool isAvailable(flecs::world &ecs, flecs::entity entity) const override
-  {
-    static auto enemiesQuery = ecs.query<const Position, const Team>();
-    bool is_near = false;
-    entity.get([&](const Position &pos)
-    {
-      float curDist = dist(position, pos);
-      is_near |= curDist <= triggerDist;
-    });
-    return is_near;
-  }
-};
-
-class ActivityEndTransition : public StateTransition
-{
-public:
-  bool isAvailable(flecs::world &ecs, flecs::entity entity) const override
-  {
-    bool is_end = false;
-    entity.get([&](const Activity &activ)
-    {
-      is_end |= activ.state == A_END;
-    });
-    return is_end;
-  }
-};
-
-class NeedTalkTransition : public StateTransition
-{
-public:
-  bool isAvailable(flecs::world &ecs, flecs::entity entity) const override
-  {
-    bool is_talk = false;
-    entity.get([&](const Action &a, const Activity &activ)
-    {
-      is_talk |= activ.state == A_PROCESS && (a.action == EA_BUY || a.action == EA_SELL);
-    });
-    return is_talk;
-  }
-};
-
-class EnemyReachableTransition : public StateTransition
-{
-public:
-  bool isAvailable(flecs::world &ecs, flecs::entity entity) const override
-  {
-    return false;
-  }
-};
-
 class NegateTransition : public StateTransition
 {
   const StateTransition *transition; // we own it
@@ -472,31 +254,9 @@ public:
   NegateTransition(const StateTransition *in_trans) : transition(in_trans) {}
   ~NegateTransition() override { delete transition; }
 
-  bool isAvailable(flecs::world &ecs, flecs::entity entity) const override
+  bool isAvailable(flecs::world &ecs, flecs::entity entity, const AIContext &ctx) const override
   {
-    return !transition->isAvailable(ecs, entity);
-  }
-};
-
-class TimeTransition : public StateTransition
-{
-  float lhs;
-  float rhs;
-public:
-  TimeTransition(float in_lhs, float in_rhs) : lhs(in_lhs), rhs(in_rhs) {}
-  
-  bool isAvailable(flecs::world &ecs, flecs::entity entity) const override
-  {
-    static auto globalTime = ecs.query<Time>();
-    float cur_time = 0.f;
-    globalTime.each([&](flecs::entity /*e*/, Time &gtime){
-      cur_time = gtime.time;
-    });
-    cur_time = cur_time - 24.0f * floor(cur_time / 72.0f);
-
-    return (cur_time >= lhs && cur_time <= rhs) || \
-           (lhs > rhs && cur_time >= lhs && cur_time <= rhs + 72.0f) || \
-           (lhs > rhs && cur_time >= lhs - 72.0f && cur_time <= rhs);
+    return !transition->isAvailable(ecs, entity, ctx);
   }
 };
 
@@ -512,9 +272,9 @@ public:
     delete rhs;
   }
 
-  bool isAvailable(flecs::world &ecs, flecs::entity entity) const override
+  bool isAvailable(flecs::world &ecs, flecs::entity entity, const AIContext &ctx) const override
   {
-    return lhs->isAvailable(ecs, entity) && rhs->isAvailable(ecs, entity);
+    return lhs->isAvailable(ecs, entity, ctx) && rhs->isAvailable(ecs, entity, ctx);
   }
 };
 
@@ -530,9 +290,9 @@ public:
     delete rhs;
   }
 
-  bool isAvailable(flecs::world &ecs, flecs::entity entity) const override
+  bool isAvailable(flecs::world &ecs, flecs::entity entity, const AIContext &ctx) const override
   {
-    return lhs->isAvailable(ecs, entity) || rhs->isAvailable(ecs, entity);
+    return lhs->isAvailable(ecs, entity, ctx) || rhs->isAvailable(ecs, entity, ctx);
   }
 };
 
@@ -594,50 +354,50 @@ State *create_activity_state(float dur, Actions a)
 // transitions
 StateTransition *create_enemy_available_transition(float dist)
 {
-  return new EnemyAvailableTransition(dist);
+  return create_predicate_transition(EnemyWithin{dist});
 }
 
 StateTransition *create_ally_available_transition(float dist)
 {
-  return new AllyAvailableTransition(dist);
+  return create_predicate_transition(AllyWithin{dist});
 }
 
 StateTransition *create_enemy_reachable_transition()
 {
-  return new EnemyReachableTransition();
+  return create_predicate_transition(Never{});
 }
 
 StateTransition *create_hitpoints_less_than_transition(float thres)
 {
-  return new HitpointsLessThanTransition(thres);
+  return create_predicate_transition(HpBelow{thres});
 }
 
 StateTransition *create_ally_hitpoints_less_than_transition(float thres, float dist)
 {
-  return new AllyHitpointsLessThanTransition(thres, dist);
+  return create_predicate_transition(AllyHpBelow{thres, dist});
 }
 
 StateTransition *create_ability_available_transition(float cd)
 {
-  return new AbilityAvailableTransition(cd);
+  return create_predicate_transition(AbilityReady{cd});
 }
 
 StateTransition *create_near_transition(Position pos, float dist)
 {
-  return new NearTransition(pos, dist);
+  return create_predicate_transition(Near{pos, dist});
 }
 
 StateTransition *create_activity_end_transition()
 {
-  return new ActivityEndTransition();
+  return create_predicate_transition(ActivityEnded{});
 }
 
 StateTransition *create_time_transition(float lhs, float rhs) {
-  return new TimeTransition(lhs, rhs);
+  return create_predicate_transition(TimeBetween{lhs, rhs});
 }
 
 StateTransition *create_need_talk_transition() {
-  return new NeedTalkTransition();
+  return create_predicate_transition(NeedTalk{});
 }
 
 StateTransition *create_negate_transition(StateTransition *in)
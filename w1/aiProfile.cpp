@@ -0,0 +1,104 @@
+#include "aiProfile.h"
+#include <cstdio>
+
+#if AI_PROFILE
+
+#include <map>
+#include <string>
+#if defined(__GNUG__)
+#include <cxxabi.h>
+#include <cstdlib>
+#endif
+
+static std::vector<const MachineProfile*> machineProfiles;
+
+void register_machine_profile(MachineProfile &profile)
+{
+  if (profile.registered)
+    return;
+  profile.registered = true;
+  machineProfiles.push_back(&profile);
+}
+
+static std::string demangle(const char *name)
+{
+#if defined(__GNUG__)
+  int status = 0;
+  char *res = abi::__cxa_demangle(name, nullptr, nullptr, &status);
+  if (status == 0 && res)
+  {
+    std::string str = res;
+    free(res);
+    return str;
+  }
+#endif
+  return name;
+}
+
+// names are used as CSV fields, template arguments have commas in them
+static std::string csv_field(const std::string &str)
+{
+  std::string res = "\"";
+  for (char c : str)
+  {
+    if (c == '"')
+      res += '"';
+    res += c;
+  }
+  return res + "\"";
+}
+
+bool dump_ai_profile(const char *path)
+{
+  FILE *f = fopen(path, "w");
+  if (!f)
+    return false;
+
+  struct PredicateTotals
+  {
+    uint64_t evals = 0;
+    uint64_t fires = 0;
+    uint64_t evalNs = 0;
+  };
+  std::map<std::string, PredicateTotals> byType;
+
+  fprintf(f, "kind,archetype,from,to,type,ticks,evals,fires,eval_ns,eval_ns_avg\n");
+  for (const MachineProfile *profile : machineProfiles)
+  {
+    const std::string archetype = csv_field(profile->archetype);
+    for (size_t i = 0; i < profile->states.size(); ++i)
+    {
+      const MachineProfile::StateCounters &state = profile->states[i];
+      fprintf(f, "state,%s,%zu,,%s,%llu,,,,\n", archetype.c_str(), i,
+              csv_field(demangle(state.type)).c_str(), static_cast<unsigned long long>(state.ticks));
+    }
+    for (const MachineProfile::TransitionCounters &trans : profile->transitions)
+    {
+      const std::string type = demangle(trans.type);
+      fprintf(f, "transition,%s,%d,%d,%s,,%llu,%llu,%llu,%.1f\n", archetype.c_str(), trans.from, trans.to,
+              csv_field(type).c_str(), static_cast<unsigned long long>(trans.evals),
+              static_cast<unsigned long long>(trans.fires), static_cast<unsigned long long>(trans.evalNs),
+              trans.evals > 0 ? double(trans.evalNs) / double(trans.evals) : 0.0);
+      PredicateTotals &totals = byType[type];
+      totals.evals += trans.evals;
+      totals.fires += trans.fires;
+      totals.evalNs += trans.evalNs;
+    }
+  }
+  for (const auto &[type, totals] : byType)
+    fprintf(f, "predicate,,,,%s,,%llu,%llu,%llu,%.1f\n", csv_field(type).c_str(),
+            static_cast<unsigned long long>(totals.evals), static_cast<unsigned long long>(totals.fires),
+            static_cast<unsigned long long>(totals.evalNs),
+            totals.evals > 0 ? double(totals.evalNs) / double(totals.evals) : 0.0);
+  fclose(f);
+  return true;
+}
+
+#else
+
+bool dump_ai_profile(const char *)
+{
+  return false;
+}
+
+#endif
@@ -0,0 +1,82 @@
+#pragma once
+#include <cstdint>
+#include <typeinfo>
+
+// Opt-in counters for state machines: ticks spent in every state, how often every
+// transition was checked and fired and how long its check took.
+// They are aggregated per archetype (machine desc) and dumped as CSV.
+// Configure with -DAI_PROFILE=ON to enable, otherwise all of it compiles out.
+#ifndef AI_PROFILE
+#define AI_PROFILE 0
+#endif
+
+#if AI_PROFILE
+
+#include <chrono>
+#include <vector>
+
+#define AI_PROFILE_ONLY(...) __VA_ARGS__
+
+class ProfileTimer
+{
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+public:
+  uint64_t elapsedNs() const
+  {
+    return uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count());
+  }
+};
+
+// Counters of one machine desc, shared by all entities using it
+struct MachineProfile
+{
+  struct StateCounters
+  {
+    const char *type = "";
+    uint64_t ticks = 0;
+  };
+  struct TransitionCounters
+  {
+    int from = 0;
+    int to = 0;
+    const char *type = "";
+    uint64_t evals = 0;
+    uint64_t fires = 0;
+    uint64_t evalNs = 0;
+  };
+
+  const char *archetype = "";
+  bool registered = false;
+  std::vector<StateCounters> states;
+  std::vector<TransitionCounters> transitions;
+
+  void onTransitionEval(size_t idx, uint64_t ns, bool fired)
+  {
+    TransitionCounters &counters = transitions[idx];
+    counters.evals++;
+    counters.evalNs += ns;
+    counters.fires += fired ? 1 : 0;
+  }
+  void onStateTick(size_t idx) { states[idx].ticks++; }
+};
+
+// profile has to stay at the same address from now on
+void register_machine_profile(MachineProfile &profile);
+
+#else
+
+#define AI_PROFILE_ONLY(...)
+
+#endif
+
+constexpr const char *ai_profile_path = "ai_profile.csv"; // dumped on exit and on F9
+
+// Writes all collected counters as CSV, returns false if profiling is compiled out or file can't be written
+bool dump_ai_profile(const char *path);
+
+// type name used for states and transitions in the dump
+template<typename T>
+inline const char *ai_profile_type_name(const T &value)
+{
+  return typeid(value).name();
+}
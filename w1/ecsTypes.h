@@ -1,5 +1,8 @@
 #pragma once
 
+#include <cfloat>
+#include <flecs.h>
+
 struct Position;
 struct MovePos;
 
@@ -145,4 +148,26 @@ struct Activity
 {
   float last_time;
   ActivityState state;
-};
\ No newline at end of file
+};
+
+constexpr size_t max_sensed_allies = 8;
+
+// per-turn snapshot of surroundings, filled by sensors before NPCs think
+struct WorldInfo
+{
+  struct AllyInfo
+  {
+    flecs::entity ally;
+    Position pos;
+    float dist = FLT_MAX;
+  };
+
+  flecs::entity closestEnemy;
+  Position closestEnemyPos;
+  float closestEnemyDist = FLT_MAX;
+
+  // closest allies sorted by distance, entity itself (and anyone on its tile) excluded.
+  // Only the closest max_sensed_allies are kept, see for_each_ally_within for all allies in range
+  AllyInfo allies[max_sensed_allies];
+  size_t numAllies = 0;
+};
@@ -1,70 +1,173 @@
 #include "hierarchicalStateMachine.h"
+#include <cassert>
 
-HierarchicalStateMachine::~HierarchicalStateMachine()
+HierarchicalStateMachineBuilder::~HierarchicalStateMachineBuilder()
 {
-  for (HierarchicalStateMachine* state : states)
+  for (HierarchicalStateMachineBuilder* state : states)
     delete state;
   states.clear();
-  for (auto &transList : transitions)
-    for (auto &transition : transList)
-      delete transition.first;
+  for (const StateTransition *transition : runtimeTransitions)
+    delete transition;
+  runtimeTransitions.clear();
   transitions.clear();
+  delete innerstate;
 }
 
-void HierarchicalStateMachine::enter() const {
-  if (innerstate != nullptr)
-    innerstate->enter();
-  else 
-    states[curStateIdx]->enter();
+int HierarchicalStateMachineBuilder::addState(State *st)
+{
+  int idx = int(states.size());
+  states.push_back(new HierarchicalStateMachineBuilder(st));
+  transitions.push_back(std::vector<std::pair<TransitionPredicate, int>>());
+  return idx;
 }
 
-void HierarchicalStateMachine::exit() const {
-  if (innerstate != nullptr)
-    innerstate->exit();
-  else 
-    states[curStateIdx]->exit();
+int HierarchicalStateMachineBuilder::addState(HierarchicalStateMachineBuilder *st)
+{
+  int idx = int(states.size());
+  states.push_back(st);
+  transitions.push_back(std::vector<std::pair<TransitionPredicate, int>>());
+  return idx;
 }
 
-void HierarchicalStateMachine::act(float dt, flecs::world &ecs, flecs::entity entity)
+void HierarchicalStateMachineBuilder::addTransition(StateTransition *trans, int from, int to)
 {
-  if (innerstate != nullptr) {
-    innerstate->act(dt, ecs, entity);
-    return;
+  runtimeTransitions.push_back(trans);
+  addTransition(RuntimeTransition{trans}, from, to);
+}
+
+void HierarchicalStateMachineBuilder::flatten(HierarchicalStateMachineDesc &desc,
+                                              std::vector<std::vector<std::pair<TransitionPredicate, int>>> &node_transitions,
+                                              size_t depth, size_t *path)
+{
+  assert(depth < max_hsm_depth);
+  // siblings get consecutive nodes, so transitions can refer to them before they are flattened
+  const size_t firstNode = desc.initialLeaves.size();
+  desc.initialLeaves.resize(desc.initialLeaves.size() + states.size(), size_t(-1));
+  node_transitions.resize(desc.initialLeaves.size());
+  desc.runtimeTransitions.insert(desc.runtimeTransitions.end(), runtimeTransitions.begin(), runtimeTransitions.end());
+  runtimeTransitions.clear();
+  for (size_t i = 0; i < states.size(); ++i)
+  {
+    const size_t node = firstNode + i;
+    for (std::pair<TransitionPredicate, int> &transition : transitions[i])
+      node_transitions[node].push_back(std::make_pair(transition.first, int(firstNode) + transition.second));
+    transitions[i].clear();
+
+    path[depth] = node;
+    HierarchicalStateMachineBuilder *child = states[i];
+    if (child->innerstate != nullptr || child->states.empty())
+    {
+      HierarchicalStateMachineDesc::Leaf leaf;
+      leaf.state = child->innerstate;
+      leaf.depth = depth + 1;
+      for (size_t d = 0; d <= depth; ++d)
+        leaf.path[d] = path[d];
+      desc.initialLeaves[node] = desc.leaves.size();
+      desc.leaves.push_back(leaf);
+      child->innerstate = nullptr;
+    }
+    else
+    {
+      const size_t firstChildNode = desc.initialLeaves.size();
+      child->flatten(desc, node_transitions, depth + 1, path);
+      desc.initialLeaves[node] = desc.initialLeaves[firstChildNode];
+    }
   }
-  if (curStateIdx < states.size())
+}
+
+HierarchicalStateMachineDesc HierarchicalStateMachineBuilder::compile()
+{
+  HierarchicalStateMachineDesc desc;
+  desc.name = name;
+  std::vector<std::vector<std::pair<TransitionPredicate, int>>> nodeTransitions;
+  size_t path[max_hsm_depth];
+  flatten(desc, nodeTransitions, 0, path);
+  for (const auto &transList : nodeTransitions)
   {
-    for (const std::pair<StateTransition*, int> &transition : transitions[curStateIdx])
-      if (transition.first->isAvailable(ecs, entity))
-      {
-        states[curStateIdx]->exit();
-        curStateIdx = transition.second;
-        states[curStateIdx]->enter();
-        break;
-      }
-    states[curStateIdx]->act(dt, ecs, entity);
+    for (const std::pair<TransitionPredicate, int> &transition : transList)
+      desc.transitions.push_back(HierarchicalStateMachineDesc::Transition{transition.first, size_t(transition.second)});
+    desc.transitionOffsets.push_back(desc.transitions.size());
   }
-  else
-    curStateIdx = 0;
+  for (HierarchicalStateMachineBuilder* state : states)
+    delete state;
+  states.clear();
+  transitions.clear();
+  return desc;
 }
 
-int HierarchicalStateMachine::addState(State *st)
+HierarchicalStateMachineDesc::~HierarchicalStateMachineDesc()
 {
-  int idx = states.size();
-  states.push_back(new HierarchicalStateMachine(st));
-  transitions.push_back(std::vector<std::pair<StateTransition*, int>>());
-  return idx;
+  for (Leaf &leaf : leaves)
+    delete leaf.state;
+  leaves.clear();
+  for (const StateTransition *transition : runtimeTransitions)
+    delete transition;
+  runtimeTransitions.clear();
+  transitions.clear();
 }
 
-int HierarchicalStateMachine::addState(HierarchicalStateMachine *st)
+#if AI_PROFILE
+MachineProfile &HierarchicalStateMachineDesc::getProfile() const
 {
-  int idx = states.size();
-  states.push_back(st);
-  transitions.push_back(std::vector<std::pair<StateTransition*, int>>());
-  return idx;
+  if (!profile.registered)
+  {
+    profile.archetype = name;
+    profile.states.resize(leaves.size());
+    for (size_t i = 0; i < leaves.size(); ++i)
+      profile.states[i].type = leaves[i].state ? ai_profile_type_name(*leaves[i].state) : "";
+    profile.transitions.resize(transitions.size());
+    for (size_t from = 0; from + 1 < transitionOffsets.size(); ++from)
+      for (size_t i = transitionOffsets[from]; i < transitionOffsets[from + 1]; ++i)
+      {
+        profile.transitions[i].from = int(from);
+        profile.transitions[i].to = int(transitions[i].to);
+        profile.transitions[i].type = transitions[i].predicate.typeName();
+      }
+    register_machine_profile(profile);
+  }
+  return profile;
 }
+#endif
 
-void HierarchicalStateMachine::addTransition(StateTransition *trans, int from, int to)
+HierarchicalStateMachine::HierarchicalStateMachine(const HierarchicalStateMachineDesc *in_desc) : desc(in_desc)
 {
-  transitions[from].push_back(std::make_pair(trans, to));
+  resumeLeaves.resize(desc->numNodes());
+  for (size_t node = 0; node < desc->numNodes(); ++node)
+    resumeLeaves[node] = desc->initialLeaf(node);
+  if (desc->numNodes() > 0)
+    curLeaf = desc->initialLeaf(0);
 }
 
+void HierarchicalStateMachine::act(float dt, flecs::world &ecs, flecs::entity entity, const AIContext &ctx)
+{
+  if (!desc || desc->numLeaves() == 0)
+    return;
+  AI_PROFILE_ONLY(MachineProfile &profile = desc->getProfile();)
+  // at every level at most one transition fires, lower levels are checked with the leaf we ended up in
+  for (size_t depth = 0; depth < desc->getLeaf(curLeaf).depth; ++depth)
+  {
+    const size_t node = desc->getLeaf(curLeaf).path[depth];
+    for (const HierarchicalStateMachineDesc::Transition *transition = desc->transitionsBegin(node);
+         transition != desc->transitionsEnd(node); ++transition)
+    {
+      AI_PROFILE_ONLY(const ProfileTimer evalTimer;)
+      const bool available = transition->predicate(ecs, entity, ctx);
+      AI_PROFILE_ONLY(profile.onTransitionEval(size_t(transition - desc->transitionsBegin(0)), evalTimer.elapsedNs(), available);)
+      if (available)
+      {
+        if (const State *state = desc->getLeaf(curLeaf).state)
+          state->exit();
+        curLeaf = resumeLeaves[transition->to];
+        const HierarchicalStateMachineDesc::Leaf &leaf = desc->getLeaf(curLeaf);
+        for (size_t d = 0; d < leaf.depth; ++d)
+          resumeLeaves[leaf.path[d]] = curLeaf;
+        if (leaf.state)
+          leaf.state->enter();
+        break;
+      }
+    }
+  }
+  AI_PROFILE_ONLY(profile.onStateTick(curLeaf);)
+  if (const State *state = desc->getLeaf(curLeaf).state)
+    state->act(dt, ecs, entity, ctx);
+}
@@ -1,40 +1,109 @@
 #pragma once
 #include <vector>
 #include <flecs.h>
-#include <iostream>
 #include "stateMachine.h"
 
-class HierarchicalStateMachine
+constexpr size_t max_hsm_depth = 8;
+
+class HierarchicalStateMachineDesc;
+
+// Authoring form of a hierarchical state machine, nested machines are added as states.
+// It is only used to describe the hierarchy, compile() flattens it into a shared desc.
+class HierarchicalStateMachineBuilder
 {
-  int curStateIdx = 0;
-  std::vector<HierarchicalStateMachine*> states;
-  std::vector<std::vector<std::pair<StateTransition*, int>>> transitions;
+  std::vector<HierarchicalStateMachineBuilder*> states;
+  std::vector<std::vector<std::pair<TransitionPredicate, int>>> transitions;
   State* innerstate = nullptr;
+  std::vector<const StateTransition*> runtimeTransitions;
+  const char *name = "";
+
+  void flatten(HierarchicalStateMachineDesc &desc, std::vector<std::vector<std::pair<TransitionPredicate, int>>> &node_transitions,
+               size_t depth, size_t *path);
 public:
-  HierarchicalStateMachine() = default;
-  HierarchicalStateMachine(State *st) : innerstate(st) {};
-  HierarchicalStateMachine(const HierarchicalStateMachine &sm) = default;
-  HierarchicalStateMachine(HierarchicalStateMachine &&sm) = default;
+  HierarchicalStateMachineBuilder() = default;
+  HierarchicalStateMachineBuilder(State *st) : innerstate(st) {};
+  HierarchicalStateMachineBuilder(const HierarchicalStateMachineBuilder &sm) = delete;
+  HierarchicalStateMachineBuilder(HierarchicalStateMachineBuilder &&sm) = delete;
+
+  ~HierarchicalStateMachineBuilder();
 
-  ~HierarchicalStateMachine();
+  HierarchicalStateMachineBuilder &operator=(const HierarchicalStateMachineBuilder &sm) = delete;
+  HierarchicalStateMachineBuilder &operator=(HierarchicalStateMachineBuilder &&sm) = delete;
 
-  HierarchicalStateMachine &operator=(const HierarchicalStateMachine &sm) = default;
-  HierarchicalStateMachine &operator=(HierarchicalStateMachine &&sm) = default;
-  
-  void enter() const;
-  void exit() const;
-  void act(float dt, flecs::world &ecs, flecs::entity entity);
+  void setName(const char *in_name) { name = in_name; }
 
   int addState(State *st);
-  int addState(HierarchicalStateMachine *st);
-  void addTransition(StateTransition *trans, int from, int to);
-
-  void get_state() {
-    std::cout << curStateIdx << "-";
-    if (innerstate == nullptr)
-      states[curStateIdx]->get_state();
-    else
-      std::cout << "inner" << std::endl;
-  }
+  int addState(HierarchicalStateMachineBuilder *st);
+  void addTransition(StateTransition *trans, int from, int to); // we own it
+  template<typename Pred>
+  void addTransition(const Pred &pred, int from, int to) { transitions[size_t(from)].push_back(std::make_pair(TransitionPredicate(pred), to)); }
+
+  // takes ownership of all states and transitions, builder is left empty
+  HierarchicalStateMachineDesc compile();
+};
+
+// Flattened hierarchy shared by all entities of an archetype.
+// Every nested machine and every state is a node, transitions are stored flat and grouped
+// by source node. Leaves keep their full path from the top level, so a tick is a single walk
+// over it. Nested machines have no enter/exit logic of their own, so switching between
+// any two nodes is exiting the current leaf and entering the one resumed in the target.
+class HierarchicalStateMachineDesc
+{
+public:
+  struct Transition
+  {
+    TransitionPredicate predicate;
+    size_t to; // sibling node
+  };
+
+  struct Leaf
+  {
+    const State *state = nullptr; // we own it, null for an empty nested machine
+    size_t depth = 0;
+    size_t path[max_hsm_depth] = {}; // nodes from the top level down to the leaf itself
+  };
+
+  HierarchicalStateMachineDesc() = default;
+  HierarchicalStateMachineDesc(const HierarchicalStateMachineDesc &desc) = delete;
+  HierarchicalStateMachineDesc(HierarchicalStateMachineDesc &&desc) = default;
+
+  ~HierarchicalStateMachineDesc();
+
+  HierarchicalStateMachineDesc &operator=(const HierarchicalStateMachineDesc &desc) = delete;
+  HierarchicalStateMachineDesc &operator=(HierarchicalStateMachineDesc &&desc) = default;
+
+  size_t numNodes() const { return initialLeaves.size(); }
+  size_t numLeaves() const { return leaves.size(); }
+  const Leaf &getLeaf(size_t idx) const { return leaves[idx]; }
+  // leaf a node starts from when it is entered for the first time
+  size_t initialLeaf(size_t node) const { return initialLeaves[node]; }
+  const Transition *transitionsBegin(size_t from) const { return transitions.data() + transitionOffsets[from]; }
+  const Transition *transitionsEnd(size_t from) const { return transitions.data() + transitionOffsets[from + 1]; }
+  const char *getName() const { return name; }
+  // states in the profile are leaves, transitions go between nodes
+  AI_PROFILE_ONLY(MachineProfile &getProfile() const;)
+
+private:
+  friend class HierarchicalStateMachineBuilder;
+
+  const char *name = "";
+  std::vector<Leaf> leaves;
+  std::vector<size_t> initialLeaves;
+  std::vector<Transition> transitions;
+  std::vector<size_t> transitionOffsets = {0};
+  std::vector<const StateTransition*> runtimeTransitions;
+  AI_PROFILE_ONLY(mutable MachineProfile profile;)
 };
 
+// Per-entity part of the hierarchical state machine
+struct HierarchicalStateMachine
+{
+  const HierarchicalStateMachineDesc *desc = nullptr;
+  size_t curLeaf = 0;
+  std::vector<size_t> resumeLeaves; // per node, the leaf which was active last time in it
+
+  HierarchicalStateMachine() = default;
+  HierarchicalStateMachine(const HierarchicalStateMachineDesc *in_desc);
+
+  void act(float dt, flecs::world &ecs, flecs::entity entity, const AIContext &ctx);
+};
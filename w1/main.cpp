@@ -9,6 +9,7 @@
 #include <flecs.h>
 #include "ecsTypes.h"
 #include "roguelike.h"
+#include "aiProfile.h"
 
 int main(int argc, const char **argv)
 {
@@ -57,6 +58,7 @@ int main(int argc, const char **argv)
     // Advance to next frame. Process submitted rendering primitives.
     bgfx::frame();
   }
+  AI_PROFILE_ONLY(dump_ai_profile(ai_profile_path);)
   ddShutdown();
   bgfx::shutdown();
   app_terminate();
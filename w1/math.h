@@ -0,0 +1,14 @@
+#pragma once
+
+#include <cmath>
+
+
+template<typename T>
+inline T sqr(T a){ return a*a; }
+
+template<typename T, typename U>
+inline float dist_sq(const T &lhs, const U &rhs) { return float(sqr(lhs.x - rhs.x) + sqr(lhs.y - rhs.y)); }
+
+template<typename T, typename U>
+inline float dist(const T &lhs, const U &rhs) { return sqrtf(dist_sq(lhs, rhs)); }
+
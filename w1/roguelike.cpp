@@ -4,6 +4,11 @@
 #include "stateMachine.h"
 #include "hierarchicalStateMachine.h"
 #include "aiLibrary.h"
+#include "aiProfile.h"
+#include "transitionPredicates.h"
+#include "math.h"
+#include "spatialHash.h"
+#include "tileOccupancy.h"
 #include "app.h"
 #include <cfloat>
 #include <cmath>
@@ -13,48 +18,62 @@
 
 static void add_patrol_attack_flee_sm(flecs::entity entity)
 {
-  entity.get([](StateMachine &sm)
+  static const StateMachineDesc desc = []()
   {
+    StateMachineDesc sm;
+    sm.setName("patrol_attack_flee");
     int patrol = sm.addState(create_patrol_state(3.f));
     int moveToEnemy = sm.addState(create_move_to_enemy_state());
     int fleeFromEnemy = sm.addState(create_flee_from_enemy_state());
 
-    sm.addTransition(create_enemy_available_transition(3.f), patrol, moveToEnemy);
-    sm.addTransition(create_negate_transition(create_enemy_available_transition(5.f)), moveToEnemy, patrol);
+    sm.addTransition(EnemyWithin{3.f}, patrol, moveToEnemy);
+    sm.addTransition(Not{EnemyWithin{5.f}}, moveToEnemy, patrol);
 
-    sm.addTransition(create_and_transition(create_hitpoints_less_than_transition(60.f), create_enemy_available_transition(5.f)),
+    sm.addTransition(And{HpBelow{60.f}, EnemyWithin{5.f}},
                      moveToEnemy, fleeFromEnemy);
-    sm.addTransition(create_and_transition(create_hitpoints_less_than_transition(60.f), create_enemy_available_transition(3.f)),
+    sm.addTransition(And{HpBelow{60.f}, EnemyWithin{3.f}},
                      patrol, fleeFromEnemy);
 
-    sm.addTransition(create_negate_transition(create_enemy_available_transition(7.f)), fleeFromEnemy, patrol);
-  });
+    sm.addTransition(Not{EnemyWithin{7.f}}, fleeFromEnemy, patrol);
+    return sm;
+  }();
+  entity.set(StateMachine{&desc});
 }
 
 static void add_patrol_flee_sm(flecs::entity entity)
 {
-  entity.get([](StateMachine &sm)
+  static const StateMachineDesc desc = []()
   {
+    StateMachineDesc sm;
+    sm.setName("patrol_flee");
     int patrol = sm.addState(create_patrol_state(3.f));
     int fleeFromEnemy = sm.addState(create_flee_from_enemy_state());
 
-    sm.addTransition(create_enemy_available_transition(3.f), patrol, fleeFromEnemy);
-    sm.addTransition(create_negate_transition(create_enemy_available_transition(5.f)), fleeFromEnemy, patrol);
-  });
+    sm.addTransition(EnemyWithin{3.f}, patrol, fleeFromEnemy);
+    sm.addTransition(Not{EnemyWithin{5.f}}, fleeFromEnemy, patrol);
+    return sm;
+  }();
+  entity.set(StateMachine{&desc});
 }
 
 static void add_attack_sm(flecs::entity entity)
 {
-  entity.get([](StateMachine &sm)
+  static const StateMachineDesc desc = []()
   {
+    StateMachineDesc sm;
+    sm.setName("attack");
     sm.addState(create_move_to_enemy_state());
-  });
+    return sm;
+  }();
+  entity.set(StateMachine{&desc});
 }
 
 static void add_barbarian_sm(flecs::entity entity)
 {
-  entity.get([](StateMachine &sm)
+  static const StateMachineDesc desc = []()
   {
+    StateMachineDesc sm;
+    sm.setName("barbarian");
     // normal patrol
     int patrol = sm.addState(create_patrol_state(3.f));
     int moveToEnemy = sm.addState(create_move_to_enemy_state());
@@ -64,26 +83,30 @@ static void add_barbarian_sm(flecs::entity entity)
     int endlessMove = sm.addState(create_move_to_enemy_state());
     
 
-    sm.addTransition(create_hitpoints_less_than_transition(50.f), moveToEnemy, endlessMove);
-    sm.addTransition(create_hitpoints_less_than_transition(50.f), patrol, endlessMove);
-    sm.addTransition(create_hitpoints_less_than_transition(50.f), fleeFromEnemy, endlessMove);
+    sm.addTransition(HpBelow{50.f}, moveToEnemy, endlessMove);
+    sm.addTransition(HpBelow{50.f}, patrol, endlessMove);
+    sm.addTransition(HpBelow{50.f}, fleeFromEnemy, endlessMove);
 
-    sm.addTransition(create_enemy_available_transition(3.f), patrol, moveToEnemy);
-    sm.addTransition(create_negate_transition(create_enemy_available_transition(5.f)), moveToEnemy, patrol);
+    sm.addTransition(EnemyWithin{3.f}, patrol, moveToEnemy);
+    sm.addTransition(Not{EnemyWithin{5.f}}, moveToEnemy, patrol);
 
-    sm.addTransition(create_and_transition(create_hitpoints_less_than_transition(70.f), create_enemy_available_transition(5.f)),
+    sm.addTransition(And{HpBelow{70.f}, EnemyWithin{5.f}},
                      moveToEnemy, fleeFromEnemy);
-    sm.addTransition(create_and_transition(create_hitpoints_less_than_transition(70.f), create_enemy_available_transition(3.f)),
+    sm.addTransition(And{HpBelow{70.f}, EnemyWithin{3.f}},
                      patrol, fleeFromEnemy);
 
-    sm.addTransition(create_negate_transition(create_enemy_available_transition(7.f)), fleeFromEnemy, patrol);
-  });
+    sm.addTransition(Not{EnemyWithin{7.f}}, fleeFromEnemy, patrol);
+    return sm;
+  }();
+  entity.set(StateMachine{&desc});
 }
 
 static void add_healer_sm(flecs::entity entity)
 {
-  entity.get([](StateMachine &sm)
+  static const StateMachineDesc desc = []()
   {
+    StateMachineDesc sm;
+    sm.setName("healer");
     // normal patrol
     int patrol = sm.addState(create_patrol_state(3.f));
     int moveToEnemy = sm.addState(create_move_to_enemy_state());
@@ -92,66 +115,74 @@ static void add_healer_sm(flecs::entity entity)
     // heal state
     int heal = sm.addState(create_heal_state(20.f));
 
-    sm.addTransition(create_and_transition(create_hitpoints_less_than_transition(50.f), create_ability_available_transition(5.0f)),
+    sm.addTransition(And{HpBelow{50.f}, AbilityReady{5.0f}},
                      moveToEnemy, heal);
-    sm.addTransition(create_and_transition(create_hitpoints_less_than_transition(50.f), create_ability_available_transition(5.0f)),
+    sm.addTransition(And{HpBelow{50.f}, AbilityReady{5.0f}},
                      patrol, heal);
-    sm.addTransition(create_and_transition(create_hitpoints_less_than_transition(50.f), create_ability_available_transition(5.0f)),
+    sm.addTransition(And{HpBelow{50.f}, AbilityReady{5.0f}},
                      fleeFromEnemy, heal);
 
-    sm.addTransition(create_enemy_available_transition(3.f), patrol, moveToEnemy);
-    sm.addTransition(create_enemy_available_transition(3.f), heal, moveToEnemy);
-    sm.addTransition(create_negate_transition(create_enemy_available_transition(5.f)), moveToEnemy, patrol);
-    sm.addTransition(create_negate_transition(create_ability_available_transition(5.0f)), heal, patrol);
+    sm.addTransition(EnemyWithin{3.f}, patrol, moveToEnemy);
+    sm.addTransition(EnemyWithin{3.f}, heal, moveToEnemy);
+    sm.addTransition(Not{EnemyWithin{5.f}}, moveToEnemy, patrol);
+    sm.addTransition(Not{AbilityReady{5.0f}}, heal, patrol);
 
-    sm.addTransition(create_and_transition(create_hitpoints_less_than_transition(70.f), create_enemy_available_transition(5.f)),
+    sm.addTransition(And{HpBelow{70.f}, EnemyWithin{5.f}},
                      moveToEnemy, fleeFromEnemy);
-    sm.addTransition(create_and_transition(create_hitpoints_less_than_transition(70.f), create_enemy_available_transition(3.f)),
+    sm.addTransition(And{HpBelow{70.f}, EnemyWithin{3.f}},
                      patrol, fleeFromEnemy);
-    sm.addTransition(create_and_transition(create_hitpoints_less_than_transition(70.f), create_enemy_available_transition(5.f)),
+    sm.addTransition(And{HpBelow{70.f}, EnemyWithin{5.f}},
                      heal, fleeFromEnemy);
     
-    sm.addTransition(create_negate_transition(create_enemy_available_transition(7.f)), fleeFromEnemy, patrol);
-  });
+    sm.addTransition(Not{EnemyWithin{7.f}}, fleeFromEnemy, patrol);
+    return sm;
+  }();
+  entity.set(StateMachine{&desc});
 }
 
 static void add_cleric_sm(flecs::entity entity)
 {
-  entity.get([](StateMachine &sm)
+  static const StateMachineDesc desc = []()
   {
+    StateMachineDesc sm;
+    sm.setName("cleric");
     int patrol = sm.addState(create_patrol_state(3.f));
     int moveToEnemy = sm.addState(create_move_to_enemy_state());
     int moveToAlly = sm.addState(create_move_to_ally_state());
     int heal = sm.addState(create_ally_heal_state(20.f, 2.0f));
 
-    sm.addTransition(create_and_transition(create_ally_hitpoints_less_than_transition(50.f, 1.f), create_ability_available_transition(10.0f)),
+    sm.addTransition(And{AllyHpBelow{50.f, 1.f}, AbilityReady{10.0f}},
                      moveToEnemy, heal);
-    sm.addTransition(create_and_transition(create_ally_hitpoints_less_than_transition(50.f, 1.f), create_ability_available_transition(10.0f)),
+    sm.addTransition(And{AllyHpBelow{50.f, 1.f}, AbilityReady{10.0f}},
                      moveToAlly, heal);
-    sm.addTransition(create_and_transition(create_ally_hitpoints_less_than_transition(50.f, 1.f), create_ability_available_transition(10.0f)),
+    sm.addTransition(And{AllyHpBelow{50.f, 1.f}, AbilityReady{10.0f}},
                      patrol, heal);
 
-    sm.addTransition(create_enemy_available_transition(3.f), patrol, moveToEnemy);
-    sm.addTransition(create_enemy_available_transition(3.f), moveToAlly, moveToEnemy);
-    sm.addTransition(create_and_transition(create_negate_transition(create_ability_available_transition(10.0f)), create_enemy_available_transition(3.f)), 
+    sm.addTransition(EnemyWithin{3.f}, patrol, moveToEnemy);
+    sm.addTransition(EnemyWithin{3.f}, moveToAlly, moveToEnemy);
+    sm.addTransition(And{Not{AbilityReady{10.0f}}, EnemyWithin{3.f}}, 
                      heal, moveToEnemy);
 
-    sm.addTransition(create_and_transition(create_negate_transition(create_enemy_available_transition(5.f)), create_ally_available_transition(3.0f)), 
+    sm.addTransition(And{Not{EnemyWithin{5.f}}, AllyWithin{3.0f}}, 
                      moveToEnemy, patrol);
-    sm.addTransition(create_ally_available_transition(3.0f), moveToAlly, patrol);
-    sm.addTransition(create_and_transition(create_negate_transition(create_ability_available_transition(10.0f)), create_ally_available_transition(3.0f)), 
+    sm.addTransition(AllyWithin{3.0f}, moveToAlly, patrol);
+    sm.addTransition(And{Not{AbilityReady{10.0f}}, AllyWithin{3.0f}}, 
                      heal, patrol);
 
-    sm.addTransition(create_ally_hitpoints_less_than_transition(45.f, 10.0f), moveToEnemy, moveToAlly);
-    sm.addTransition(create_negate_transition(create_ally_available_transition(3.f)), patrol, moveToAlly);
-    sm.addTransition(create_negate_transition(create_ally_available_transition(2.f)), heal, moveToAlly);
-  });
+    sm.addTransition(AllyHpBelow{45.f, 10.0f}, moveToEnemy, moveToAlly);
+    sm.addTransition(Not{AllyWithin{3.f}}, patrol, moveToAlly);
+    sm.addTransition(Not{AllyWithin{2.f}}, heal, moveToAlly);
+    return sm;
+  }();
+  entity.set(StateMachine{&desc});
 }
 
 static void add_crafter_sm(flecs::entity entity)
 {
-  entity.get([](HierarchicalStateMachine &sm)
+  static const HierarchicalStateMachineDesc desc = []()
   {
+    HierarchicalStateMachineBuilder sm;
+    sm.setName("crafter");
     Position eat_pos{3, 3};
     Position sleep_pos{5, 5};
     Position craft_pos{1, 4};
@@ -159,37 +190,37 @@ static void add_crafter_sm(flecs::entity entity)
     Position buy_pos{-2, -4};
 
     // sleep sm 
-    HierarchicalStateMachine* sleep_sm = new HierarchicalStateMachine();
+    HierarchicalStateMachineBuilder* sleep_sm = new HierarchicalStateMachineBuilder();
     {
       int move_to_sleep = sleep_sm->addState(create_move_to_state(sleep_pos));
       int sleep = sleep_sm->addState(create_activity_state(12.f, EA_SLEEP));
 
-      sleep_sm->addTransition(create_near_transition(sleep_pos, FLT_EPSILON), move_to_sleep, sleep);
-      sleep_sm->addTransition(create_negate_transition(create_near_transition(sleep_pos, FLT_EPSILON)), sleep, move_to_sleep);
+      sleep_sm->addTransition(Near{sleep_pos, FLT_EPSILON}, move_to_sleep, sleep);
+      sleep_sm->addTransition(Not{Near{sleep_pos, FLT_EPSILON}}, sleep, move_to_sleep);
     }
 
     // eat sm 
-    HierarchicalStateMachine* eat_sm = new HierarchicalStateMachine();
+    HierarchicalStateMachineBuilder* eat_sm = new HierarchicalStateMachineBuilder();
     {
       int move_to_eat = eat_sm->addState(create_move_to_state(eat_pos));
       int eat = eat_sm->addState(create_activity_state(2.f, EA_EAT));
 
-      eat_sm->addTransition(create_near_transition(eat_pos, FLT_EPSILON), move_to_eat, eat);
-      eat_sm->addTransition(create_negate_transition(create_near_transition(eat_pos, FLT_EPSILON)), eat, move_to_eat);
+      eat_sm->addTransition(Near{eat_pos, FLT_EPSILON}, move_to_eat, eat);
+      eat_sm->addTransition(Not{Near{eat_pos, FLT_EPSILON}}, eat, move_to_eat);
     }
 
     // talk sm 
-    HierarchicalStateMachine* talk_sm = new HierarchicalStateMachine();
+    HierarchicalStateMachineBuilder* talk_sm = new HierarchicalStateMachineBuilder();
     {
       int move_to_talk = talk_sm->addState(create_move_to_ally_state());
       int talk = talk_sm->addState(create_activity_state(4.f, EA_TALK));
 
-      talk_sm->addTransition(create_ally_available_transition(1.0f), move_to_talk, talk);
-      talk_sm->addTransition(create_negate_transition(create_ally_available_transition(1.0f)), talk, move_to_talk);
+      talk_sm->addTransition(AllyWithin{1.0f}, move_to_talk, talk);
+      talk_sm->addTransition(Not{AllyWithin{1.0f}}, talk, move_to_talk);
     }
 
     //work sm
-    HierarchicalStateMachine* work_sm = new HierarchicalStateMachine();
+    HierarchicalStateMachineBuilder* work_sm = new HierarchicalStateMachineBuilder();
     {
       int move_to_craft = work_sm->addState(create_move_to_state(craft_pos));
       int craft = work_sm->addState(create_activity_state(8.f, EA_CRAFT));
@@ -198,13 +229,13 @@ static void add_crafter_sm(flecs::entity entity)
       int move_to_buy = work_sm->addState(create_move_to_state(buy_pos));
       int buy = work_sm->addState(create_activity_state(2.f, EA_BUY));
 
-      work_sm->addTransition(create_near_transition(craft_pos, FLT_EPSILON), move_to_craft, craft);
-      work_sm->addTransition(create_near_transition(sell_pos, FLT_EPSILON), move_to_sell, sell);
-      work_sm->addTransition(create_near_transition(buy_pos, FLT_EPSILON), move_to_buy, buy);
+      work_sm->addTransition(Near{craft_pos, FLT_EPSILON}, move_to_craft, craft);
+      work_sm->addTransition(Near{sell_pos, FLT_EPSILON}, move_to_sell, sell);
+      work_sm->addTransition(Near{buy_pos, FLT_EPSILON}, move_to_buy, buy);
 
-      work_sm->addTransition(create_activity_end_transition(), craft, move_to_sell);
-      work_sm->addTransition(create_activity_end_transition(), sell, move_to_buy);
-      work_sm->addTransition(create_activity_end_transition(), buy, move_to_craft);
+      work_sm->addTransition(ActivityEnded{}, craft, move_to_sell);
+      work_sm->addTransition(ActivityEnded{}, sell, move_to_buy);
+      work_sm->addTransition(ActivityEnded{}, buy, move_to_craft);
     }
 
     int sleep = sm.addState(sleep_sm);
@@ -213,20 +244,22 @@ static void add_crafter_sm(flecs::entity entity)
     int talk = sm.addState(talk_sm);
     int wander = sm.addState(create_patrol_state(10.0f));
 
-    sm.addTransition(create_time_transition(8.0, 12.0), sleep, eat);
-    sm.addTransition(create_activity_end_transition(), sleep, eat);
-    sm.addTransition(create_time_transition(20.0, 24.0), work, eat);
-    sm.addTransition(create_activity_end_transition(), eat, work);
-    sm.addTransition(create_time_transition(60.0, 6.0), work, sleep);
-    sm.addTransition(create_time_transition(60.0, 6.0), wander, sleep);
-    sm.addTransition(create_and_transition(create_time_transition(60.0, 6.0), create_negate_transition(create_ally_available_transition(2.0))),
+    sm.addTransition(TimeBetween{8.0, 12.0}, sleep, eat);
+    sm.addTransition(ActivityEnded{}, sleep, eat);
+    sm.addTransition(TimeBetween{20.0, 24.0}, work, eat);
+    sm.addTransition(ActivityEnded{}, eat, work);
+    sm.addTransition(TimeBetween{60.0, 6.0}, work, sleep);
+    sm.addTransition(TimeBetween{60.0, 6.0}, wander, sleep);
+    sm.addTransition(And{TimeBetween{60.0, 6.0}, Not{AllyWithin{2.0}}},
                      talk, sleep);
-    sm.addTransition(create_time_transition(40.0, 60.0), work, wander);
-    sm.addTransition(create_time_transition(13.0, 40.0), wander, work);
-    sm.addTransition(create_activity_end_transition(), talk, wander);
-    sm.addTransition(create_need_talk_transition(), work, talk);
-    sm.addTransition(create_ally_available_transition(3.0f), wander, talk);
-  });
+    sm.addTransition(TimeBetween{40.0, 60.0}, work, wander);
+    sm.addTransition(TimeBetween{13.0, 40.0}, wander, work);
+    sm.addTransition(ActivityEnded{}, talk, wander);
+    sm.addTransition(NeedTalk{}, work, talk);
+    sm.addTransition(AllyWithin{3.0f}, wander, talk);
+    return sm.compile();
+  }();
+  entity.set(HierarchicalStateMachine(&desc));
 }
 
 static flecs::entity create_monster(flecs::world &ecs, int x, int y, uint32_t color, int team = 1)
@@ -239,6 +272,7 @@ static flecs::entity create_monster(flecs::world &ecs, int x, int y, uint32_t co
     .set(Action{EA_NOP})
     .set(Color{color})
     .set(StateMachine{})
+    .set(WorldInfo{})
     .set(Team{team})
     .set(NumActions{1, 0})
     .set(MeleeDamage{20.f});
@@ -254,6 +288,7 @@ static flecs::entity create_crafter(flecs::world &ecs, int x, int y, uint32_t co
     .set(Action{EA_NOP})
     .set(Color{color})
     .set(HierarchicalStateMachine{})
+    .set(WorldInfo{})
     .set(Team{team})
     .set(NumActions{1, 0})
     .set(MeleeDamage{20.f})
@@ -270,6 +305,7 @@ static flecs::entity create_monster_with_ability(flecs::world &ecs, int x, int y
     .set(Action{EA_NOP})
     .set(Color{color})
     .set(StateMachine{})
+    .set(WorldInfo{})
     .set(Team{team})
     .set(NumActions{1, 0})
     .set(MeleeDamage{20.f})
@@ -351,6 +387,9 @@ static void register_roguelike_systems(flecs::world &ecs)
 void init_roguelike(flecs::world &ecs)
 {
   register_roguelike_systems(ecs);
+  register_spatial_hash(ecs);
+  ecs.entity("tile_occupancy")
+    .set(TileOccupancy{});
 
   // add_patrol_attack_flee_sm(create_monster(ecs, 5, 5, 0xffee00ee));
   // add_patrol_attack_flee_sm(create_monster(ecs, 10, -5, 0xffee00ee));
@@ -429,32 +468,50 @@ static void process_actions(flecs::world &ecs)
 
   static auto processActions = ecs.query<Action, Position, MovePos, const MeleeDamage, const Team>();
   static auto checkAttacks = ecs.query<const MovePos, Hitpoints, const Team>();
+  static auto tileOccupancy = ecs.query<TileOccupancy>();
   // Process all actions
   ecs.defer([&]
   {
-    processActions.each([&](flecs::entity entity, Action &a, Position &pos, MovePos &mpos, const MeleeDamage &dmg, const Team &team)
+    // moves are resolved in query order: the first one to step on a tile claims it,
+    // everyone coming later is blocked by whoever is there (and hits them if they are enemies)
+    tileOccupancy.each([&](TileOccupancy &occ)
     {
-      Position nextPos = move_pos(pos, a.action);
-      bool blocked = false;
-      checkAttacks.each([&](flecs::entity enemy, const MovePos &epos, Hitpoints &hp, const Team &enemy_team)
+      occ.clear();
+      checkAttacks.each([&](flecs::entity e, const MovePos &epos, Hitpoints &hp, const Team &t)
+      {
+        occ.addOccupant(epos.x, epos.y, e, hp, t.team);
+      });
+      processActions.each([&](flecs::entity entity, Action &a, Position &pos, MovePos &mpos, const MeleeDamage &dmg, const Team &team)
       {
-        if (entity != enemy && epos == nextPos)
+        Position nextPos = move_pos(pos, a.action);
+        bool blocked = false;
+        for (const TileOccupancy::Occupant &occupant : occ.occupantsAt(nextPos.x, nextPos.y))
         {
+          if (occupant.entity == entity)
+            continue;
           blocked = true;
-          if (team.team != enemy_team.team)
-            hp.hitpoints -= dmg.damage;
+          if (team.team != occupant.team)
+            occupant.hp->hitpoints -= dmg.damage;
+        }
+        if (blocked)
+          a.action = EA_NOP;
+        else
+        {
+          occ.moveOccupant(entity, mpos.x, mpos.y, nextPos.x, nextPos.y);
+          mpos = nextPos;
         }
       });
-      if (blocked)
-        a.action = EA_NOP;
-      else
-        mpos = nextPos;
     });
     // now move
-    processActions.each([&](flecs::entity entity, Action &a, Position &pos, MovePos &mpos, const MeleeDamage &, const Team&)
+    query_spatial_hash(ecs, [&](SpatialHash &hash)
     {
-      pos = mpos;
-      a.action = EA_NOP;
+      processActions.each([&](flecs::entity entity, Action &a, Position &pos, MovePos &mpos, const MeleeDamage &, const Team &team)
+      {
+        if (!(pos == mpos))
+          hash.update(entity, Position{mpos.x, mpos.y}, team.team);
+        pos = mpos;
+        a.action = EA_NOP;
+      });
     });
   });
 
@@ -473,30 +530,78 @@ static void process_actions(flecs::world &ecs)
   static auto powerupPickup = ecs.query<const Position, const PowerupAmount>();
   ecs.defer([&]
   {
-    playerPickup.each([&](const IsPlayer&, const Position &pos, Hitpoints &hp, MeleeDamage &dmg)
+    tileOccupancy.each([&](TileOccupancy &occ)
     {
-      healPickup.each([&](flecs::entity entity, const Position &ppos, const HealAmount &amt)
-      {
-        if (pos == ppos)
-        {
-          hp.hitpoints += amt.amount;
-          entity.destruct();
-        }
-      });
-      powerupPickup.each([&](flecs::entity entity, const Position &ppos, const PowerupAmount &amt)
+      occ.clear();
+      healPickup.each([&](flecs::entity e, const Position &ppos, const HealAmount &) { occ.addItem(ppos.x, ppos.y, e); });
+      powerupPickup.each([&](flecs::entity e, const Position &ppos, const PowerupAmount &) { occ.addItem(ppos.x, ppos.y, e); });
+      playerPickup.each([&](const IsPlayer&, const Position &pos, Hitpoints &hp, MeleeDamage &dmg)
       {
-        if (pos == ppos)
+        std::vector<flecs::entity> *items = occ.itemsAt(pos.x, pos.y);
+        if (!items)
+          return;
+        for (flecs::entity item : *items)
         {
-          dmg.damage += amt.amount;
-          entity.destruct();
+          if (const HealAmount *amt = item.get<HealAmount>())
+            hp.hitpoints += amt->amount;
+          if (const PowerupAmount *amt = item.get<PowerupAmount>())
+            dmg.damage += amt->amount;
+          item.destruct();
         }
+        items->clear();
       });
     });
   });
 }
 
+// sensors
+static void gather_world_info(flecs::world &ecs, const AIContext &ctx)
+{
+  static auto gatherWorldInfo = ecs.query<WorldInfo, const Position, const Team>();
+  if (!ctx.spatialHash)
+    return;
+  const SpatialHash &hash = *ctx.spatialHash;
+  gatherWorldInfo.each([&](WorldInfo &info, const Position &pos, const Team &team)
+  {
+    info = WorldInfo{};
+    SpatialHash::Neighbour enemy;
+    if (hash.nearest(pos, [&](int t) { return t != team.team; }, enemy))
+    {
+      info.closestEnemy = enemy.entity;
+      info.closestEnemyPos = enemy.pos;
+      info.closestEnemyDist = enemy.dist;
+    }
+    SpatialHash::Neighbour allies[max_sensed_allies];
+    info.numAllies = hash.k_nearest(pos, [&](int t) { return t == team.team; },
+                                    allies, max_sensed_allies, FLT_EPSILON);
+    for (size_t i = 0; i < info.numAllies; ++i)
+      info.allies[i] = WorldInfo::AllyInfo{allies[i].entity, allies[i].pos, allies[i].dist};
+  });
+}
+
+static AIContext make_ai_context(flecs::world &ecs)
+{
+  static auto globalTime = ecs.query<const Time>();
+  AIContext ctx;
+  globalTime.each([&](const Time &gtime) { ctx.time = &gtime; });
+  query_spatial_hash(ecs, [&](const SpatialHash &hash) { ctx.spatialHash = &hash; });
+  return ctx;
+}
+
+#if AI_PROFILE
+static void dump_ai_profile_on_key()
+{
+  static bool wasPressed = false;
+  const bool pressed = app_keypressed(GLFW_KEY_F9);
+  if (pressed && !wasPressed)
+    dump_ai_profile(ai_profile_path);
+  wasPressed = pressed;
+}
+#endif
+
 void process_turn(flecs::world &ecs)
 {
+  AI_PROFILE_ONLY(dump_ai_profile_on_key();)
   static auto stateMachineAct = ecs.query<StateMachine>();
   static auto stateHMachineAct = ecs.query<HierarchicalStateMachine>();
   if (is_player_acted(ecs))
@@ -504,15 +609,17 @@ void process_turn(flecs::world &ecs)
     if (upd_player_actions_count(ecs))
     {
       // Plan action for NPCs
+      const AIContext ctx = make_ai_context(ecs);
+      gather_world_info(ecs, ctx);
       ecs.defer([&]
       {
         stateMachineAct.each([&](flecs::entity e, StateMachine &sm)
         {
-          sm.act(1.f, ecs, e);
+          sm.act(1.f, ecs, e, ctx);
         });
         stateHMachineAct.each([&](flecs::entity e, HierarchicalStateMachine &sm)
         {
-          sm.act(1.f, ecs, e);
+          sm.act(1.f, ecs, e, ctx);
         });
       });
 
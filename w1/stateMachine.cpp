@@ -1,44 +1,85 @@
 #include "stateMachine.h"
 
-StateMachine::~StateMachine()
+StateMachineDesc::~StateMachineDesc()
 {
   for (State* state : states)
     delete state;
   states.clear();
-  for (auto &transList : transitions)
-    for (auto &transition : transList)
-      delete transition.first;
+  for (const StateTransition *transition : runtimeTransitions)
+    delete transition;
+  runtimeTransitions.clear();
   transitions.clear();
 }
 
-void StateMachine::act(float dt, flecs::world &ecs, flecs::entity entity)
+int StateMachineDesc::addState(State *st)
 {
-  if (curStateIdx < states.size())
-  {
-    for (const std::pair<StateTransition*, int> &transition : transitions[curStateIdx])
-      if (transition.first->isAvailable(ecs, entity))
-      {
-        states[curStateIdx]->exit();
-        curStateIdx = transition.second;
-        states[curStateIdx]->enter();
-        break;
-      }
-    states[curStateIdx]->act(dt, ecs, entity);
-  }
-  else
-    curStateIdx = 0;
+  int idx = int(states.size());
+  states.push_back(st);
+  transitionOffsets.push_back(transitions.size());
+  return idx;
 }
 
-int StateMachine::addState(State *st)
+void StateMachineDesc::addTransition(StateTransition *trans, int from, int to)
 {
-  int idx = states.size();
-  states.push_back(st);
-  transitions.push_back(std::vector<std::pair<StateTransition*, int>>());
-  return idx;
+  runtimeTransitions.push_back(trans);
+  insertTransition(TransitionPredicate(RuntimeTransition{trans}), from, to);
 }
 
-void StateMachine::addTransition(StateTransition *trans, int from, int to)
+void StateMachineDesc::insertTransition(const TransitionPredicate &pred, int from, int to)
 {
-  transitions[from].push_back(std::make_pair(trans, to));
+  // keep transitions grouped by source state, order within a state is preserved
+  transitions.insert(transitions.begin() + ptrdiff_t(transitionOffsets[size_t(from) + 1]), Transition{pred, to});
+  for (size_t i = size_t(from) + 1; i < transitionOffsets.size(); ++i)
+    transitionOffsets[i]++;
 }
 
+#if AI_PROFILE
+MachineProfile &StateMachineDesc::getProfile() const
+{
+  if (!profile.registered)
+  {
+    profile.archetype = name;
+    profile.states.resize(states.size());
+    for (size_t i = 0; i < states.size(); ++i)
+      profile.states[i].type = ai_profile_type_name(*states[i]);
+    profile.transitions.resize(transitions.size());
+    for (size_t from = 0; from + 1 < transitionOffsets.size(); ++from)
+      for (size_t i = transitionOffsets[from]; i < transitionOffsets[from + 1]; ++i)
+      {
+        profile.transitions[i].from = int(from);
+        profile.transitions[i].to = transitions[i].to;
+        profile.transitions[i].type = transitions[i].predicate.typeName();
+      }
+    register_machine_profile(profile);
+  }
+  return profile;
+}
+#endif
+
+void StateMachine::act(float dt, flecs::world &ecs, flecs::entity entity, const AIContext &ctx)
+{
+  if (!desc)
+    return;
+  if (size_t(curStateIdx) < desc->numStates())
+  {
+    AI_PROFILE_ONLY(MachineProfile &profile = desc->getProfile();)
+    for (const StateMachineDesc::Transition *transition = desc->transitionsBegin(curStateIdx);
+         transition != desc->transitionsEnd(curStateIdx); ++transition)
+    {
+      AI_PROFILE_ONLY(const ProfileTimer evalTimer;)
+      const bool available = transition->predicate(ecs, entity, ctx);
+      AI_PROFILE_ONLY(profile.onTransitionEval(size_t(transition - desc->transitionsBegin(0)), evalTimer.elapsedNs(), available);)
+      if (available)
+      {
+        desc->getState(curStateIdx)->exit();
+        curStateIdx = transition->to;
+        desc->getState(curStateIdx)->enter();
+        break;
+      }
+    }
+    AI_PROFILE_ONLY(profile.onStateTick(size_t(curStateIdx));)
+    desc->getState(curStateIdx)->act(dt, ecs, entity, ctx);
+  }
+  else
+    curStateIdx = 0;
+}
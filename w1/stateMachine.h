@@ -1,41 +1,123 @@
 #pragma once
 #include <vector>
+#include <cstddef>
+#include <new>
+#include <type_traits>
 #include <flecs.h>
+#include "aiContext.h"
+#include "aiProfile.h"
 
 class State
 {
 public:
+  virtual ~State() {}
   virtual void enter() const = 0;
   virtual void exit() const = 0;
-  virtual void act(float dt, flecs::world &ecs, flecs::entity entity) const = 0;
+  virtual void act(float dt, flecs::world &ecs, flecs::entity entity, const AIContext &ctx) const = 0;
 };
 
 class StateTransition
 {
 public:
   virtual ~StateTransition() {}
-  virtual bool isAvailable(flecs::world &ecs, flecs::entity entity) const = 0;
+  virtual bool isAvailable(flecs::world &ecs, flecs::entity entity, const AIContext &ctx) const = 0;
 };
 
-class StateMachine
+// Transition condition stored by value: any trivially copyable callable
+// bool(flecs::world&, flecs::entity, const AIContext&), evaluated through a single function pointer.
+// See transitionPredicates.h for the building blocks.
+class TransitionPredicate
 {
-  int curStateIdx = 0;
-  std::vector<State*> states;
-  std::vector<std::vector<std::pair<StateTransition*, int>>> transitions;
 public:
-  StateMachine() = default;
-  StateMachine(const StateMachine &sm) = default;
-  StateMachine(StateMachine &&sm) = default;
+  static constexpr size_t max_size = 32;
+
+  template<typename Pred>
+    requires (!std::is_same_v<Pred, TransitionPredicate>)
+  TransitionPredicate(const Pred &pred)
+  {
+    static_assert(std::is_trivially_copyable_v<Pred>, "transition predicates are stored by value and copied around");
+    static_assert(sizeof(Pred) <= max_size && alignof(Pred) <= alignof(std::max_align_t), "transition predicate is too big");
+    new (storage) Pred(pred);
+    eval = [](const void *data, flecs::world &ecs, flecs::entity entity, const AIContext &ctx)
+    {
+      return (*static_cast<const Pred*>(data))(ecs, entity, ctx);
+    };
+    AI_PROFILE_ONLY(typeNameOf = [](const void *data) { return ai_profile_type_name(*static_cast<const Pred*>(data)); };)
+  }
+
+  bool operator()(flecs::world &ecs, flecs::entity entity, const AIContext &ctx) const { return eval(storage, ecs, entity, ctx); }
+  AI_PROFILE_ONLY(const char *typeName() const { return typeNameOf(storage); })
+
+private:
+  alignas(std::max_align_t) unsigned char storage[max_size];
+  bool (*eval)(const void*, flecs::world&, flecs::entity, const AIContext&);
+  AI_PROFILE_ONLY(const char *(*typeNameOf)(const void*);)
+};
 
-  ~StateMachine();
+// runtime StateTransition as a predicate, doesn't own it
+struct RuntimeTransition
+{
+  const StateTransition *transition;
+
+  bool operator()(flecs::world &ecs, flecs::entity entity, const AIContext &ctx) const { return transition->isAvailable(ecs, entity, ctx); }
+};
 
-  StateMachine &operator=(const StateMachine &sm) = default;
-  StateMachine &operator=(StateMachine &&sm) = default;
+inline const char *ai_profile_type_name(const RuntimeTransition &trans)
+{
+  return typeid(*trans.transition).name();
+}
 
+// Immutable state machine graph, built once per archetype and shared by all entities of it.
+// Transitions are stored flat and grouped by source state, so a single state walks
+// a contiguous [transitionsBegin[from], transitionsBegin[from + 1]) range.
+class StateMachineDesc
+{
+public:
+  struct Transition
+  {
+    TransitionPredicate predicate;
+    int to;
+  };
 
-  void act(float dt, flecs::world &ecs, flecs::entity entity);
+  StateMachineDesc() = default;
+  StateMachineDesc(const StateMachineDesc &desc) = delete;
+  StateMachineDesc(StateMachineDesc &&desc) = default;
+
+  ~StateMachineDesc();
+
+  StateMachineDesc &operator=(const StateMachineDesc &desc) = delete;
+  StateMachineDesc &operator=(StateMachineDesc &&desc) = default;
 
   int addState(State *st);
-  void addTransition(StateTransition *trans, int from, int to);
+  void addTransition(StateTransition *trans, int from, int to); // we own it
+  template<typename Pred>
+  void addTransition(const Pred &pred, int from, int to) { insertTransition(TransitionPredicate(pred), from, to); }
+
+  void setName(const char *in_name) { name = in_name; }
+  const char *getName() const { return name; }
+
+  size_t numStates() const { return states.size(); }
+  const State *getState(int idx) const { return states[size_t(idx)]; }
+  const Transition *transitionsBegin(int from) const { return transitions.data() + transitionOffsets[size_t(from)]; }
+  const Transition *transitionsEnd(int from) const { return transitions.data() + transitionOffsets[size_t(from) + 1]; }
+  AI_PROFILE_ONLY(MachineProfile &getProfile() const;)
+
+private:
+  const char *name = "";
+  std::vector<State*> states;
+  std::vector<Transition> transitions;
+  std::vector<size_t> transitionOffsets = {0};
+  std::vector<const StateTransition*> runtimeTransitions;
+  AI_PROFILE_ONLY(mutable MachineProfile profile;)
+
+  void insertTransition(const TransitionPredicate &pred, int from, int to);
 };
 
+// Per-entity part of the state machine, everything else lives in the shared desc
+struct StateMachine
+{
+  const StateMachineDesc *desc = nullptr;
+  int curStateIdx = 0;
+
+  void act(float dt, flecs::world &ecs, flecs::entity entity, const AIContext &ctx);
+};
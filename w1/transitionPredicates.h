@@ -0,0 +1,198 @@
+#pragma once
+#include <flecs.h>
+#include <cmath>
+#include "ecsTypes.h"
+#include "math.h"
+#include "stateMachine.h"
+#include "spatialHash.h"
+
+// Transition conditions as plain value types with bool operator()(ecs, entity, ctx).
+// Combinators hold their operands by value, so a whole condition like
+// And{HpBelow{50.f}, Not{EnemyWithin{5.f}}} is a single type evaluated with inlined calls,
+// and StateMachineDesc keeps it by value in its transition table.
+
+inline float get_global_time(const AIContext &ctx)
+{
+  return ctx.time ? ctx.time->time : 0.f;
+}
+
+// calls c(const SpatialHash::Neighbour &) for every ally within dist, anyone on the entity's tile excluded.
+// WorldInfo only keeps the closest max_sensed_allies, checks that need all of them go through the hash.
+template<typename Callable>
+inline void for_each_ally_within(flecs::entity entity, const AIContext &ctx, float dist, Callable c)
+{
+  const Position *pos = entity.get<Position>();
+  const Team *team = entity.get<Team>();
+  if (!pos || !team || !ctx.spatialHash)
+    return;
+  ctx.spatialHash->query_radius(*pos, dist, [&](int t) { return t == team->team; },
+                                [&](const SpatialHash::Neighbour &ally)
+                                {
+                                  if (ally.dist > FLT_EPSILON)
+                                    c(ally);
+                                });
+}
+
+struct EnemyWithin
+{
+  float dist;
+
+  bool operator()(flecs::world &, flecs::entity entity, const AIContext &) const
+  {
+    const WorldInfo *info = entity.get<WorldInfo>();
+    return info && info->closestEnemyDist <= dist;
+  }
+};
+
+struct AllyWithin
+{
+  float dist;
+
+  bool operator()(flecs::world &, flecs::entity entity, const AIContext &) const
+  {
+    const WorldInfo *info = entity.get<WorldInfo>();
+    return info && info->numAllies > 0 && info->allies[0].dist <= dist;
+  }
+};
+
+struct HpBelow
+{
+  float threshold;
+
+  bool operator()(flecs::world &, flecs::entity entity, const AIContext &) const
+  {
+    const Hitpoints *hp = entity.get<Hitpoints>();
+    return hp && hp->hitpoints < threshold;
+  }
+};
+
+// any ally within dist has less than threshold hitpoints, not limited to the closest allies
+struct AllyHpBelow
+{
+  float threshold;
+  float dist;
+
+  bool operator()(flecs::world &, flecs::entity entity, const AIContext &ctx) const
+  {
+    bool found = false;
+    for_each_ally_within(entity, ctx, dist, [&](const SpatialHash::Neighbour &ally)
+    {
+      const Hitpoints *hp = ally.entity.get<Hitpoints>();
+      found |= hp && hp->hitpoints < threshold;
+    });
+    return found;
+  }
+};
+
+struct AbilityReady
+{
+  float cooldown;
+
+  bool operator()(flecs::world &, flecs::entity entity, const AIContext &ctx) const
+  {
+    const Ability *ability = entity.get<Ability>();
+    return ability && (ability->lastAbilityUsage + cooldown) < get_global_time(ctx);
+  }
+};
+
+struct Near
+{
+  Position position;
+  float dist;
+
+  bool operator()(flecs::world &, flecs::entity entity, const AIContext &) const
+  {
+    const Position *pos = entity.get<Position>();
+    return pos && ::dist(position, *pos) <= dist;
+  }
+};
+
+struct ActivityEnded
+{
+  bool operator()(flecs::world &, flecs::entity entity, const AIContext &) const
+  {
+    const Activity *activ = entity.get<Activity>();
+    return activ && activ->state == A_END;
+  }
+};
+
+struct NeedTalk
+{
+  bool operator()(flecs::world &, flecs::entity entity, const AIContext &) const
+  {
+    const Action *a = entity.get<Action>();
+    const Activity *activ = entity.get<Activity>();
+    return a && activ && activ->state == A_PROCESS && (a->action == EA_BUY || a->action == EA_SELL);
+  }
+};
+
+// time of day is in [from, to], the range may wrap over midnight
+struct TimeBetween
+{
+  float from;
+  float to;
+
+  bool operator()(flecs::world &, flecs::entity, const AIContext &ctx) const
+  {
+    float curTime = get_global_time(ctx);
+    curTime = curTime - 24.0f * floor(curTime / 72.0f);
+
+    return (curTime >= from && curTime <= to) ||
+           (from > to && curTime >= from && curTime <= to + 72.0f) ||
+           (from > to && curTime >= from - 72.0f && curTime <= to);
+  }
+};
+
+struct Never
+{
+  bool operator()(flecs::world &, flecs::entity, const AIContext &) const { return false; }
+};
+
+template<typename Pred>
+struct Not
+{
+  Pred pred;
+
+  bool operator()(flecs::world &ecs, flecs::entity entity, const AIContext &ctx) const { return !pred(ecs, entity, ctx); }
+};
+
+template<typename Lhs, typename Rhs>
+struct And
+{
+  Lhs lhs;
+  Rhs rhs;
+
+  bool operator()(flecs::world &ecs, flecs::entity entity, const AIContext &ctx) const { return lhs(ecs, entity, ctx) && rhs(ecs, entity, ctx); }
+};
+
+template<typename Lhs, typename Rhs>
+struct Or
+{
+  Lhs lhs;
+  Rhs rhs;
+
+  bool operator()(flecs::world &ecs, flecs::entity entity, const AIContext &ctx) const { return lhs(ecs, entity, ctx) || rhs(ecs, entity, ctx); }
+};
+
+template<typename Pred> Not(Pred) -> Not<Pred>;
+template<typename Lhs, typename Rhs> And(Lhs, Rhs) -> And<Lhs, Rhs>;
+template<typename Lhs, typename Rhs> Or(Lhs, Rhs) -> Or<Lhs, Rhs>;
+
+// lets a compile-time predicate go where a runtime StateTransition is expected
+template<typename Pred>
+class PredicateTransition : public StateTransition
+{
+  Pred pred;
+public:
+  PredicateTransition(const Pred &in_pred) : pred(in_pred) {}
+  bool isAvailable(flecs::world &ecs, flecs::entity entity, const AIContext &ctx) const override
+  {
+    return pred(ecs, entity, ctx);
+  }
+};
+
+template<typename Pred>
+inline StateTransition *create_predicate_transition(const Pred &pred)
+{
+  return new PredicateTransition<Pred>(pred);
+}
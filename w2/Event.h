@@ -1,13 +1,48 @@
 #pragma once
 
-#include "blackboard.h"
+#include <vector>
+#include <flecs.h>
 
 enum Events {
   NoEvent,
   HelpEvent
 };
 
+// Small POD payload, reactions copy what they need into their own blackboard
 struct Event {
-  Events event;
-  Blackboard event_bb;
+  Events event = NoEvent;
+  flecs::entity sender;
+  flecs::entity target; // e.g. whom to help with
+};
+
+// Events sent while trees are ticked, delivered in one batch after all of them
+// by deliver_events, so senders never run the trees of their receivers.
+struct EventMailboxes
+{
+  std::vector<std::vector<Event>> swarms; // by Swarm::idx
+  std::vector<std::pair<flecs::entity, Event>> entities;
+  // scratch of deliver_events, swarm members by Swarm::idx, kept to reuse the allocations
+  std::vector<std::vector<flecs::entity>> swarmMembers;
+
+  void sendToSwarm(int swarm_idx, const Event &evt)
+  {
+    if (swarm_idx < 0)
+      return;
+    if (size_t(swarm_idx) >= swarms.size())
+      swarms.resize(size_t(swarm_idx) + 1);
+    swarms[size_t(swarm_idx)].push_back(evt);
+  }
+
+  void sendTo(flecs::entity receiver, const Event &evt)
+  {
+    entities.emplace_back(receiver, evt);
+  }
+
+  bool empty() const
+  {
+    for (const std::vector<Event> &mailbox : swarms)
+      if (!mailbox.empty())
+        return false;
+    return entities.empty();
+  }
 };
@@ -0,0 +1,12 @@
+#pragma once
+
+class SpatialHash;
+struct EventMailboxes;
+
+// World singletons AI reads every turn, gathered once per turn in process_turn
+// and passed down to states, transitions and behaviour nodes instead of querying them on every call.
+struct AIContext
+{
+  const SpatialHash *spatialHash = nullptr;
+  EventMailboxes *mailboxes = nullptr; // nodes post events here, they are delivered after the think phase
+};
@@ -7,8 +7,6 @@
 #include "blackboard.h"
 #include "aiUtils.h"
 
-using react_func = std::function<void(flecs::world&, flecs::entity, Blackboard&, Blackboard&)>;
-
 // states
 State *create_attack_enemy_state();
 State *create_move_to_enemy_state();
@@ -23,64 +21,63 @@ StateTransition *create_hitpoints_less_than_transition(float thres);
 StateTransition *create_negate_transition(StateTransition *in);
 StateTransition *create_and_transition(StateTransition *lhs, StateTransition *rhs);
 
-BehNode *sequence(const std::vector<BehNode*> &nodes);
-BehNode *selector(const std::vector<BehNode*> &nodes);
-BehNode *parallel(const std::vector<BehNode*> &nodes);
-BehNode *with_reaction(BehNode* node, const std::vector<std::pair<Events, react_func>> &reactions);
+BehNodeSpec sequence(const std::vector<BehNodeSpec> &nodes);
+BehNodeSpec selector(const std::vector<BehNodeSpec> &nodes);
+// resume at the running child instead of starting over every tick
+BehNodeSpec mem_sequence(const std::vector<BehNodeSpec> &nodes);
+BehNodeSpec mem_selector(const std::vector<BehNodeSpec> &nodes);
+// child of a memory composite which is checked every tick, even when it resumes past it
+BehNodeSpec recheck(const BehNodeSpec &node);
+BehNodeSpec parallel(const std::vector<BehNodeSpec> &nodes);
+BehNodeSpec with_reaction(const BehNodeSpec &node, const std::vector<std::pair<Events, react_func>> &reactions);
+
+BehNodeSpec and_node(const std::vector<BehNodeSpec> &nodes);
+BehNodeSpec or_node(const std::vector<BehNodeSpec> &nodes);
+BehNodeSpec not_node(const BehNodeSpec &node);
 
-BehNode *and_node(const std::vector<BehNode*> &nodes);
-BehNode *or_node(const std::vector<BehNode*> &nodes);
-BehNode *not_node(BehNode* node);
+BehNodeSpec move_to_entity(flecs::entity entity, const char *bb_name);
+BehNodeSpec is_low_hp(float thres);
+BehNodeSpec find_enemy(flecs::entity entity, float dist, const char *bb_name);
+BehNodeSpec flee(flecs::entity entity, const char *bb_name);
+BehNodeSpec patrol(flecs::entity entity, float patrol_dist, const char *bb_name);
+BehNodeSpec get_next_point();
+BehNodeSpec route_go();
+// sends the enemy in bb_name to the whole swarm of the entity
+BehNodeSpec ask_help(flecs::entity entity, const char *bb_name);
+BehNodeSpec find_closest_spec(flecs::entity entity, const char *bb_name, find_closest_func func);
 
-BehNode *move_to_entity(flecs::entity entity, const char *bb_name);
-BehNode *is_low_hp(float thres);
-BehNode *find_enemy(flecs::entity entity, float dist, const char *bb_name);
-BehNode *flee(flecs::entity entity, const char *bb_name);
-BehNode *patrol(flecs::entity entity, float patrol_dist, const char *bb_name);
-BehNode *get_next_point();
-BehNode *route_go();
-BehNode *ask_help(flecs::entity entity, const char *bb_name, const char *target_bb_name);
+// writes hp and the closest enemy within reach into the blackboards of entities with trees,
+// called before they are ticked
+void update_beh_sensors(flecs::world &ecs, const AIContext &ctx);
+// reacts to all events sent during this turn, called after all trees are ticked
+void deliver_events(flecs::world &ecs, EventMailboxes &mailboxes);
+
+// gives the entity its own state for a compiled tree, desc has to outlive it
+void set_beh_tree(flecs::entity entity, const BehaviourTreeDesc &desc);
 
 template<class T>
-struct FindClosest : public BehNode
+flecs::entity find_closest_entity(flecs::world &ecs, flecs::entity entity)
 {
-  size_t entityBb = size_t(-1);
-  FindClosest(flecs::entity entity, const char *bb_name)
-  {
-    entityBb = reg_entity_blackboard_var<flecs::entity>(entity, bb_name);
-  }
-  BehResult update(flecs::world &ecs, flecs::entity entity, Blackboard &bb) override
+  static auto healsQuery = ecs.query<const Position, const T>();
+  flecs::entity closestHeal;
+  entity.get([&](const Position &pos)
   {
-    BehResult res = BEH_FAIL;
-    static auto healsQuery = ecs.query<const Position, const T>();
-    entity.set([&](const Position &pos)
+    float closestDist = FLT_MAX;
+    healsQuery.each([&](flecs::entity heal, const Position &epos, const T /**/)
     {
-      flecs::entity closestHeal;
-      float closestDist = FLT_MAX;
-      healsQuery.each([&](flecs::entity heal, const Position &epos, const T /**/)
+      float curDist = dist(epos, pos);
+      if (curDist < closestDist)
       {
-        float curDist = dist(epos, pos);
-        if (curDist < closestDist)
-        {
-          closestDist = curDist;
-          closestHeal = heal;
-        }
-      });
-      if (ecs.is_valid(closestHeal))
-      {
-        bb.set<flecs::entity>(entityBb, closestHeal);
-        res = BEH_SUCCESS;
+        closestDist = curDist;
+        closestHeal = heal;
       }
     });
-    return res;
-  }
-
-  void react(flecs::world &ecs, flecs::entity entity, Blackboard &bb, Event coming_evt) override {}
-};
+  });
+  return closestHeal;
+}
 
 template<class T>
-BehNode *find_closest(flecs::entity entity, const char *bb_name)
+BehNodeSpec find_closest(flecs::entity entity, const char *bb_name)
 {
-  return new FindClosest<T>(entity, bb_name);
+  return find_closest_spec(entity, bb_name, &find_closest_entity<T>);
 }
-
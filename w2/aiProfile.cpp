@@ -0,0 +1,88 @@
+#include "aiProfile.h"
+#include <cstdio>
+
+#if AI_PROFILE
+
+#include <algorithm>
+#include <cstddef>
+#include <string>
+
+static std::vector<const TreeProfile*> treeProfiles;
+
+void register_tree_profile(TreeProfile &profile)
+{
+  if (profile.registered)
+    return;
+  profile.registered = true;
+  treeProfiles.push_back(&profile);
+}
+
+size_t ai_profile_top_nodes(ProfileTopNode *out, size_t max_count)
+{
+  std::vector<ProfileTopNode> all;
+  for (const TreeProfile *profile : treeProfiles)
+    for (size_t i = 0; i < profile->nodes.size(); ++i)
+      all.push_back(ProfileTopNode{profile, i});
+  const size_t count = std::min(max_count, all.size());
+  std::partial_sort(all.begin(), all.begin() + ptrdiff_t(count), all.end(), [](const ProfileTopNode &lhs, const ProfileTopNode &rhs)
+  {
+    return lhs.tree->nodes[lhs.node].exclusiveNs > rhs.tree->nodes[rhs.node].exclusiveNs;
+  });
+  std::copy(all.begin(), all.begin() + ptrdiff_t(count), out);
+  return count;
+}
+
+// frame of a folded stack, flamegraph tools split frames on ';' and the count on the last ' '
+static std::string frame_name(const TreeProfile &profile, size_t idx)
+{
+  std::string res = std::string(profile.nodes[idx].type) + "#" + std::to_string(idx);
+  std::replace(res.begin(), res.end(), ';', '_');
+  std::replace(res.begin(), res.end(), ' ', '_');
+  return res;
+}
+
+bool dump_ai_profile(const char *path, const char *folded_path)
+{
+  FILE *f = fopen(path, "w");
+  if (!f)
+    return false;
+  FILE *folded = fopen(folded_path, "w");
+  if (!folded)
+  {
+    fclose(f);
+    return false;
+  }
+
+  fprintf(f, "archetype,node,parent,type,ticks,success,fail,running,inclusive_ns,exclusive_ns,exclusive_ns_avg\n");
+  for (const TreeProfile *profile : treeProfiles)
+  {
+    for (size_t i = 0; i < profile->nodes.size(); ++i)
+    {
+      const TreeProfile::NodeCounters &node = profile->nodes[i];
+      fprintf(f, "%s,%zu,%d,%s,%llu,%llu,%llu,%llu,%llu,%llu,%.1f\n", profile->archetype, i, node.parent, node.type,
+              static_cast<unsigned long long>(node.ticks), static_cast<unsigned long long>(node.results[0]),
+              static_cast<unsigned long long>(node.results[1]), static_cast<unsigned long long>(node.results[2]),
+              static_cast<unsigned long long>(node.inclusiveNs), static_cast<unsigned long long>(node.exclusiveNs),
+              node.ticks > 0 ? double(node.exclusiveNs) / double(node.ticks) : 0.0);
+
+      if (node.exclusiveNs == 0)
+        continue;
+      std::string stack = frame_name(*profile, i);
+      for (int parent = node.parent; parent >= 0; parent = profile->nodes[size_t(parent)].parent)
+        stack = frame_name(*profile, size_t(parent)) + ";" + stack;
+      fprintf(folded, "%s;%s %llu\n", profile->archetype, stack.c_str(), static_cast<unsigned long long>(node.exclusiveNs));
+    }
+  }
+  fclose(folded);
+  fclose(f);
+  return true;
+}
+
+#else
+
+bool dump_ai_profile(const char *, const char *)
+{
+  return false;
+}
+
+#endif
@@ -0,0 +1,80 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+// Opt-in counters for behaviour trees: how often every node was ticked, what it returned
+// and how long it took, with and without its children.
+// They are aggregated per archetype (tree desc) and dumped as CSV and as folded stacks
+// for flamegraph tools. Configure with -DAI_PROFILE=ON to enable, otherwise all of it compiles out.
+#ifndef AI_PROFILE
+#define AI_PROFILE 0
+#endif
+
+#if AI_PROFILE
+
+#include <chrono>
+#include <vector>
+
+#define AI_PROFILE_ONLY(...) __VA_ARGS__
+
+class ProfileTimer
+{
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+public:
+  uint64_t elapsedNs() const
+  {
+    return uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count());
+  }
+};
+
+// Counters of one tree desc, shared by all entities using it
+struct TreeProfile
+{
+  struct NodeCounters
+  {
+    const char *type = "";
+    int parent = -1;
+    uint64_t ticks = 0;
+    uint64_t results[3] = {}; // by BehResult
+    uint64_t inclusiveNs = 0;
+    uint64_t exclusiveNs = 0;
+  };
+
+  const char *archetype = "";
+  bool registered = false;
+  std::vector<NodeCounters> nodes;
+
+  void onTick(size_t idx, int result, uint64_t inclusive_ns, uint64_t exclusive_ns)
+  {
+    NodeCounters &counters = nodes[idx];
+    counters.ticks++;
+    counters.results[result]++;
+    counters.inclusiveNs += inclusive_ns;
+    counters.exclusiveNs += exclusive_ns;
+  }
+};
+
+// profile has to stay at the same address from now on
+void register_tree_profile(TreeProfile &profile);
+
+struct ProfileTopNode
+{
+  const TreeProfile *tree = nullptr;
+  size_t node = 0;
+};
+
+// nodes with the most exclusive time over all trees, returns how many were written
+size_t ai_profile_top_nodes(ProfileTopNode *out, size_t max_count);
+
+#else
+
+#define AI_PROFILE_ONLY(...)
+
+#endif
+
+constexpr const char *ai_profile_path = "ai_profile.csv"; // dumped on exit and on F9
+constexpr const char *ai_profile_folded_path = "ai_profile.folded";
+
+// Writes all collected counters as CSV and folded stacks,
+// returns false if profiling is compiled out or files can't be written
+bool dump_ai_profile(const char *path, const char *folded_path);
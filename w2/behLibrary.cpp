@@ -5,191 +5,105 @@
 #include "math.h"
 #include "raylib.h"
 #include "blackboard.h"
-#include <map>
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
 
-struct CompoundNode : public BehNode
-{
-  std::vector<BehNode*> nodes;
-  int current = 0;
-
-  virtual ~CompoundNode()
-  {
-    for (BehNode *node : nodes)
-      delete node;
-    nodes.clear();
-  }
+// written by update_beh_sensors for every entity with a tree, conditions read them
+// from the blackboard so trees can watch them for changes
+static BlackboardKey<float> hp_key() { return bb_key<float, "hp">(); }
+static BlackboardKey<flecs::entity> sensed_enemy_key() { return bb_key<flecs::entity, "sensed_enemy">(); }
+static BlackboardKey<float> sensed_enemy_dist_key() { return bb_key<float, "sensed_enemy_dist">(); }
 
-  CompoundNode &pushNode(BehNode *node)
-  {
-    nodes.push_back(node);
-    return *this;
-  }
-
-  void react(flecs::world &ecs, flecs::entity entity, Blackboard &bb, Event coming_evt) override {
-    nodes[current]->react(ecs, entity, bb, coming_evt);
-  }
-};
-
-struct Sequence : public CompoundNode
+static BehResult move_to_entity_update(const BehNode &node, flecs::entity entity, Blackboard &bb)
 {
-  BehResult update(flecs::world &ecs, flecs::entity entity, Blackboard &bb) override
+  BehResult res = BEH_RUNNING;
+  entity.set([&](Action &a, const Position &pos)
   {
-    int cur_i = 0;
-    for (BehNode *node : nodes)
+    flecs::entity targetEntity = bb.get<flecs::entity>(node.bb);
+    if (!targetEntity.is_alive())
     {
-      BehResult res = node->update(ecs, entity, bb);
-      if (res != BEH_SUCCESS) {
-        current = cur_i;
-        return res;
-      }
-      cur_i++;
+      res = BEH_FAIL;
+      return;
     }
-    return BEH_SUCCESS;
-  }
-};
-
-struct Selector : public CompoundNode
-{
-  BehResult update(flecs::world &ecs, flecs::entity entity, Blackboard &bb) override
-  {
-    int cur_i = 0;
-    for (BehNode *node : nodes)
+    targetEntity.get([&](const Position &target_pos)
     {
-      BehResult res = node->update(ecs, entity, bb);
-      if (res != BEH_FAIL) {
-        current = cur_i;
-        return res;
+      if (pos != target_pos)
+      {
+        a.action = move_towards(pos, target_pos);
+        res = BEH_RUNNING;
       }
-      cur_i++;
-    }
-    return BEH_FAIL;
-  }
-};
+      else
+        res = BEH_SUCCESS;
+    });
+  });
+  return res;
+}
 
-struct NotNode : public BehNode
+static BehResult is_low_hp_update(const BehNode &node, const Blackboard &bb)
 {
-  BehNode* node;
-
-  NotNode(BehNode *_node) : node(_node) {}
-
-  virtual ~NotNode()
-  {
-    delete node;
-  }
-
-  BehResult update(flecs::world &ecs, flecs::entity entity, Blackboard &bb) override
-  {
-    BehResult res = node->update(ecs, entity, bb);
-    if (res == BEH_FAIL)
-      return BEH_SUCCESS;
-    else if (res == BEH_SUCCESS) 
-      return BEH_FAIL;
-    throw "Wrong node result";
-  }
-
-  void react(flecs::world &ecs, flecs::entity entity, Blackboard &bb, Event coming_evt) override {
-    node->react(ecs, entity, bb, coming_evt);
-  }
-};
+  return bb.get(hp_key()) < node.param ? BEH_SUCCESS : BEH_FAIL;
+}
 
-struct Parallel : public CompoundNode
+static BehResult find_enemy_update(const BehNode &node, Blackboard &bb)
 {
-  BehResult update(flecs::world &ecs, flecs::entity entity, Blackboard &bb) override
-  {
-    for (BehNode *node : nodes)
-    {
-      BehResult res = node->update(ecs, entity, bb);
-      if (res != BEH_RUNNING)
-        return res;    
-    }
-    return BEH_RUNNING;
-  }
-
-  void react(flecs::world &ecs, flecs::entity entity, Blackboard &bb, Event coming_evt) override {
-    for (BehNode *node : nodes)
-    {
-      node->react(ecs, entity, bb, coming_evt);
-    }
-  }
-};
+  const flecs::entity enemy = bb.get(sensed_enemy_key());
+  if (!enemy.is_alive() || bb.get(sensed_enemy_dist_key()) > node.param)
+    return BEH_FAIL;
+  bb.set<flecs::entity>(node.bb, enemy);
+  return BEH_SUCCESS;
+}
 
-struct OrNode : public CompoundNode
+static BehResult find_closest_update(const BehNode &node, flecs::world &ecs, flecs::entity entity, Blackboard &bb)
 {
-  BehResult update(flecs::world &ecs, flecs::entity entity, Blackboard &bb) override
-  {
-    BehResult total_res = BEH_FAIL;
-    for (BehNode *node : nodes)
-    {
-      BehResult res = node->update(ecs, entity, bb);
-      if (res == BEH_SUCCESS)
-        return BEH_SUCCESS;
-      else if (res == BEH_RUNNING)
-        throw "Wrong node result";
-    }
+  flecs::entity closest = node.findClosest(ecs, entity);
+  if (!ecs.is_valid(closest))
     return BEH_FAIL;
-  }
-};
+  bb.set<flecs::entity>(node.bb, closest);
+  return BEH_SUCCESS;
+}
 
-struct AndNode : public CompoundNode
+static BehResult flee_update(const BehNode &node, flecs::entity entity, Blackboard &bb)
 {
-  BehResult update(flecs::world &ecs, flecs::entity entity, Blackboard &bb) override
+  BehResult res = BEH_RUNNING;
+  entity.set([&](Action &a, const Position &pos)
   {
-    for (BehNode *node : nodes)
+    flecs::entity targetEntity = bb.get<flecs::entity>(node.bb);
+    if (!targetEntity.is_alive())
     {
-      BehResult res = node->update(ecs, entity, bb);
-      if (res == BEH_FAIL)
-        return BEH_FAIL;
-      else if (res == BEH_RUNNING)
-        throw "Wrong node result";
+      res = BEH_FAIL;
+      return;
     }
-    return BEH_SUCCESS;
-  }
-};
+    targetEntity.get([&](const Position &target_pos)
+    {
+      a.action = inverse_move(move_towards(pos, target_pos));
+    });
+  });
+  return res;
+}
 
-struct ReactNode : public BehNode
+static BehResult patrol_update(const BehNode &node, flecs::entity entity, Blackboard &bb)
 {
-  std::map<Events, react_func> reactions;
-  BehNode* node;
-  
-  ReactNode(BehNode *_node) : node(_node) {}
-
-  ReactNode &addReaction(Events evt, react_func func)
+  BehResult res = BEH_RUNNING;
+  entity.set([&](Action &a, const Position &pos)
   {
-    reactions[evt] = func;
-    return *this;
-  } 
-
-  BehResult update(flecs::world &ecs, flecs::entity entity, Blackboard &bb) override
-  {
-    return node->update(ecs, entity, bb);
-  }
-
-  void react(flecs::world &ecs, flecs::entity entity, Blackboard &bb, Event coming_evt) override {
-    reactions[coming_evt.event](ecs, entity, bb, coming_evt.event_bb);
-    node->react(ecs, entity, bb, coming_evt);
-  }
-};
+    Position patrolPos = bb.get<Position>(node.bb);
+    if (dist(pos, patrolPos) > node.param)
+      a.action = move_towards(pos, patrolPos);
+    else
+      a.action = GetRandomValue(EA_MOVE_START, EA_MOVE_END - 1); // do a random walk
+  });
+  return res;
+}
 
-struct MoveToEntity : public BehNode
+static BehResult route_go_update(flecs::entity entity)
 {
-  size_t entityBb = size_t(-1); // wraps to 0xff...
-  MoveToEntity(flecs::entity entity, const char *bb_name)
+  BehResult res = BEH_RUNNING;
+  entity.set([&](Action &a, const Position &pos)
   {
-    entityBb = reg_entity_blackboard_var<flecs::entity>(entity, bb_name);
-  }
-
-  BehResult update(flecs::world &, flecs::entity entity, Blackboard &bb) override
-  {
-    BehResult res = BEH_RUNNING;
-    entity.set([&](Action &a, const Position &pos)
+    entity.each<WayPoint>([&](flecs::entity point)
     {
-      flecs::entity targetEntity = bb.get<flecs::entity>(entityBb);
-      if (!targetEntity.is_alive())
-      {
-        res = BEH_FAIL;
-        return;
-      }
-      targetEntity.get([&](const Position &target_pos)
+      point.get([&](const Position &target_pos)
       {
         if (pos != target_pos)
         {
@@ -200,310 +114,576 @@ struct MoveToEntity : public BehNode
           res = BEH_SUCCESS;
       });
     });
-    return res;
-  }
-
-  void react(flecs::world &ecs, flecs::entity entity, Blackboard &bb, Event coming_evt) override {}
-};
+  });
+  return res;
+}
 
-struct IsLowHp : public BehNode
+static BehResult get_next_point_update(flecs::entity entity)
 {
-  float threshold = 0.f;
-  IsLowHp(float thres) : threshold(thres) {}
-
-  BehResult update(flecs::world &, flecs::entity entity, Blackboard &) override
+  BehResult res = BEH_FAIL;
+  entity.each<WayPoint>([&](flecs::entity cur_point)
   {
-    BehResult res = BEH_SUCCESS;
-    entity.get([&](const Hitpoints &hp)
+    cur_point.each<WayPoint>([&](flecs::entity next_point)
     {
-      res = hp.hitpoints < threshold ? BEH_SUCCESS : BEH_FAIL;
+      entity.remove<WayPoint>(cur_point);
+      entity.add<WayPoint>(next_point);
+      res = BEH_SUCCESS;
     });
-    return res;
-  }
+  });
+  return res;
+}
 
-  void react(flecs::world &ecs, flecs::entity entity, Blackboard &bb, Event coming_evt) override {}
-};
+static BehResult ask_help_update(const BehNode &node, flecs::world &ecs, flecs::entity entity, Blackboard &bb,
+                                 const AIContext &ctx)
+{
+  flecs::entity targetEntity = bb.get<flecs::entity>(node.bb);
+  if (!ecs.is_valid(targetEntity) || !ctx.mailboxes){
+    return BEH_FAIL;
+  }
+  BehResult res = BEH_FAIL;
+  entity.get([&](const Swarm &swarm)
+  {
+    ctx.mailboxes->sendToSwarm(swarm.idx, Event{HelpEvent, entity, targetEntity});
+    res = BEH_SUCCESS;
+  });
+  return res;
+}
 
-struct FindEnemy : public BehNode
+const char *beh_node_type_name(BehNodeType type)
 {
-  size_t entityBb = size_t(-1);
-  float distance = 0;
-  FindEnemy(flecs::entity entity, float in_dist, const char *bb_name) : distance(in_dist)
+  switch (type)
   {
-    entityBb = reg_entity_blackboard_var<flecs::entity>(entity, bb_name);
+  case BEH_SEQUENCE: return "Sequence";
+  case BEH_SELECTOR: return "Selector";
+  case BEH_PARALLEL: return "Parallel";
+  case BEH_AND: return "And";
+  case BEH_OR: return "Or";
+  case BEH_MEM_SEQUENCE: return "MemSequence";
+  case BEH_MEM_SELECTOR: return "MemSelector";
+  case BEH_NOT: return "Not";
+  case BEH_REACT: return "React";
+  case BEH_MOVE_TO_ENTITY: return "MoveToEntity";
+  case BEH_IS_LOW_HP: return "IsLowHp";
+  case BEH_FIND_ENEMY: return "FindEnemy";
+  case BEH_FIND_CLOSEST: return "FindClosest";
+  case BEH_FLEE: return "Flee";
+  case BEH_PATROL: return "Patrol";
+  case BEH_ROUTE_GO: return "RouteGo";
+  case BEH_GET_NEXT_POINT: return "GetNextPoint";
+  case BEH_ASK_HELP: return "AskHelp";
   }
-  BehResult update(flecs::world &ecs, flecs::entity entity, Blackboard &bb) override
+  return "Unknown";
+}
+
+#if AI_PROFILE
+TreeProfile &BehaviourTreeDesc::getProfile() const
+{
+  if (!profile.registered)
   {
-    BehResult res = BEH_FAIL;
-    static auto enemiesQuery = ecs.query<const Position, const Team>();
-    entity.set([&](const Position &pos, const Team &t)
+    profile.archetype = name;
+    profile.nodes.resize(nodes.size());
+    for (size_t i = 0; i < nodes.size(); ++i)
     {
-      flecs::entity closestEnemy;
-      float closestDist = FLT_MAX;
-      Position closestPos;
-      enemiesQuery.each([&](flecs::entity enemy, const Position &epos, const Team &et)
-      {
-        if (t.team == et.team)
-          return;
-        float curDist = dist(epos, pos);
-        if (curDist < closestDist)
-        {
-          closestDist = curDist;
-          closestPos = epos;
-          closestEnemy = enemy;
-        }
-      });
-      if (ecs.is_valid(closestEnemy) && closestDist <= distance)
-      {
-        bb.set<flecs::entity>(entityBb, closestEnemy);
-        res = BEH_SUCCESS;
-      }
-    });
-    return res;
+      profile.nodes[i].type = beh_node_type_name(nodes[i].type);
+      for (size_t child = i + 1; child < nodes[i].next; child = nodes[child].next)
+        profile.nodes[child].parent = int(i);
+    }
+    register_tree_profile(profile);
   }
+  return profile;
+}
 
-  void react(flecs::world &ecs, flecs::entity entity, Blackboard &bb, Event coming_evt) override {}
-};
+// inclusive time of the children of the node being ticked, the rest of its time is its own
+static uint64_t profile_children_ns = 0;
+#endif
 
-struct Flee : public BehNode
+BehResult BehaviourTreeDesc::update(size_t idx, BehaviourTree &bt, flecs::world &ecs, flecs::entity entity,
+                                    Blackboard &bb, const AIContext &ctx) const
 {
-  size_t entityBb = size_t(-1);
-  Flee(flecs::entity entity, const char *bb_name)
-  {
-    entityBb = reg_entity_blackboard_var<flecs::entity>(entity, bb_name);
-  }
+#if AI_PROFILE
+  const uint64_t outerChildrenNs = profile_children_ns;
+  profile_children_ns = 0;
+  const ProfileTimer timer;
+  const BehResult res = tickNode(idx, bt, ecs, entity, bb, ctx);
+  const uint64_t ns = timer.elapsedNs();
+  getProfile().onTick(idx, int(res), ns, ns > profile_children_ns ? ns - profile_children_ns : 0);
+  profile_children_ns = outerChildrenNs + ns;
+  return res;
+#else
+  return tickNode(idx, bt, ecs, entity, bb, ctx);
+#endif
+}
 
-  BehResult update(flecs::world &, flecs::entity entity, Blackboard &bb) override
+BehResult BehaviourTreeDesc::tickNode(size_t idx, BehaviourTree &bt, flecs::world &ecs, flecs::entity entity,
+                                      Blackboard &bb, const AIContext &ctx) const
+{
+  const BehNode &node = nodes[idx];
+  switch (node.type)
+  {
+  case BEH_SEQUENCE:
   {
-    BehResult res = BEH_RUNNING;
-    entity.set([&](Action &a, const Position &pos)
+    size_t child = idx + 1;
+    for (uint8_t i = 0; i < node.numChildren; ++i, child = nodes[child].next)
     {
-      flecs::entity targetEntity = bb.get<flecs::entity>(entityBb);
-      if (!targetEntity.is_alive())
+      BehResult res = update(child, bt, ecs, entity, bb, ctx);
+      if (res != BEH_SUCCESS)
       {
-        res = BEH_FAIL;
-        return;
+        switchChild(idx, bt, i);
+        return res;
       }
-      targetEntity.get([&](const Position &target_pos)
+    }
+    return BEH_SUCCESS;
+  }
+  case BEH_SELECTOR:
+  {
+    size_t child = idx + 1;
+    for (uint8_t i = 0; i < node.numChildren; ++i, child = nodes[child].next)
+    {
+      BehResult res = update(child, bt, ecs, entity, bb, ctx);
+      if (res != BEH_FAIL)
       {
-        a.action = inverse_move(move_towards(pos, target_pos));
-      });
-    });
-    return res;
+        switchChild(idx, bt, i);
+        return res;
+      }
+    }
+    return BEH_FAIL;
   }
-
-  void react(flecs::world &ecs, flecs::entity entity, Blackboard &bb, Event coming_evt) override {}
-};
-
-struct Patrol : public BehNode
-{
-  size_t pposBb = size_t(-1);
-  float patrolDist = 1.f;
-  Patrol(flecs::entity entity, float patrol_dist, const char *bb_name)
-    : patrolDist(patrol_dist)
+  case BEH_MEM_SEQUENCE:
+  case BEH_MEM_SELECTOR:
   {
-    pposBb = reg_entity_blackboard_var<Position>(entity, bb_name);
-    entity.set([&](Blackboard &bb, const Position &pos)
+    // Resume at the running child, children before it have already finished with the result
+    // which let us get there. Only the ones marked with BEH_RECHECK are ticked again: a failed
+    // condition aborts the sequence, a higher priority branch which doesn't fail takes over.
+    const BehResult passing = node.type == BEH_MEM_SEQUENCE ? BEH_SUCCESS : BEH_FAIL;
+    const uint8_t running = bt.state[node.state];
+    size_t child = idx + 1;
+    for (uint8_t i = 0; i < node.numChildren; ++i, child = nodes[child].next)
     {
-      bb.set<Position>(pposBb, pos);
-    });
+      if (i < running && !(nodes[child].flags & BEH_RECHECK))
+        continue;
+      BehResult res = update(child, bt, ecs, entity, bb, ctx);
+      if (res == passing)
+        continue;
+      switchChild(idx, bt, res == BEH_RUNNING ? i : 0);
+      return res;
+    }
+    switchChild(idx, bt, 0);
+    return passing;
   }
-
-  BehResult update(flecs::world &, flecs::entity entity, Blackboard &bb) override
+  case BEH_PARALLEL:
   {
-    BehResult res = BEH_RUNNING;
-    entity.set([&](Action &a, const Position &pos)
+    size_t child = idx + 1;
+    for (uint8_t i = 0; i < node.numChildren; ++i, child = nodes[child].next)
     {
-      Position patrolPos = bb.get<Position>(pposBb);
-      if (dist(pos, patrolPos) > patrolDist)
-        a.action = move_towards(pos, patrolPos);
-      else
-        a.action = GetRandomValue(EA_MOVE_START, EA_MOVE_END - 1); // do a random walk
-    });
-    return res;
+      BehResult res = update(child, bt, ecs, entity, bb, ctx);
+      if (res != BEH_RUNNING)
+        return res;
+    }
+    return BEH_RUNNING;
+  }
+  case BEH_AND:
+  case BEH_OR:
+  {
+    // and fails on the first failure, or succeeds on the first success
+    const BehResult decisive = node.type == BEH_AND ? BEH_FAIL : BEH_SUCCESS;
+    size_t child = idx + 1;
+    for (uint8_t i = 0; i < node.numChildren; ++i, child = nodes[child].next)
+    {
+      BehResult res = update(child, bt, ecs, entity, bb, ctx);
+      if (res == decisive)
+        return decisive;
+      else if (res == BEH_RUNNING)
+        throw "Wrong node result";
+    }
+    return decisive == BEH_FAIL ? BEH_SUCCESS : BEH_FAIL;
+  }
+  case BEH_NOT:
+  {
+    BehResult res = update(idx + 1, bt, ecs, entity, bb, ctx);
+    if (res == BEH_FAIL)
+      return BEH_SUCCESS;
+    else if (res == BEH_SUCCESS)
+      return BEH_FAIL;
+    throw "Wrong node result";
+  }
+  case BEH_REACT:
+    return update(idx + 1, bt, ecs, entity, bb, ctx);
+  default:
+    break;
   }
 
-  void react(flecs::world &ecs, flecs::entity entity, Blackboard &bb, Event coming_evt) override {}
-};
+  BehResult res = BEH_FAIL;
+  switch (node.type)
+  {
+  case BEH_MOVE_TO_ENTITY: res = move_to_entity_update(node, entity, bb); break;
+  case BEH_IS_LOW_HP: res = is_low_hp_update(node, bb); break;
+  case BEH_FIND_ENEMY: res = find_enemy_update(node, bb); break;
+  case BEH_FIND_CLOSEST: res = find_closest_update(node, ecs, entity, bb); break;
+  case BEH_FLEE: res = flee_update(node, entity, bb); break;
+  case BEH_PATROL: res = patrol_update(node, entity, bb); break;
+  case BEH_ROUTE_GO: res = route_go_update(entity); break;
+  case BEH_GET_NEXT_POINT: res = get_next_point_update(entity); break;
+  case BEH_ASK_HELP: res = ask_help_update(node, ecs, entity, bb, ctx); break;
+  default: break;
+  }
+  if (res == BEH_RUNNING)
+    bt.runningLeaf = uint16_t(idx + 1);
+  else if (reads_world(node.type))
+    bt.passedWorldLeaf = true;
+  return res;
+}
 
-struct RouteGo : public BehNode
+void BehaviourTreeDesc::tick(BehaviourTree &bt, flecs::world &ecs, flecs::entity entity, Blackboard &bb,
+                             const AIContext &ctx) const
 {
-  RouteGo() {}
+  // nothing the tree has decided on changed, so the same leaf would be picked again
+  bt.resumed = resumable && bt.runningLeaf > 0 && !bt.passedWorldLeaf &&
+               (bb.getChanged() & bt.watchMask) == 0 &&
+               update(bt.runningLeaf - 1, bt, ecs, entity, bb, ctx) == BEH_RUNNING;
+  if (!bt.resumed)
+  {
+    bt.runningLeaf = 0;
+    bt.passedWorldLeaf = false;
+    update(0, bt, ecs, entity, bb, ctx);
+  }
+  // writes of the tick itself are already accounted for
+  bb.clearChanged();
+}
 
-  BehResult update(flecs::world &, flecs::entity entity, Blackboard &bb) override
+// events go down the running branch, parallel nodes pass them to all children
+void BehaviourTreeDesc::react(size_t idx, const BehaviourTree &bt, flecs::world &ecs, flecs::entity entity,
+                              Blackboard &bb, const Event &coming_evt) const
+{
+  const BehNode &node = nodes[idx];
+  switch (node.type)
   {
-    BehResult res = BEH_RUNNING;
-    entity.set([&](Action &a, const Position &pos)
-    {
-      entity.each<WayPoint>([&](flecs::entity point) 
-      {
-        point.get([&](const Position &target_pos)
-        {
-          if (pos != target_pos)
-          {
-            a.action = move_towards(pos, target_pos);
-            res = BEH_RUNNING;
-          }
-          else
-            res = BEH_SUCCESS;
-        });
-      });
-    });
-    return res;
+  case BEH_SEQUENCE:
+  case BEH_SELECTOR:
+  case BEH_AND:
+  case BEH_OR:
+  case BEH_MEM_SEQUENCE:
+  case BEH_MEM_SELECTOR:
+  {
+    if (node.numChildren > 0)
+      react(childAt(idx, bt.state[node.state]), bt, ecs, entity, bb, coming_evt);
+    break;
   }
+  case BEH_PARALLEL:
+  {
+    size_t child = idx + 1;
+    for (uint8_t i = 0; i < node.numChildren; ++i, child = nodes[child].next)
+      react(child, bt, ecs, entity, bb, coming_evt);
+    break;
+  }
+  case BEH_REACT:
+    for (uint32_t i = node.reactionsBegin; i < node.reactionsEnd; ++i)
+      if (reactions[i].first == coming_evt.event)
+        reactions[i].second(ecs, entity, bb, coming_evt);
+    [[fallthrough]];
+  case BEH_NOT:
+    react(idx + 1, bt, ecs, entity, bb, coming_evt);
+    break;
+  default:
+    break;
+  }
+}
 
-  void react(flecs::world &ecs, flecs::entity entity, Blackboard &bb, Event coming_evt) override {}
-};
+size_t BehaviourTreeDesc::childAt(size_t idx, uint8_t num) const
+{
+  size_t child = idx + 1;
+  for (uint8_t i = 0; i < num && i + 1 < nodes[idx].numChildren; ++i)
+    child = nodes[child].next;
+  return child;
+}
 
-struct GetNextPoint : public BehNode
+// the branch which was running is left, memory composites in it start over next time
+void BehaviourTreeDesc::switchChild(size_t idx, BehaviourTree &bt, uint8_t to) const
 {
-  GetNextPoint() {}
+  uint8_t &cur = bt.state[nodes[idx].state];
+  if (cur == to)
+    return;
+  const size_t child = childAt(idx, cur);
+  for (size_t i = child; i < nodes[child].next; ++i)
+    if (is_composite(nodes[i].type))
+      bt.state[nodes[i].state] = 0;
+  cur = to;
+}
 
-  BehResult update(flecs::world &ecs, flecs::entity entity, Blackboard &bb) override
+void BehaviourTreeDesc::initEntity(flecs::entity entity, BehaviourTree &bt) const
+{
+  entity.set([&](Blackboard &bb, const Position &pos)
   {
-    BehResult res = BEH_FAIL;
-    flecs::entity next;
-    entity.each<WayPoint>([&](flecs::entity cur_point) 
+    bb.regName<float>("hp");
+    bb.regName<flecs::entity>("sensed_enemy");
+    bb.regName<float>("sensed_enemy_dist");
+    for (const BehNode &node : nodes)
     {
-      cur_point.each<WayPoint>([&](flecs::entity next_point) 
+      switch (node.type)
       {
-        entity.remove<WayPoint>(cur_point);
-        entity.add<WayPoint>(next_point);
-        res = BEH_SUCCESS;
-      });
-    });
-    return res;
-  }
-
-  void react(flecs::world &ecs, flecs::entity entity, Blackboard &bb, Event coming_evt) override {}
-};
+      case BEH_IS_LOW_HP:
+        bt.watchMask |= bb.watchBit(hp_key());
+        break;
+      case BEH_FIND_ENEMY:
+        bt.watchMask |= bb.watchBit(sensed_enemy_key()) | bb.watchBit(sensed_enemy_dist_key());
+        break;
+      case BEH_MOVE_TO_ENTITY:
+      case BEH_FLEE:
+      case BEH_ASK_HELP:
+        bt.watchMask |= bb.watchBit<flecs::entity>(node.bb);
+        break;
+      case BEH_PATROL:
+        bb.set<Position>(node.bb, pos);
+        bt.watchMask |= bb.watchBit<Position>(node.bb);
+        break;
+      default:
+        break;
+      }
+    }
+    bb.clearChanged();
+  });
+}
 
-struct AskHelp : public BehNode
+// trees are compiled once at startup, a tree that doesn't fit the packed nodes is a bug in its spec
+static void beh_tree_error(const char *tree, const char *what, size_t count, size_t limit)
 {
-  size_t entityBb = size_t(-1); // wraps to 0xff...
-  const char *target_bb_name;
+  fprintf(stderr, "behaviour tree '%s': %s (%zu, at most %zu)\n", tree, what, count, limit);
+  std::abort();
+}
 
-  AskHelp(flecs::entity entity, const char *bb_name, const char *_target_bb_name)
+void BehaviourTreeDesc::append(const BehNodeSpec &spec)
+{
+  const size_t idx = nodes.size();
+  BehNode node;
+  node.type = spec.type;
+  node.flags = spec.flags;
+  node.param = spec.param;
+  node.bb = spec.bb;
+  node.bb2 = spec.bb2;
+  node.findClosest = spec.findClosest;
+  if (spec.type == BEH_FIND_ENEMY)
+    senseRadius = std::max(senseRadius, spec.param);
+  if (spec.type == BEH_PARALLEL)
+    resumable = false;
+  if (spec.children.size() > UINT8_MAX)
+    beh_tree_error(name, "too many children in a node", spec.children.size(), UINT8_MAX);
+  node.numChildren = uint8_t(spec.children.size());
+  if (is_composite(spec.type))
   {
-    entityBb = reg_entity_blackboard_var<flecs::entity>(entity, bb_name);
-    target_bb_name = _target_bb_name;
+    if (numStates >= max_beh_tree_state)
+      beh_tree_error(name, "too many composites", numStates + 1, max_beh_tree_state);
+    node.state = uint8_t(numStates++);
   }
+  node.reactionsBegin = uint32_t(reactions.size());
+  reactions.insert(reactions.end(), spec.reactions.begin(), spec.reactions.end());
+  node.reactionsEnd = uint32_t(reactions.size());
+  nodes.push_back(node);
+
+  for (const BehNodeSpec &child : spec.children)
+    append(child);
+  if (nodes.size() > UINT16_MAX)
+    beh_tree_error(name, "too many nodes", nodes.size(), UINT16_MAX);
+  nodes[idx].next = uint16_t(nodes.size());
+}
 
-  BehResult update(flecs::world &ecs, flecs::entity entity, Blackboard &bb) override
-  {
-    static auto swarmQuery = ecs.query<const Swarm, Blackboard, BehaviourTree>();
-    flecs::entity targetEntity = bb.get<flecs::entity>(entityBb);
-    if (!ecs.is_valid(targetEntity)){
-      return BEH_FAIL;
-    }
-    Event evt = {HelpEvent, Blackboard{}};
-    size_t targetBb = evt.event_bb.regName<flecs::entity>(target_bb_name);
-    evt.event_bb.set<flecs::entity>(targetBb, targetEntity);
+BehaviourTreeDesc compile_beh_tree(const BehNodeSpec &root, const char *name)
+{
+  BehaviourTreeDesc desc;
+  desc.name = name;
+  desc.append(root);
+  return desc;
+}
 
-    entity.set([&](const Swarm &swarm)
-    {
-      swarmQuery.each([&](flecs::entity ally, const Swarm &aswarm, Blackboard &abb, BehaviourTree &abt)
-      {
-        if (swarm.idx != aswarm.idx)
-          return;
-        abt.root->react(ecs, ally, abb, evt);
-      });
-    });
-    return BEH_SUCCESS;
-  }
+static BehNodeSpec composite(BehNodeType type, const std::vector<BehNodeSpec> &nodes)
+{
+  BehNodeSpec spec;
+  spec.type = type;
+  spec.children = nodes;
+  return spec;
+}
+
+static BehNodeSpec leaf(BehNodeType type, float param = 0.f, uint32_t bb = uint32_t(-1))
+{
+  BehNodeSpec spec;
+  spec.type = type;
+  spec.param = param;
+  spec.bb = bb;
+  return spec;
+}
+
+BehNodeSpec sequence(const std::vector<BehNodeSpec> &nodes)
+{
+  return composite(BEH_SEQUENCE, nodes);
+}
 
-  void react(flecs::world &ecs, flecs::entity entity, Blackboard &bb, Event coming_evt) override {}
-};
+BehNodeSpec selector(const std::vector<BehNodeSpec> &nodes)
+{
+  return composite(BEH_SELECTOR, nodes);
+}
+
+BehNodeSpec mem_sequence(const std::vector<BehNodeSpec> &nodes)
+{
+  return composite(BEH_MEM_SEQUENCE, nodes);
+}
 
-BehNode *sequence(const std::vector<BehNode*> &nodes)
+BehNodeSpec mem_selector(const std::vector<BehNodeSpec> &nodes)
 {
-  Sequence *seq = new Sequence;
-  for (BehNode *node : nodes)
-    seq->pushNode(node);
-  return seq;
+  return composite(BEH_MEM_SELECTOR, nodes);
 }
 
-BehNode *selector(const std::vector<BehNode*> &nodes)
+BehNodeSpec recheck(const BehNodeSpec &node)
 {
-  Selector *sel = new Selector;
-  for (BehNode *node : nodes)
-    sel->pushNode(node);
-  return sel;
+  BehNodeSpec spec = node;
+  spec.flags |= BEH_RECHECK;
+  return spec;
 }
 
-BehNode *parallel(const std::vector<BehNode*> &nodes)
+BehNodeSpec parallel(const std::vector<BehNodeSpec> &nodes)
 {
-  Parallel *par = new Parallel;
-  for (BehNode *node : nodes)
-    par->pushNode(node);
-  return par;
+  return composite(BEH_PARALLEL, nodes);
 }
 
-BehNode *with_reaction(BehNode* node, const std::vector<std::pair<Events, react_func>> &reactions)
+BehNodeSpec with_reaction(const BehNodeSpec &node, const std::vector<std::pair<Events, react_func>> &reactions)
 {
-  ReactNode *rea = new ReactNode(node);
-  for (auto [evt, react] : reactions)
-    rea->addReaction(evt, react);
-  return rea;
+  BehNodeSpec spec = composite(BEH_REACT, {node});
+  spec.reactions = reactions;
+  return spec;
 }
 
-BehNode *and_node(const std::vector<BehNode*> &nodes)
+BehNodeSpec and_node(const std::vector<BehNodeSpec> &nodes)
 {
-  AndNode *an = new AndNode;
-  for (BehNode *node : nodes)
-    an->pushNode(node);
-  return an;
+  return composite(BEH_AND, nodes);
 }
 
-BehNode *or_node(const std::vector<BehNode*> &nodes)
+BehNodeSpec or_node(const std::vector<BehNodeSpec> &nodes)
 {
-  OrNode *on = new OrNode;
-  for (BehNode *node : nodes)
-    on->pushNode(node);
-  return on;
+  return composite(BEH_OR, nodes);
 }
 
-BehNode *not_node(BehNode* node) 
+BehNodeSpec not_node(const BehNodeSpec &node)
 {
-  return new NotNode(node);
+  return composite(BEH_NOT, {node});
 }
 
-BehNode *move_to_entity(flecs::entity entity, const char *bb_name)
+BehNodeSpec move_to_entity(flecs::entity entity, const char *bb_name)
 {
-  return new MoveToEntity(entity, bb_name);
+  return leaf(BEH_MOVE_TO_ENTITY, 0.f, uint32_t(reg_entity_blackboard_var<flecs::entity>(entity, bb_name)));
 }
 
-BehNode *is_low_hp(float thres)
+BehNodeSpec is_low_hp(float thres)
 {
-  return new IsLowHp(thres);
+  return leaf(BEH_IS_LOW_HP, thres);
 }
 
-BehNode *find_enemy(flecs::entity entity, float dist, const char *bb_name)
+BehNodeSpec find_enemy(flecs::entity entity, float dist, const char *bb_name)
 {
-  return new FindEnemy(entity, dist, bb_name);
+  return leaf(BEH_FIND_ENEMY, dist, uint32_t(reg_entity_blackboard_var<flecs::entity>(entity, bb_name)));
 }
 
-BehNode *flee(flecs::entity entity, const char *bb_name)
+BehNodeSpec flee(flecs::entity entity, const char *bb_name)
 {
-  return new Flee(entity, bb_name);
+  return leaf(BEH_FLEE, 0.f, uint32_t(reg_entity_blackboard_var<flecs::entity>(entity, bb_name)));
 }
 
-BehNode *patrol(flecs::entity entity, float patrol_dist, const char *bb_name)
+BehNodeSpec patrol(flecs::entity entity, float patrol_dist, const char *bb_name)
 {
-  return new Patrol(entity, patrol_dist, bb_name);
+  return leaf(BEH_PATROL, patrol_dist, uint32_t(reg_entity_blackboard_var<Position>(entity, bb_name)));
 }
 
-BehNode *get_next_point() 
+BehNodeSpec get_next_point()
 {
-  return new GetNextPoint();
+  return leaf(BEH_GET_NEXT_POINT);
 }
 
-BehNode *route_go() 
+BehNodeSpec route_go()
 {
-  return new RouteGo();
+  return leaf(BEH_ROUTE_GO);
 }
 
-BehNode *ask_help(flecs::entity entity, const char *bb_name, const char *target_bb_name) 
+BehNodeSpec ask_help(flecs::entity entity, const char *bb_name)
 {
-  return new AskHelp(entity, bb_name, target_bb_name);
-}
\ No newline at end of file
+  return leaf(BEH_ASK_HELP, 0.f, uint32_t(reg_entity_blackboard_var<flecs::entity>(entity, bb_name)));
+}
+
+BehNodeSpec find_closest_spec(flecs::entity entity, const char *bb_name, find_closest_func func)
+{
+  BehNodeSpec spec = leaf(BEH_FIND_CLOSEST, 0.f, uint32_t(reg_entity_blackboard_var<flecs::entity>(entity, bb_name)));
+  spec.findClosest = func;
+  return spec;
+}
+
+void set_beh_tree(flecs::entity entity, const BehaviourTreeDesc &desc)
+{
+  BehaviourTree bt{&desc};
+  desc.initEntity(entity, bt);
+  entity.set(bt);
+}
+
+void update_beh_sensors(flecs::world &ecs, const AIContext &ctx)
+{
+  static auto sensorsQuery = ecs.query<const BehaviourTree, Blackboard, const Position, const Team, const Hitpoints>();
+  sensorsQuery.each([&](const BehaviourTree &bt, Blackboard &bb, const Position &pos, const Team &t, const Hitpoints &hp)
+  {
+    bb.set(hp_key(), hp.hitpoints);
+    const float radius = bt.getDesc() ? bt.getDesc()->getSenseRadius() : 0.f;
+    SpatialHash::Neighbour enemy;
+    // enemies out of reach of every FindEnemy are not written, so moving around there changes nothing
+    if (ctx.spatialHash && radius > 0.f &&
+        ctx.spatialHash->nearest(pos, [&](int team) { return team != t.team; }, enemy) && enemy.dist <= radius)
+    {
+      bb.set(sensed_enemy_key(), enemy.entity);
+      bb.set(sensed_enemy_dist_key(), enemy.dist);
+    }
+    else
+    {
+      bb.set(sensed_enemy_key(), flecs::entity());
+      bb.set(sensed_enemy_dist_key(), FLT_MAX);
+    }
+  });
+}
+
+void deliver_events(flecs::world &ecs, EventMailboxes &mailboxes)
+{
+  if (mailboxes.empty())
+    return;
+
+  // swarm members are indexed once per batch instead of scanning all of them per event
+  static auto swarmQuery = ecs.query<const Swarm, const BehaviourTree>();
+  std::vector<std::vector<flecs::entity>> &members = mailboxes.swarmMembers;
+  for (std::vector<flecs::entity> &swarm : members)
+    swarm.clear();
+  bool anySwarmEvents = false;
+  for (const std::vector<Event> &mailbox : mailboxes.swarms)
+    anySwarmEvents |= !mailbox.empty();
+  if (anySwarmEvents)
+    swarmQuery.each([&](flecs::entity member, const Swarm &swarm, const BehaviourTree &)
+    {
+      if (swarm.idx < 0 || size_t(swarm.idx) >= mailboxes.swarms.size() || mailboxes.swarms[size_t(swarm.idx)].empty())
+        return;
+      if (size_t(swarm.idx) >= members.size())
+        members.resize(size_t(swarm.idx) + 1);
+      members[size_t(swarm.idx)].push_back(member);
+    });
+
+  auto deliver = [&](flecs::entity receiver, const Event *begin, const Event *end)
+  {
+    if (!receiver.is_alive())
+      return;
+    receiver.set([&](Blackboard &bb, const BehaviourTree &bt)
+    {
+      for (const Event *evt = begin; evt != end; ++evt)
+        bt.react(ecs, receiver, bb, *evt);
+    });
+  };
+  for (size_t i = 0; i < mailboxes.swarms.size() && i < members.size(); ++i)
+  {
+    const std::vector<Event> &mailbox = mailboxes.swarms[i];
+    for (flecs::entity member : members[i])
+      deliver(member, mailbox.data(), mailbox.data() + mailbox.size());
+  }
+  for (const auto &[receiver, evt] : mailboxes.entities)
+    deliver(receiver, &evt, &evt + 1);
+
+  for (std::vector<Event> &mailbox : mailboxes.swarms)
+    mailbox.clear();
+  mailboxes.entities.clear();
+}
@@ -1,7 +1,12 @@
 #pragma once
 
 #include <flecs.h>
-#include <memory>
+#include <cstdint>
+#include <functional>
+#include <utility>
+#include <vector>
+#include "aiContext.h"
+#include "aiProfile.h"
 #include "blackboard.h"
 #include "Event.h"
 
@@ -12,31 +17,170 @@ enum BehResult
   BEH_RUNNING
 };
 
+using react_func = std::function<void(flecs::world&, flecs::entity, Blackboard&, const Event&)>;
+// finds an entity for FindClosest nodes, one instantiation per component type
+using find_closest_func = flecs::entity (*)(flecs::world&, flecs::entity);
+
+enum BehNodeType : uint8_t
+{
+  // composites
+  BEH_SEQUENCE,
+  BEH_SELECTOR,
+  BEH_PARALLEL,
+  BEH_AND,
+  BEH_OR,
+  BEH_MEM_SEQUENCE,
+  BEH_MEM_SELECTOR,
+  // decorators
+  BEH_NOT,
+  BEH_REACT,
+  // leaves
+  BEH_MOVE_TO_ENTITY,
+  BEH_IS_LOW_HP,
+  BEH_FIND_ENEMY,
+  BEH_FIND_CLOSEST,
+  BEH_FLEE,
+  BEH_PATROL,
+  BEH_ROUTE_GO,
+  BEH_GET_NEXT_POINT,
+  BEH_ASK_HELP
+};
+
+constexpr bool is_composite(BehNodeType type) { return type <= BEH_MEM_SELECTOR; }
+// leaves whose result depends on more than the blackboard, e.g. positions or relations of other entities
+constexpr bool reads_world(BehNodeType type)
+{
+  return type == BEH_MOVE_TO_ENTITY || type == BEH_FIND_CLOSEST || type == BEH_FLEE || type == BEH_ROUTE_GO ||
+         type == BEH_GET_NEXT_POINT || type == BEH_ASK_HELP;
+}
+const char *beh_node_type_name(BehNodeType type);
+
+enum BehNodeFlags : uint8_t
+{
+  // memory composites resuming past this child still tick it first
+  BEH_RECHECK = 1 << 0
+};
+
+// Authoring form of a node, built by sequence(), selector(), find_enemy() and friends.
+// Blackboard names are already resolved to schema indices here, compile_beh_tree()
+// lowers the whole tree into a BehaviourTreeDesc.
+struct BehNodeSpec
+{
+  BehNodeType type = BEH_SEQUENCE;
+  uint8_t flags = 0;
+  float param = 0.f;
+  uint32_t bb = uint32_t(-1);
+  uint32_t bb2 = uint32_t(-1);
+  find_closest_func findClosest = nullptr;
+  std::vector<std::pair<Events, react_func>> reactions;
+  std::vector<BehNodeSpec> children;
+};
+
+// Node of a compiled tree. Nodes are stored in preorder, so children of a node start
+// right after it and every child links to its next sibling.
 struct BehNode
 {
-  virtual ~BehNode() {}
-  virtual BehResult update(flecs::world &ecs, flecs::entity entity, Blackboard &bb) = 0;
-  virtual void react(flecs::world &ecs, flecs::entity entity, Blackboard &bb, Event coming_evt) = 0;
+  BehNodeType type = BEH_SEQUENCE;
+  uint8_t numChildren = 0;
+  uint8_t state = 0; // byte in the per-entity state, composites only
+  uint8_t flags = 0;
+  uint16_t next = 0; // next sibling, or the end of the parent's children
+  float param = 0.f; // hp threshold, search or patrol distance
+  uint32_t bb = uint32_t(-1); // blackboard variable the leaf works with
+  uint32_t bb2 = uint32_t(-1); // event blackboard variable for AskHelp
+  uint32_t reactionsBegin = 0; // for React, range in the reactions table of the desc
+  uint32_t reactionsEnd = 0;
+  find_closest_func findClosest = nullptr;
 };
 
-struct BehaviourTree
+constexpr size_t max_beh_tree_state = 16;
+
+class BehaviourTree;
+
+// Compiled tree shared by all entities of an archetype, read-only once built
+class BehaviourTreeDesc
 {
-  std::unique_ptr<BehNode> root = nullptr;
+public:
+  BehaviourTreeDesc() = default;
+  BehaviourTreeDesc(const BehaviourTreeDesc &desc) = delete;
+  BehaviourTreeDesc(BehaviourTreeDesc &&desc) = default;
 
-  BehaviourTree() = default;
-  BehaviourTree(BehNode *r) : root(r) {}
+  BehaviourTreeDesc &operator=(const BehaviourTreeDesc &desc) = delete;
+  BehaviourTreeDesc &operator=(BehaviourTreeDesc &&desc) = default;
+
+  size_t numNodes() const { return nodes.size(); }
+  const BehNode &getNode(size_t idx) const { return nodes[idx]; }
+  size_t stateSize() const { return numStates; }
+  // furthest FindEnemy in the tree, enemies beyond it are not sensed
+  float getSenseRadius() const { return senseRadius; }
+  const char *getName() const { return name; }
+  AI_PROFILE_ONLY(TreeProfile &getProfile() const;)
 
-  BehaviourTree(const BehaviourTree &bt) = delete;
-  BehaviourTree(BehaviourTree &&bt) = default;
+  // per-entity setup, e.g. remembering where to patrol and which keys to watch
+  void initEntity(flecs::entity entity, BehaviourTree &bt) const;
 
-  BehaviourTree &operator=(const BehaviourTree &bt) = delete;
-  BehaviourTree &operator=(BehaviourTree &&bt) = default;
+  void tick(BehaviourTree &bt, flecs::world &ecs, flecs::entity entity, Blackboard &bb, const AIContext &ctx) const;
 
-  ~BehaviourTree() = default;
+  BehResult update(size_t idx, BehaviourTree &bt, flecs::world &ecs, flecs::entity entity, Blackboard &bb,
+                   const AIContext &ctx) const;
+  void react(size_t idx, const BehaviourTree &bt, flecs::world &ecs, flecs::entity entity, Blackboard &bb,
+             const Event &coming_evt) const;
 
-  void update(flecs::world &ecs, flecs::entity entity, Blackboard &bb)
+private:
+  friend BehaviourTreeDesc compile_beh_tree(const BehNodeSpec &root, const char *name);
+
+  void append(const BehNodeSpec &spec);
+  BehResult tickNode(size_t idx, BehaviourTree &bt, flecs::world &ecs, flecs::entity entity, Blackboard &bb,
+                     const AIContext &ctx) const;
+  size_t childAt(size_t idx, uint8_t num) const;
+  void switchChild(size_t idx, BehaviourTree &bt, uint8_t to) const;
+
+  const char *name = "";
+  std::vector<BehNode> nodes;
+  std::vector<std::pair<Events, react_func>> reactions;
+  size_t numStates = 0;
+  float senseRadius = 0.f;
+  bool resumable = true; // at most one leaf runs at a time, i.e. there are no parallel nodes
+  AI_PROFILE_ONLY(mutable TreeProfile profile;)
+};
+
+// name is the archetype in profiles
+BehaviourTreeDesc compile_beh_tree(const BehNodeSpec &root, const char *name = "");
+
+// Per-entity part of a behaviour tree: the desc, the running child of every composite
+// and the running leaf, which is ticked on its own while none of the watched blackboard
+// variables change. A change re-evaluates the tree from the root, aborting the running branch.
+// So does a pass which got past a leaf that reads the world: a blackboard mask can't tell
+// whether a higher priority branch would be picked now.
+class BehaviourTree
+{
+public:
+  BehaviourTree() = default;
+  explicit BehaviourTree(const BehaviourTreeDesc *in_desc) : desc(in_desc) {}
+
+  void update(flecs::world &ecs, flecs::entity entity, Blackboard &bb, const AIContext &ctx)
   {
-    root->update(ecs, entity, bb);
+    if (desc && desc->numNodes() > 0)
+      desc->tick(*this, ecs, entity, bb, ctx);
   }
-};
 
+  const BehaviourTreeDesc *getDesc() const { return desc; }
+  // the last tick only resumed the running leaf
+  bool wasResumed() const { return resumed; }
+
+  void react(flecs::world &ecs, flecs::entity entity, Blackboard &bb, const Event &coming_evt) const
+  {
+    if (desc && desc->numNodes() > 0)
+      desc->react(0, *this, ecs, entity, bb, coming_evt);
+  }
+
+private:
+  friend class BehaviourTreeDesc;
+
+  const BehaviourTreeDesc *desc = nullptr;
+  uint64_t watchMask = 0; // blackboard slots read by the tree's nodes
+  uint16_t runningLeaf = 0; // node index + 1, 0 if none
+  bool resumed = false;
+  bool passedWorldLeaf = false; // the last pass from the root finished a leaf which reads the world
+  uint8_t state[max_beh_tree_state] = {};
+};
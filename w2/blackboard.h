@@ -1,63 +1,261 @@
 #pragma once
 
+#include <atomic>
+#include <cassert>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
 #include <string>
+#include <string_view>
+#include <type_traits>
 #include <unordered_map>
 #include <vector>
 #include <flecs.h>
 #include "ecsTypes.h"
 
+// Blackboard names are interned into a schema shared by all blackboards: every name
+// gets an index per data type once, and the layout of an archetype maps it to a slot in
+// the value buffer of its blackboards. Names known at compile time are hashed at compile
+// time and resolved once per call site with bb_key, after that reads and writes are
+// a lookup in the layout and a load from the buffer.
+
+constexpr uint64_t bb_name_hash(std::string_view name)
+{
+  // FNV-1a
+  uint64_t hash = 14695981039346656037ull;
+  for (char c : name)
+  {
+    hash ^= uint64_t(static_cast<unsigned char>(c));
+    hash *= 1099511628211ull;
+  }
+  return hash;
+}
+
+template<typename DataType>
+struct BlackboardKey
+{
+  size_t idx = size_t(-1);
+};
+
 template<typename DataType>
-class NamedDataPool
+class BlackboardSchema
 {
 public:
-  size_t regName(const std::string &name)
+  static size_t intern(uint64_t hash, std::string_view name)
   {
-    const auto itf = nameIndices.find(name);
-    if (itf != nameIndices.end())
+    BlackboardSchema &schema = instance();
+    // only happens on registration, but nodes may register from think threads
+    std::lock_guard<std::mutex> lock(schema.mutex);
+    const auto itf = schema.indices.find(hash);
+    if (itf != schema.indices.end())
+    {
+      assert(schema.names[itf->second] == name && "blackboard name hash collision");
       return itf->second;
-
-    size_t idx = data.size();
-    nameIndices.emplace(name, idx);
-    data.emplace_back(DataType());
+    }
+    const size_t idx = schema.names.size();
+    schema.indices.emplace(hash, idx);
+    schema.names.emplace_back(name);
     return idx;
   }
 
-  void set(size_t idx, const DataType &in_data)
+  static size_t intern(std::string_view name) { return intern(bb_name_hash(name), name); }
+
+private:
+  static BlackboardSchema &instance()
   {
-    data[idx] = in_data;
+    static BlackboardSchema schema;
+    return schema;
   }
 
-  DataType get(size_t idx) const
+  std::mutex mutex;
+  std::unordered_map<uint64_t, size_t> indices;
+  std::vector<std::string> names;
+};
+
+template<size_t N>
+struct BlackboardName
+{
+  char str[N] = {};
+
+  consteval BlackboardName(const char (&name)[N])
   {
-    return data[idx];
+    for (size_t i = 0; i < N; ++i)
+      str[i] = name[i];
   }
+
+  constexpr std::string_view view() const { return std::string_view(str, N - 1); }
+};
+
+// key of a name known at compile time, e.g. bb.get(bb_key<float, "hp">())
+template<typename DataType, BlackboardName name>
+inline BlackboardKey<DataType> bb_key()
+{
+  constexpr uint64_t hash = bb_name_hash(name.view());
+  static const BlackboardKey<DataType> key{BlackboardSchema<DataType>::intern(hash, name.view())};
+  return key;
+}
+
+template<typename DataType> struct BlackboardType;
+template<> struct BlackboardType<float> { static constexpr size_t index = 0; };
+template<> struct BlackboardType<int> { static constexpr size_t index = 1; };
+template<> struct BlackboardType<flecs::entity> { static constexpr size_t index = 2; };
+template<> struct BlackboardType<Position> { static constexpr size_t index = 3; };
+constexpr size_t num_blackboard_types = 4;
+
+// Where every variable lives in the value buffer of a blackboard. Built once per archetype,
+// as behaviour nodes register their variables, and shared by all its entities.
+// Slots are only appended, so buffers of existing entities stay valid while it grows.
+// A variable set for the first time gets its slot right away, possibly on a think thread while
+// others read the layout, so offsets are atomics written under the mutex.
+// Running out of keys or bytes aborts: dropping values silently would change AI decisions.
+class BlackboardLayout
+{
+public:
+  static constexpr size_t max_size = 128; // bytes of values per entity
+  static constexpr size_t max_keys = 64; // schema indices per data type
+  static constexpr size_t max_slots = 64; // bits in the change mask of a blackboard
+
+  BlackboardLayout()
+  {
+    for (auto &typeOffsets : offsets)
+      for (std::atomic<int16_t> &offset : typeOffsets)
+        offset.store(-1, std::memory_order_relaxed);
+    for (auto &typeSlots : slots)
+      for (std::atomic<int8_t> &slot : typeSlots)
+        slot.store(-1, std::memory_order_relaxed);
+  }
+  BlackboardLayout(const BlackboardLayout &) = delete;
+  BlackboardLayout &operator=(const BlackboardLayout &) = delete;
+
+  // for entities which don't have a layout of their own
+  static BlackboardLayout &common()
+  {
+    static BlackboardLayout layout;
+    return layout;
+  }
+
+  template<typename DataType>
+  int offset(size_t idx) const
+  {
+    return idx < max_keys ? offsets[BlackboardType<DataType>::index][idx].load(std::memory_order_acquire) : -1;
+  }
+
+  // ordinal of the variable, -1 if it has no slot
+  template<typename DataType>
+  int slot(size_t idx) const
+  {
+    return idx < max_keys ? slots[BlackboardType<DataType>::index][idx].load(std::memory_order_acquire) : -1;
+  }
+
+  template<typename DataType>
+  int addSlot(size_t idx)
+  {
+    static_assert(std::is_trivially_copyable_v<DataType>, "blackboard values are stored as raw bytes");
+    std::lock_guard<std::mutex> lock(mutex);
+    if (offset<DataType>(idx) >= 0)
+      return offset<DataType>(idx);
+    const size_t at = (size + alignof(DataType) - 1) / alignof(DataType) * alignof(DataType);
+    if (idx >= max_keys)
+    {
+      fprintf(stderr, "blackboard: key %zu of type %zu is over max_keys (%zu)\n",
+              idx, BlackboardType<DataType>::index, max_keys);
+      std::abort();
+    }
+    if (at + sizeof(DataType) > max_size)
+    {
+      fprintf(stderr, "blackboard: layout is full, %zu bytes used of max_size (%zu)\n", size, max_size);
+      std::abort();
+    }
+    slots[BlackboardType<DataType>::index][idx].store(int8_t(numSlots++), std::memory_order_relaxed);
+    offsets[BlackboardType<DataType>::index][idx].store(int16_t(at), std::memory_order_release);
+    size = at + sizeof(DataType);
+    return int(at);
+  }
+
+  size_t getSize() const { return size; }
+
 private:
-  std::unordered_map<std::string, size_t> nameIndices;
-  std::vector<DataType> data;
+  std::mutex mutex;
+  std::atomic<int16_t> offsets[num_blackboard_types][max_keys];
+  std::atomic<int8_t> slots[num_blackboard_types][max_keys];
+  size_t size = 0;
+  size_t numSlots = 0; // every slot takes at least 4 bytes, so they fit in max_slots
 };
 
-class Blackboard : public NamedDataPool<float>,
-                   public NamedDataPool<int>,
-                   public NamedDataPool<flecs::entity>,
-                   public NamedDataPool<Position>
+// Per-entity values in a flat buffer laid out by the archetype layout,
+// trivially copyable so it lives right in the component column.
+class Blackboard
 {
 public:
+  Blackboard() : layout(&BlackboardLayout::common()) {}
+  explicit Blackboard(BlackboardLayout *in_layout) : layout(in_layout) {}
+
   template<typename DataType>
   size_t regName(const std::string &name)
   {
-    return NamedDataPool<DataType>::regName(name);
+    const size_t idx = BlackboardSchema<DataType>::intern(name);
+    layout->addSlot<DataType>(idx);
+    return idx;
   }
 
   template<typename DataType>
   void set(size_t idx, const DataType &in_data)
   {
-    NamedDataPool<DataType>::set(idx, in_data);
+    int offset = layout->offset<DataType>(idx);
+    if (offset < 0)
+      offset = layout->addSlot<DataType>(idx);
+    if (memcmp(values + offset, &in_data, sizeof(DataType)) != 0)
+    {
+      memcpy(values + offset, &in_data, sizeof(DataType));
+      changed |= uint64_t(1) << layout->slot<DataType>(idx);
+    }
   }
 
   template<typename DataType>
   DataType get(size_t idx) const
   {
-    return NamedDataPool<DataType>::get(idx);
+    const int offset = layout->offset<DataType>(idx);
+    if (offset < 0)
+      return DataType();
+    DataType res;
+    memcpy(&res, values + offset, sizeof(DataType));
+    return res;
   }
-};
 
+  template<typename DataType>
+  void set(BlackboardKey<DataType> key, const DataType &in_data)
+  {
+    set<DataType>(key.idx, in_data);
+  }
+
+  template<typename DataType>
+  DataType get(BlackboardKey<DataType> key) const
+  {
+    return get<DataType>(key.idx);
+  }
+
+  // Change tracking: every slot written with a different value since the last
+  // clearChanged() has its bit set, readers watch the bits of the keys they depend on.
+  template<typename DataType>
+  uint64_t watchBit(size_t idx) const
+  {
+    // a watched variable gets its slot now, otherwise its first write would go unnoticed
+    if (layout->slot<DataType>(idx) < 0)
+      layout->addSlot<DataType>(idx);
+    return uint64_t(1) << layout->slot<DataType>(idx);
+  }
+
+  template<typename DataType>
+  uint64_t watchBit(BlackboardKey<DataType> key) const { return watchBit<DataType>(key.idx); }
+
+  uint64_t getChanged() const { return changed; }
+  void clearChanged() { changed = 0; }
+
+private:
+  BlackboardLayout *layout = nullptr;
+  uint64_t changed = 0;
+  // zero bytes are default values of all blackboard types
+  alignas(std::max_align_t) unsigned char values[BlackboardLayout::max_size] = {};
+};
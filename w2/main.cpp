@@ -6,6 +6,7 @@
 #include "ecsTypes.h"
 #include "Event.h"
 #include "roguelike.h"
+#include "aiProfile.h"
 
 static void update_camera(Camera2D &cam, flecs::world &ecs)
 {
@@ -59,6 +60,7 @@ int main(int /*argc*/, const char ** /*argv*/)
     EndDrawing();
   }
 
+  AI_PROFILE_ONLY(dump_ai_profile(ai_profile_path, ai_profile_folded_path);)
   CloseWindow();
 
   return 0;
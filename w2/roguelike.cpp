@@ -5,11 +5,17 @@
 #include "stateMachine.h"
 #include "aiLibrary.h"
 #include "blackboard.h"
+#include "aiProfile.h"
+#include "tileOccupancy.h"
+#include <algorithm>
+#include <cmath>
 
 static void create_minotaur_beh(flecs::entity e)
 {
-  e.set(Blackboard{});
-  BehNode *root =
+  static BlackboardLayout layout;
+  e.set(Blackboard{&layout});
+  // compiled once, the first entity registers its variables in the shared layout
+  static const BehaviourTreeDesc desc = compile_beh_tree(
     selector({
       sequence({
         is_low_hp(50.f),
@@ -21,14 +27,15 @@ static void create_minotaur_beh(flecs::entity e)
         move_to_entity(e, "attack_enemy")
       }),
       patrol(e, 2.f, "patrol_pos")
-    });
-  e.set(BehaviourTree{root});
+    }), "minotaur");
+  set_beh_tree(e, desc);
 }
 
 static void create_collector_beh(flecs::entity e)
 {
-  e.add<CouldTake>().set(Blackboard{});
-  BehNode *root =
+  static BlackboardLayout layout;
+  e.add<CouldTake>().set(Blackboard{&layout});
+  static const BehaviourTreeDesc desc = compile_beh_tree(
     selector({
       sequence({
         find_enemy(e, 2.f, "attack_enemy"),
@@ -47,14 +54,15 @@ static void create_collector_beh(flecs::entity e)
         find_closest<IsPlayer>(e, "enemy"),
         move_to_entity(e, "enemy")
       })
-    });
-  e.set(BehaviourTree{root});
+    }), "collector");
+  set_beh_tree(e, desc);
 }
 
 static void create_guard_beh(flecs::entity e, flecs::entity& start_point)
 {
-  e.add<WayPoint>(start_point).set(Blackboard{});
-  BehNode *root =
+  static BlackboardLayout layout;
+  e.add<WayPoint>(start_point).set(Blackboard{&layout});
+  static const BehaviourTreeDesc desc = compile_beh_tree(
     selector({
       sequence({
         find_enemy(e, 2.f, "attack_enemy"),
@@ -64,33 +72,32 @@ static void create_guard_beh(flecs::entity e, flecs::entity& start_point)
         route_go(),
         get_next_point()
       })
-    });
-  e.set(BehaviourTree{root});
+    }), "guard");
+  set_beh_tree(e, desc);
 }
 
 static void create_mosqito_beh(flecs::entity e, int swarm_idx = 0)
 {
-  e.set(Swarm{swarm_idx}).set(Blackboard{});
-  BehNode *root =
+  static BlackboardLayout layout;
+  e.set(Swarm{swarm_idx}).set(Blackboard{&layout});
+  static const BehaviourTreeDesc desc = compile_beh_tree(
     selector({
       sequence({move_to_entity(e, "swarm_enemy")}),
       sequence({
         find_enemy(e, 5.f, "attack_enemy"),
-        ask_help(e, "attack_enemy", "swarm_enemy"),
+        ask_help(e, "attack_enemy"),
         move_to_entity(e, "attack_enemy")
       }),
       with_reaction(patrol(e, 2.f, "patrol_pos"), 
         {std::pair(
           HelpEvent, 
-          [](flecs::world &ecs, flecs::entity entity, Blackboard &bb, Blackboard &event_bb) {
-            size_t targetBb = bb.regName<flecs::entity>("swarm_enemy");
-            size_t target_idx = event_bb.regName<flecs::entity>("swarm_enemy");
-            bb.set<flecs::entity>(targetBb, event_bb.get<flecs::entity>(target_idx));
+          [](flecs::world &, flecs::entity, Blackboard &bb, const Event &evt) {
+            bb.set(bb_key<flecs::entity, "swarm_enemy">(), evt.target);
           }
         )}
       )
-    });
-  e.set(BehaviourTree{root});
+    }), "mosquito");
+  set_beh_tree(e, desc);
 }
 
 static flecs::entity create_monster(flecs::world &ecs, int x, int y, Color col, const char *texture_src)
@@ -205,20 +212,52 @@ static void register_roguelike_systems(flecs::world &ecs)
 }
 
 
-void init_roguelike(flecs::world &ecs)
+// where the default set of monsters stands
+static const Position default_monster_spawns[num_default_monsters] = {
+  {5, 5}, {10, -5}, {-5, -5}, {-5, 5}, // minotaurs
+  {0, 5}, // collector
+  {-10, 5}, // guard
+  {3, 3}, {7, 7}, {-3, -3}, {-7, -7} // swarm
+};
+
+// kinds repeat after the default set, monsters past it are scattered at random within spawn_radius
+static void create_monster_of_kind(flecs::world &ecs, int idx, int spawn_radius, flecs::entity route)
+{
+  const int kind = idx % num_default_monsters;
+  const Position pos = idx < num_default_monsters ? default_monster_spawns[kind] :
+                       Position{GetRandomValue(-spawn_radius, spawn_radius), GetRandomValue(-spawn_radius, spawn_radius)};
+  const Color white{0xff, 0xff, 0xff, 0xff};
+  if (kind < 4)
+    create_minotaur_beh(create_monster(ecs, pos.x, pos.y, white, "minotaur_tex"));
+  else if (kind == 4)
+    create_collector_beh(create_monster(ecs, pos.x, pos.y, white, "monk_tex"));
+  else if (kind == 5)
+    create_guard_beh(create_monster(ecs, pos.x, pos.y, white, "guard_tex"), route);
+  else
+    create_mosqito_beh(create_monster(ecs, pos.x, pos.y, white, "mosqito_tex"));
+}
+
+void init_roguelike(flecs::world &ecs, int num_monsters)
 {
   register_roguelike_systems(ecs);
+  register_spatial_hash(ecs);
+  ecs.entity("tile_occupancy")
+    .set(TileOccupancy{});
 
-  ecs.entity("swordsman_tex")
-    .set(Texture2D{LoadTexture("w2/assets/swordsman.png")});
-  ecs.entity("minotaur_tex")
-    .set(Texture2D{LoadTexture("w2/assets/minotaur.png")});
-  ecs.entity("monk_tex")
-    .set(Texture2D{LoadTexture("w2/assets/monk.png")});
-  ecs.entity("guard_tex")
-    .set(Texture2D{LoadTexture("w2/assets/guard.png")});
-  ecs.entity("mosqito_tex")
-    .set(Texture2D{LoadTexture("w2/assets/mosqito.png")});
+  // no window means a headless simulation, nothing will be rendered
+  if (IsWindowReady())
+  {
+    ecs.entity("swordsman_tex")
+      .set(Texture2D{LoadTexture("w2/assets/swordsman.png")});
+    ecs.entity("minotaur_tex")
+      .set(Texture2D{LoadTexture("w2/assets/minotaur.png")});
+    ecs.entity("monk_tex")
+      .set(Texture2D{LoadTexture("w2/assets/monk.png")});
+    ecs.entity("guard_tex")
+      .set(Texture2D{LoadTexture("w2/assets/guard.png")});
+    ecs.entity("mosqito_tex")
+      .set(Texture2D{LoadTexture("w2/assets/mosqito.png")});
+  }
 
   ecs.observer<Texture2D>()
     .event(flecs::OnRemove)
@@ -227,21 +266,11 @@ void init_roguelike(flecs::world &ecs)
         UnloadTexture(texture);
       });
 
-  create_minotaur_beh(create_monster(ecs, 5, 5, Color{0xff, 0xff, 0xff, 0xff}, "minotaur_tex"));
-  create_minotaur_beh(create_monster(ecs, 10, -5, Color{0xff, 0xff, 0xff, 0xff}, "minotaur_tex"));
-  create_minotaur_beh(create_monster(ecs, -5, -5, Color{0xff, 0xff, 0xff, 0xff}, "minotaur_tex"));
-  create_minotaur_beh(create_monster(ecs, -5, 5, Color{255, 255, 255, 255}, "minotaur_tex"));
-  
-  create_collector_beh(create_monster(ecs, 0, 5, Color{255, 255, 255, 255}, "monk_tex"));
-
   auto start_point = create_route(ecs, {{3, 3}, {-2, 12}, {4, -3}});
-  create_guard_beh(create_monster(ecs, -10, 5, Color{255, 255, 255, 255}, "guard_tex"), start_point);
-
-  //swarm
-  create_mosqito_beh(create_monster(ecs, 3, 3, Color{0xff, 0xff, 0xff, 0xff}, "mosqito_tex"));
-  create_mosqito_beh(create_monster(ecs, 7, 7, Color{0xff, 0xff, 0xff, 0xff}, "mosqito_tex"));
-  create_mosqito_beh(create_monster(ecs, -3, -3, Color{0xff, 0xff, 0xff, 0xff}, "mosqito_tex"));
-  create_mosqito_beh(create_monster(ecs, -7, -7, Color{0xff, 0xff, 0xff, 0xff}, "mosqito_tex"));
+  // the default set fits in 10 tiles around the player, larger crowds keep about the same density
+  const int spawnRadius = std::max(10, int(sqrtf(float(num_monsters)) * 3.f));
+  for (int i = 0; i < num_monsters; ++i)
+    create_monster_of_kind(ecs, i, spawnRadius, start_point);
 
   create_player(ecs, 0, 0, "swordsman_tex");
 
@@ -293,32 +322,50 @@ static void process_actions(flecs::world &ecs)
 {
   static auto processActions = ecs.query<Action, Position, MovePos, const MeleeDamage, const Team>();
   static auto checkAttacks = ecs.query<const MovePos, Hitpoints, const Team>();
+  static auto tileOccupancy = ecs.query<TileOccupancy>();
   // Process all actions
   ecs.defer([&]
   {
-    processActions.each([&](flecs::entity entity, Action &a, Position &pos, MovePos &mpos, const MeleeDamage &dmg, const Team &team)
+    // moves are resolved in query order: the first one to step on a tile claims it,
+    // everyone coming later is blocked by whoever is there (and hits them if they are enemies)
+    tileOccupancy.each([&](TileOccupancy &occ)
     {
-      Position nextPos = move_pos(pos, a.action);
-      bool blocked = false;
-      checkAttacks.each([&](flecs::entity enemy, const MovePos &epos, Hitpoints &hp, const Team &enemy_team)
+      occ.clear();
+      checkAttacks.each([&](flecs::entity e, const MovePos &epos, Hitpoints &hp, const Team &t)
       {
-        if (entity != enemy && epos == nextPos)
+        occ.addOccupant(epos.x, epos.y, e, hp, t.team);
+      });
+      processActions.each([&](flecs::entity entity, Action &a, Position &pos, MovePos &mpos, const MeleeDamage &dmg, const Team &team)
+      {
+        Position nextPos = move_pos(pos, a.action);
+        bool blocked = false;
+        for (const TileOccupancy::Occupant &occupant : occ.occupantsAt(nextPos.x, nextPos.y))
         {
+          if (occupant.entity == entity)
+            continue;
           blocked = true;
-          if (team.team != enemy_team.team)
-            hp.hitpoints -= dmg.damage;
+          if (team.team != occupant.team)
+            occupant.hp->hitpoints -= dmg.damage;
+        }
+        if (blocked)
+          a.action = EA_NOP;
+        else
+        {
+          occ.moveOccupant(entity, mpos.x, mpos.y, nextPos.x, nextPos.y);
+          mpos = nextPos;
         }
       });
-      if (blocked)
-        a.action = EA_NOP;
-      else
-        mpos = nextPos;
     });
     // now move
-    processActions.each([&](Action &a, Position &pos, MovePos &mpos, const MeleeDamage &, const Team&)
+    query_spatial_hash(ecs, [&](SpatialHash &hash)
     {
-      pos = mpos;
-      a.action = EA_NOP;
+      processActions.each([&](flecs::entity entity, Action &a, Position &pos, MovePos &mpos, const MeleeDamage &, const Team &team)
+      {
+        if (!(pos == mpos))
+          hash.update(entity, Position{mpos.x, mpos.y}, team.team);
+        pos = mpos;
+        a.action = EA_NOP;
+      });
     });
   });
 
@@ -337,53 +384,86 @@ static void process_actions(flecs::world &ecs)
   static auto powerupPickup = ecs.query<const Position, const PowerupAmount>();
   ecs.defer([&]
   {
-    playerPickup.each([&](const CouldTake&, const Position &pos, Hitpoints &hp, MeleeDamage &dmg)
+    tileOccupancy.each([&](TileOccupancy &occ)
     {
-      healPickup.each([&](flecs::entity entity, const Position &ppos, const HealAmount &amt)
-      {
-        if (pos == ppos)
-        {
-          hp.hitpoints += amt.amount;
-          entity.destruct();
-        }
-      });
-      powerupPickup.each([&](flecs::entity entity, const Position &ppos, const PowerupAmount &amt)
+      occ.clear();
+      healPickup.each([&](flecs::entity e, const Position &ppos, const HealAmount &) { occ.addItem(ppos.x, ppos.y, e); });
+      powerupPickup.each([&](flecs::entity e, const Position &ppos, const PowerupAmount &) { occ.addItem(ppos.x, ppos.y, e); });
+      playerPickup.each([&](const CouldTake&, const Position &pos, Hitpoints &hp, MeleeDamage &dmg)
       {
-        if (pos == ppos)
+        std::vector<flecs::entity> *items = occ.itemsAt(pos.x, pos.y);
+        if (!items)
+          return;
+        for (flecs::entity item : *items)
         {
-          dmg.damage += amt.amount;
-          entity.destruct();
+          if (const HealAmount *amt = item.get<HealAmount>())
+            hp.hitpoints += amt->amount;
+          if (const PowerupAmount *amt = item.get<PowerupAmount>())
+            dmg.damage += amt->amount;
+          item.destruct();
         }
+        items->clear();
       });
     });
   });
 }
 
+static AIContext make_ai_context(flecs::world &ecs)
+{
+  AIContext ctx;
+  query_spatial_hash(ecs, [&](const SpatialHash &hash) { ctx.spatialHash = &hash; });
+  return ctx;
+}
+
 void process_turn(flecs::world &ecs)
 {
   static auto stateMachineAct = ecs.query<StateMachine>();
   static auto behTreeUpdate = ecs.query<BehaviourTree, Blackboard>();
+  AI_PROFILE_ONLY(if (IsKeyPressed(KEY_F9)) dump_ai_profile(ai_profile_path, ai_profile_folded_path);)
   if (is_player_acted(ecs))
   {
     if (upd_player_actions_count(ecs))
     {
       // Plan action for NPCs
+      static EventMailboxes mailboxes;
+      AIContext ctx = make_ai_context(ecs);
+      ctx.mailboxes = &mailboxes;
+      update_beh_sensors(ecs, ctx);
       ecs.defer([&]
       {
         stateMachineAct.each([&](flecs::entity e, StateMachine &sm)
         {
-          sm.act(0.f, ecs, e);
+          sm.act(0.f, ecs, e, ctx);
         });
         behTreeUpdate.each([&](flecs::entity e, BehaviourTree &bt, Blackboard &bb)
         {
-          bt.update(ecs, e, bb);
+          bt.update(ecs, e, bb, ctx);
         });
+        deliver_events(ecs, mailboxes);
       });
     }
     process_actions(ecs);
   }
 }
 
+#if AI_PROFILE
+static void draw_ai_profile_top()
+{
+  constexpr size_t num_top = 8;
+  ProfileTopNode top[num_top];
+  const size_t count = ai_profile_top_nodes(top, num_top);
+  const int xPos = GetRenderWidth() - 520;
+  DrawText("node                           ticks  excl ms  incl ms", xPos, 20, 20, WHITE);
+  for (size_t i = 0; i < count; ++i)
+  {
+    const TreeProfile::NodeCounters &node = top[i].tree->nodes[top[i].node];
+    DrawText(TextFormat("%s/%s#%d", top[i].tree->archetype, node.type, int(top[i].node)), xPos, 40 + int(i) * 20, 20, WHITE);
+    DrawText(TextFormat("%7llu %8.2f %8.2f", static_cast<unsigned long long>(node.ticks), double(node.exclusiveNs) * 1e-6,
+                        double(node.inclusiveNs) * 1e-6), xPos + 300, 40 + int(i) * 20, 20, WHITE);
+  }
+}
+#endif
+
 void print_stats(flecs::world &ecs)
 {
   static auto playerStatsQuery = ecs.query<const IsPlayer, const Hitpoints, const MeleeDamage>();
@@ -392,5 +472,6 @@ void print_stats(flecs::world &ecs)
     DrawText(TextFormat("hp: %d", int(hp.hitpoints)), 20, 20, 20, WHITE);
     DrawText(TextFormat("power: %d", int(dmg.damage)), 20, 40, 20, WHITE);
   });
+  AI_PROFILE_ONLY(draw_ai_profile_top();)
 }
 
@@ -2,6 +2,8 @@
 
 #include <flecs.h>
 
-void init_roguelike(flecs::world &ecs);
+constexpr int num_default_monsters = 10;
+
+void init_roguelike(flecs::world &ecs, int num_monsters = num_default_monsters);
 void process_turn(flecs::world &ecs);
 void print_stats(flecs::world &ecs);
@@ -0,0 +1,97 @@
+// Headless simulation: the same roguelike logic without a window, the player is driven by a bot.
+// Prints turns/sec, meant for measuring AI throughput.
+#include "raylib.h"
+#include <flecs.h>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include "ecsTypes.h"
+#include "roguelike.h"
+#include "aiProfile.h"
+
+struct SimSettings
+{
+  int numMonsters = num_default_monsters;
+  int numTurns = 1000;
+  unsigned seed = 1;
+  std::string bot = "random"; // or a script of l/r/u/d moves, repeated
+};
+
+static void print_usage(const char *exe)
+{
+  printf("usage: %s [--monsters N] [--turns N] [--seed S] [--bot random|<script of l,r,u,d>]\n", exe);
+}
+
+static bool parse_args(int argc, const char **argv, SimSettings &settings)
+{
+  for (int i = 1; i < argc; ++i)
+  {
+    const char *arg = argv[i];
+    if (i + 1 >= argc)
+      return false;
+    const char *val = argv[++i];
+    if (!strcmp(arg, "--monsters"))
+      settings.numMonsters = atoi(val);
+    else if (!strcmp(arg, "--turns"))
+      settings.numTurns = atoi(val);
+    else if (!strcmp(arg, "--seed"))
+      settings.seed = unsigned(strtoul(val, nullptr, 10));
+    else if (!strcmp(arg, "--bot"))
+      settings.bot = val;
+    else
+      return false;
+  }
+  return settings.numMonsters >= 0 && settings.numTurns >= 0;
+}
+
+static int bot_action(const SimSettings &settings, int turn)
+{
+  if (settings.bot == "random" || settings.bot.empty())
+    return GetRandomValue(EA_MOVE_START, EA_MOVE_END - 1);
+  const char move = settings.bot[size_t(turn) % settings.bot.size()];
+  return move == 'l' ? EA_MOVE_LEFT :
+         move == 'r' ? EA_MOVE_RIGHT :
+         move == 'u' ? EA_MOVE_UP : EA_MOVE_DOWN;
+}
+
+int main(int argc, const char **argv)
+{
+  SimSettings settings;
+  if (!parse_args(argc, argv, settings))
+  {
+    print_usage(argv[0]);
+    return 1;
+  }
+  SetTraceLogLevel(LOG_WARNING);
+  SetRandomSeed(settings.seed);
+
+  flecs::world ecs;
+  init_roguelike(ecs, settings.numMonsters);
+
+  static auto playerQuery = ecs.query<const IsPlayer, Action, Hitpoints>();
+  const auto start = std::chrono::steady_clock::now();
+  int turn = 0;
+  for (; turn < settings.numTurns; ++turn)
+  {
+    bool playerAlive = false;
+    playerQuery.each([&](const IsPlayer &, Action &a, Hitpoints &hp)
+    {
+      playerAlive = true;
+      a.action = bot_action(settings, turn);
+      // the bot can't die, so every run lasts the same number of turns
+      hp.hitpoints = 100.f;
+    });
+    if (!playerAlive)
+      break;
+    process_turn(ecs);
+  }
+  const double total = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+  printf("monsters: %d, seed: %u, bot: %s\n", settings.numMonsters, settings.seed, settings.bot.c_str());
+  printf("turns: %d in %.3f s, %.1f turns/sec\n", turn, total, total > 0.0 ? turn / total : 0.0);
+
+  AI_PROFILE_ONLY(dump_ai_profile(ai_profile_path, ai_profile_folded_path);)
+  return 0;
+}
@@ -0,0 +1,14 @@
+#pragma once
+
+struct TurnCounter;
+struct ActionLog;
+class SpatialHash;
+
+// World singletons AI reads every turn, gathered once per turn in process_turn
+// and passed down to states, transitions and behaviour nodes instead of querying them on every call.
+struct AIContext
+{
+  const TurnCounter *turnCounter = nullptr;
+  ActionLog *actionLog = nullptr; // only written outside of the think phase
+  const SpatialHash *spatialHash = nullptr;
+};
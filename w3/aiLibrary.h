@@ -3,6 +3,7 @@
 #include <functional>
 #include "stateMachine.h"
 #include "behaviourTree.h"
+#include "utilityScorer.h"
 
 // states
 State *create_attack_enemy_state();
@@ -18,11 +19,14 @@ StateTransition *create_hitpoints_less_than_transition(float thres);
 StateTransition *create_negate_transition(StateTransition *in);
 StateTransition *create_and_transition(StateTransition *lhs, StateTransition *rhs);
 
-using utility_function = std::function<float(Blackboard&)>;
-
 BehNode *sequence(const std::vector<BehNode*> &nodes);
 BehNode *selector(const std::vector<BehNode*> &nodes);
-BehNode *utility_selector(const std::vector<std::pair<BehNode*, utility_function>> &nodes);
+// scorer is shared by all entities of an archetype, options are data for its batch evaluation
+BehNode *utility_selector(flecs::entity entity, UtilityScorer &scorer,
+                          const std::vector<std::pair<BehNode*, UtilityOption>> &nodes);
+// highest scoring option which doesn't fail, scored on demand in the order of upper bounds
+BehNode *best_utility_selector(flecs::entity entity, UtilityScorer &scorer,
+                               const std::vector<std::pair<BehNode*, UtilityOption>> &nodes);
 
 BehNode *move_to_entity(flecs::entity entity, const char *bb_name);
 BehNode *move_to_position(flecs::entity entity, const char *bb_name);
@@ -3,6 +3,8 @@
 #include "blackboard.h"
 #include <float.h>
 #include "math.h"
+#include "spatialHash.h"
+#include "aiContext.h"
 
 template<typename T, typename U>
 inline int move_towards(const T &from, const U &to)
@@ -23,29 +25,18 @@ inline int inverse_move(int move)
 }
 
 template<typename Callable>
-inline void on_closest_enemy_pos(flecs::world &ecs, flecs::entity entity, Callable c)
+inline void on_closest_enemy_pos(const AIContext &ctx, flecs::entity entity, Callable c)
 {
-  static auto enemiesQuery = ecs.query<const Position, const Team>();
-  entity.set([&](const Position &pos, const Team &t, Action &a)
+  if (ctx.spatialHash)
   {
-    flecs::entity closestEnemy;
-    float closestDist = FLT_MAX;
-    Position closestPos;
-    enemiesQuery.each([&](flecs::entity enemy, const Position &epos, const Team &et)
+    const SpatialHash &hash = *ctx.spatialHash;
+    entity.set([&](const Position &pos, const Team &t, Action &a)
     {
-      if (t.team == et.team)
-        return;
-      float curDist = dist(epos, pos);
-      if (curDist < closestDist)
-      {
-        closestDist = curDist;
-        closestPos = epos;
-        closestEnemy = enemy;
-      }
+      SpatialHash::Neighbour enemy;
+      if (hash.nearest(pos, [&](int team) { return team != t.team; }, enemy))
+        c(a, pos, enemy.pos);
     });
-    if (ecs.is_valid(closestEnemy))
-      c(a, pos, closestPos);
-  });
+  }
 }
 
 template<typename T>
@@ -59,15 +50,14 @@ inline size_t reg_entity_blackboard_var(flecs::entity entity, const char *bb_nam
   return res;
 }
 
-static void push_to_log(flecs::world &ecs, const char *msg)
+static void push_to_log(const AIContext &ctx, const char *msg)
 {
-  static auto queryLog = ecs.query<ActionLog, const TurnCounter>();
+  if (!ctx.actionLog || !ctx.turnCounter)
+    return;
   printf("pushing to log %s\n", msg);
-  queryLog.each([&](ActionLog &l, const TurnCounter &c)
-  {
-    l.log.push_back(std::to_string(c.count) + ": " + msg);
-    printf("pushed to log %s\n", msg);
-    if (l.log.size() > l.capacity)
-      l.log.erase(l.log.begin());
-  });
+  ActionLog &l = *ctx.actionLog;
+  l.log.push_back(std::to_string(ctx.turnCounter->count) + ": " + msg);
+  printf("pushed to log %s\n", msg);
+  if (l.log.size() > l.capacity)
+    l.log.erase(l.log.begin());
 }
\ No newline at end of file
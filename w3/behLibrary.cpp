@@ -7,7 +7,6 @@
 #include <algorithm>
 #include <ranges>
 #include <random>
-#include <iostream>
 
 static auto& get_engine() {
   static std::random_device rd{};
@@ -36,11 +35,11 @@ struct CompoundNode : public BehNode
 
 struct Sequence : public CompoundNode
 {
-  BehResult update(flecs::world &ecs, flecs::entity entity, Blackboard &bb) override
+  BehResult update(flecs::world &ecs, flecs::entity entity, Blackboard &bb, const AIContext &ctx) override
   {
     for (BehNode *node : nodes)
     {
-      BehResult res = node->update(ecs, entity, bb);
+      BehResult res = node->update(ecs, entity, bb, ctx);
       if (res != BEH_SUCCESS)
         return res;
     }
@@ -50,11 +49,11 @@ struct Sequence : public CompoundNode
 
 struct Selector : public CompoundNode
 {
-  BehResult update(flecs::world &ecs, flecs::entity entity, Blackboard &bb) override
+  BehResult update(flecs::world &ecs, flecs::entity entity, Blackboard &bb, const AIContext &ctx) override
   {
     for (BehNode *node : nodes)
     {
-      BehResult res = node->update(ecs, entity, bb);
+      BehResult res = node->update(ecs, entity, bb, ctx);
       if (res != BEH_FAIL)
         return res;
     }
@@ -62,77 +61,96 @@ struct Selector : public CompoundNode
   }
 };
 
+// Scores come from a scorer shared by all entities with the same selector,
+// evaluated in one batch per turn before trees are ticked
 struct UtilitySelector : public CompoundNode
 {
-  std::vector<utility_function> utilities;
+  UtilityScorer &scorer;
+  size_t row = 0;
   bool soft_max = false;
-  std::vector<float> inertia;
+  float inertia[max_utility_options] = {};
 
-  UtilitySelector(bool use_soft_max = false) : soft_max(use_soft_max) {}
+  UtilitySelector(UtilityScorer &in_scorer, flecs::entity entity, bool use_soft_max = false)
+    : scorer(in_scorer), row(in_scorer.addRow(entity)), soft_max(use_soft_max) {}
 
-  UtilitySelector &pushNode(BehNode *node, const utility_function& func)
+  ~UtilitySelector() override
   {
-    nodes.push_back(node);
-    utilities.push_back(func);
-    inertia.push_back(0.);
-    return *this;
+    scorer.removeRow(row);
   }
 
-  BehResult update(flecs::world &ecs, flecs::entity entity, Blackboard &bb) override
+  BehResult update(flecs::world &ecs, flecs::entity entity, Blackboard &bb, const AIContext &ctx) override
   {
+    const size_t numOptions = std::min(nodes.size(), scorer.numOptions());
+    float utilityScores[max_utility_options];
+
     if (soft_max) {
-      std::vector<float> utilityScores;
+      for (size_t i = 0; i < numOptions; ++i)
+        utilityScores[i] = scorer.score(row, i) + inertia[i];
       float sum = 0;
-      for (auto i : std::views::iota(size_t(0), utilities.size()))
-      {
-        std::cout << utilities[i](bb) << " ";
-        const float utilityScore = utilities[i](bb) + inertia[i];
-        sum += utilityScore;
-        utilityScores.push_back(utilityScore);
-      }
-      std::cout << " = " << sum << std::endl;
-      for (auto _ : std::views::iota(size_t(0), nodes.size())) {
+      for (size_t i = 0; i < numOptions; ++i)
+        sum += utilityScores[i];
+      for (size_t attempt = 0; attempt < numOptions; ++attempt) {
         // generate
         std::uniform_real_distribution<float> dist(0.0, sum);
         float proba = dist(get_engine());
-      
+
         size_t nodeIdx = 0;
-        for(; proba >= 0.0; nodeIdx++){
+        for (; nodeIdx + 1 < numOptions && proba >= utilityScores[nodeIdx]; ++nodeIdx)
           proba -= utilityScores[nodeIdx];
-        }
-        
-        nodeIdx -= 1;
-        std::cout << nodeIdx << std::endl;
 
-        BehResult res = nodes[nodeIdx]->update(ecs, entity, bb);
+        BehResult res = nodes[nodeIdx]->update(ecs, entity, bb, ctx);
         if (res != BEH_FAIL) {
           update_inertia(nodeIdx);
           return res;
         }
-        
+
         sum -= utilityScores[nodeIdx];
         utilityScores[nodeIdx] = 0;
       }
     }
     else {
-      std::vector<std::pair<float, size_t>> utilityScores;
-      for (size_t i = 0; i < utilities.size(); ++i)
+      // Options are scored lazily in the order of their upper bounds: once the best scored
+      // option beats the bound of the next one, the rest can't win and aren't scored at all.
+      // Options which failed stay failed for the rest of the tick.
+      float bounds[max_utility_options];
+      size_t order[max_utility_options];
+      for (size_t i = 0; i < numOptions; ++i)
       {
-        const float utilityScore = utilities[i](bb) + inertia[i];
-        utilityScores.push_back(std::make_pair(utilityScore, i));
+        bounds[i] = scorer.upperBound(i) + inertia[i];
+        order[i] = i;
       }
-      std::sort(utilityScores.begin(), utilityScores.end(), [](auto &lhs, auto &rhs)
+      std::sort(order, order + numOptions, [&](size_t lhs, size_t rhs)
       {
-        return lhs.first > rhs.first;
+        return bounds[lhs] > bounds[rhs];
       });
-      for (const std::pair<float, size_t> &node : utilityScores)
+      bool scored[max_utility_options] = {};
+      bool failed[max_utility_options] = {};
+      size_t numScored = 0;
+      for (size_t attempt = 0; attempt < numOptions; ++attempt)
       {
-        size_t nodeIdx = node.second;
-        BehResult res = nodes[nodeIdx]->update(ecs, entity, bb);
+        size_t nodeIdx = numOptions;
+        for (size_t i = 0; i < numOptions; ++i)
+          if (scored[i] && !failed[i] && (nodeIdx == numOptions || utilityScores[i] > utilityScores[nodeIdx]))
+            nodeIdx = i;
+        for (; numScored < numOptions; ++numScored)
+        {
+          const size_t next = order[numScored];
+          if (nodeIdx != numOptions && utilityScores[nodeIdx] >= bounds[next])
+            break;
+          utilityScores[next] = scorer.scoreOption(bb, next) + inertia[next];
+          scored[next] = true;
+          if (nodeIdx == numOptions || utilityScores[next] > utilityScores[nodeIdx])
+            nodeIdx = next;
+        }
+        if (nodeIdx == numOptions)
+          break;
+
+        BehResult res = nodes[nodeIdx]->update(ecs, entity, bb, ctx);
         if (res != BEH_FAIL) {
           update_inertia(nodeIdx);
           return res;
         }
+        failed[nodeIdx] = true;
       }
     }
 
@@ -144,7 +162,7 @@ private:
   float cooldown = 10.;
   void update_inertia(size_t nodeIdx) {
     float prev = inertia[nodeIdx];
-    std::ranges::fill(inertia, 0);
+    std::ranges::fill(inertia, 0.f);
     if (prev > 0)
       inertia[nodeIdx] = prev - cooldown;
     else
@@ -152,6 +170,7 @@ private:
   }
 };
 
+
 struct MoveToEntity : public BehNode
 {
   size_t entityBb = size_t(-1); // wraps to 0xff...
@@ -160,7 +179,7 @@ struct MoveToEntity : public BehNode
     entityBb = reg_entity_blackboard_var<flecs::entity>(entity, bb_name);
   }
 
-  BehResult update(flecs::world &, flecs::entity entity, Blackboard &bb) override
+  BehResult update(flecs::world &, flecs::entity entity, Blackboard &bb, const AIContext &/*ctx*/) override
   {
     BehResult res = BEH_RUNNING;
     entity.set([&](Action &a, const Position &pos)
@@ -194,7 +213,7 @@ struct MoveToPosition : public BehNode
     targetBb = reg_entity_blackboard_var<Position>(entity, bb_name);
   }
 
-  BehResult update(flecs::world &ecs, flecs::entity entity, Blackboard &bb) override
+  BehResult update(flecs::world &ecs, flecs::entity entity, Blackboard &bb, const AIContext &/*ctx*/) override
   {
     BehResult res = BEH_RUNNING;
     entity.set([&](Action &a, const Position &pos)
@@ -217,7 +236,7 @@ struct IsLowHp : public BehNode
   float threshold = 0.f;
   IsLowHp(float thres) : threshold(thres) {}
 
-  BehResult update(flecs::world &, flecs::entity entity, Blackboard &) override
+  BehResult update(flecs::world &, flecs::entity entity, Blackboard &, const AIContext &/*ctx*/) override
   {
     BehResult res = BEH_SUCCESS;
     entity.get([&](const Hitpoints &hp)
@@ -236,31 +255,22 @@ struct FindEnemy : public BehNode
   {
     entityBb = reg_entity_blackboard_var<flecs::entity>(entity, bb_name);
   }
-  BehResult update(flecs::world &ecs, flecs::entity entity, Blackboard &bb) override
+  BehResult update(flecs::world &ecs, flecs::entity entity, Blackboard &bb, const AIContext &ctx) override
   {
     BehResult res = BEH_FAIL;
-    static auto enemiesQuery = ecs.query<const Position, const Team>();
-    entity.set([&](const Position &pos, const Team &t)
+    if (ctx.spatialHash)
     {
-      flecs::entity closestEnemy;
-      float closestDist = FLT_MAX;
-      enemiesQuery.each([&](flecs::entity enemy, const Position &epos, const Team &et)
+      const SpatialHash &hash = *ctx.spatialHash;
+      entity.set([&](const Position &pos, const Team &t)
       {
-        if (t.team == et.team)
-          return;
-        float curDist = dist(epos, pos);
-        if (curDist < closestDist)
+        SpatialHash::Neighbour enemy;
+        if (hash.nearest(pos, [&](int team) { return team != t.team; }, enemy) && enemy.dist <= distance)
         {
-          closestDist = curDist;
-          closestEnemy = enemy;
+          bb.set<flecs::entity>(entityBb, enemy.entity);
+          res = BEH_SUCCESS;
         }
       });
-      if (ecs.is_valid(closestEnemy) && closestDist <= distance)
-      {
-        bb.set<flecs::entity>(entityBb, closestEnemy);
-        res = BEH_SUCCESS;
-      }
-    });
+    }
     return res;
   }
 };
@@ -276,32 +286,23 @@ struct ClosestEnemyTo : public BehNode
     enemyBb = reg_entity_blackboard_var<flecs::entity>(entity, enemy_bb_name);
   }
 
-  BehResult update(flecs::world &ecs, flecs::entity entity, Blackboard &bb) override
+  BehResult update(flecs::world &ecs, flecs::entity entity, Blackboard &bb, const AIContext &ctx) override
   {
     BehResult res = BEH_FAIL;
     Position pos = bb.get<Position>(positionBb);
-    static auto enemiesQuery = ecs.query<const Position, const Team>();
-    entity.set([&](const Team &t)
+    if (ctx.spatialHash)
     {
-      flecs::entity closestEnemy;
-      float closestDist = FLT_MAX;
-      enemiesQuery.each([&](flecs::entity enemy, const Position &epos, const Team &et)
+      const SpatialHash &hash = *ctx.spatialHash;
+      entity.set([&](const Team &t)
       {
-        if (t.team == et.team)
-          return;
-        float curDist = dist(epos, pos);
-        if (curDist < closestDist)
+        SpatialHash::Neighbour enemy;
+        if (hash.nearest(pos, [&](int team) { return team != t.team; }, enemy))
         {
-          closestDist = curDist;
-          closestEnemy = enemy;
+          bb.set<flecs::entity>(enemyBb, enemy.entity);
+          res = BEH_SUCCESS;
         }
       });
-      if (ecs.is_valid(closestEnemy))
-      {
-        bb.set<flecs::entity>(enemyBb, closestEnemy);
-        res = BEH_SUCCESS;
-      }
-    });
+    }
     return res;
   }
 };
@@ -314,7 +315,7 @@ struct Flee : public BehNode
     entityBb = reg_entity_blackboard_var<flecs::entity>(entity, bb_name);
   }
 
-  BehResult update(flecs::world &, flecs::entity entity, Blackboard &bb) override
+  BehResult update(flecs::world &, flecs::entity entity, Blackboard &bb, const AIContext &/*ctx*/) override
   {
     BehResult res = BEH_RUNNING;
     entity.set([&](Action &a, const Position &pos)
@@ -348,7 +349,7 @@ struct Patrol : public BehNode
     });
   }
 
-  BehResult update(flecs::world &, flecs::entity entity, Blackboard &bb) override
+  BehResult update(flecs::world &, flecs::entity entity, Blackboard &bb, const AIContext &/*ctx*/) override
   {
     BehResult res = BEH_RUNNING;
     entity.set([&](Action &a, const Position &pos)
@@ -365,7 +366,7 @@ struct Patrol : public BehNode
 
 struct MoveRandom : public BehNode
 {
-  BehResult update(flecs::world &ecs, flecs::entity entity, Blackboard &bb) override
+  BehResult update(flecs::world &ecs, flecs::entity entity, Blackboard &bb, const AIContext &/*ctx*/) override
   {
     BehResult res = BEH_RUNNING;
     entity.set([&](Action &a, const Position &pos)
@@ -381,7 +382,7 @@ struct PatchUp : public BehNode
   float hpThreshold = 100.f;
   PatchUp(float threshold) : hpThreshold(threshold) {}
 
-  BehResult update(flecs::world &, flecs::entity entity, Blackboard &) override
+  BehResult update(flecs::world &, flecs::entity entity, Blackboard &, const AIContext &/*ctx*/) override
   {
     BehResult res = BEH_SUCCESS;
     entity.set([&](Action &a, Hitpoints &hp)
@@ -413,15 +414,31 @@ BehNode *selector(const std::vector<BehNode*> &nodes)
   return sel;
 }
 
-BehNode *utility_selector(const std::vector<std::pair<BehNode*, utility_function>> &nodes)
+static BehNode *make_utility_selector(flecs::entity entity, UtilityScorer &scorer,
+                                      const std::vector<std::pair<BehNode*, UtilityOption>> &nodes, bool soft_max)
 {
-  UtilitySelector *usel = new UtilitySelector(true);
-  for (auto& [node, util] : nodes) {
-    usel->pushNode(node, util);
-  }
+  std::vector<UtilityOption> options;
+  for (const auto &[node, option] : nodes)
+    options.push_back(option);
+  scorer.setOptions(options, soft_max);
+  UtilitySelector *usel = new UtilitySelector(scorer, entity, soft_max);
+  for (const auto &[node, option] : nodes)
+    usel->pushNode(node);
   return usel;
 }
 
+BehNode *utility_selector(flecs::entity entity, UtilityScorer &scorer,
+                          const std::vector<std::pair<BehNode*, UtilityOption>> &nodes)
+{
+  return make_utility_selector(entity, scorer, nodes, true);
+}
+
+BehNode *best_utility_selector(flecs::entity entity, UtilityScorer &scorer,
+                               const std::vector<std::pair<BehNode*, UtilityOption>> &nodes)
+{
+  return make_utility_selector(entity, scorer, nodes, false);
+}
+
 BehNode *move_to_entity(flecs::entity entity, const char *bb_name)
 {
   return new MoveToEntity(entity, bb_name);
@@ -0,0 +1,167 @@
+#include "responseCurve.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <string>
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define RESPONSE_CURVE_SSE 1
+#endif
+
+ResponseCurve ResponseCurve::custom(float x_min, float x_max, const std::function<float(float)> &func)
+{
+  ResponseCurve curve;
+  curve.xMin = x_min;
+  const float step = (x_max - x_min) / float(num_segments);
+  curve.invStep = step > 0.f ? 1.f / step : 0.f;
+  for (size_t i = 0; i <= num_segments; ++i)
+    curve.samples[i] = func(x_min + step * float(i));
+  curve.minSample = *std::min_element(std::begin(curve.samples), std::end(curve.samples));
+  curve.maxSample = *std::max_element(std::begin(curve.samples), std::end(curve.samples));
+  return curve;
+}
+
+ResponseCurve ResponseCurve::linear(float x_min, float x_max, float slope, float offset)
+{
+  return custom(x_min, x_max, [=](float x) { return slope * x + offset; });
+}
+
+ResponseCurve ResponseCurve::exponential(float x_min, float x_max, float scale, float slope, float offset)
+{
+  return custom(x_min, x_max, [=](float x) { return scale * expf(slope * x + offset); });
+}
+
+ResponseCurve ResponseCurve::logistic(float x_min, float x_max, float scale, float steepness, float midpoint)
+{
+  return custom(x_min, x_max, [=](float x) { return scale / (1.f + expf(-steepness * (x - midpoint))); });
+}
+
+ResponseCurve ResponseCurve::piecewise(const std::vector<std::pair<float, float>> &points)
+{
+  if (points.empty())
+    return ResponseCurve();
+  return custom(points.front().first, points.back().first, [&](float x)
+  {
+    auto itf = std::upper_bound(points.begin(), points.end(), x,
+                                [](float val, const std::pair<float, float> &pt) { return val < pt.first; });
+    if (itf == points.begin())
+      return points.front().second;
+    if (itf == points.end())
+      return points.back().second;
+    const std::pair<float, float> &from = *(itf - 1);
+    const std::pair<float, float> &to = *itf;
+    return from.second + (to.second - from.second) * (x - from.first) / (to.first - from.first);
+  });
+}
+
+ResponseCurve ResponseCurve::table(float x_min, float x_max, const std::vector<float> &values)
+{
+  if (values.empty())
+    return ResponseCurve();
+  if (values.size() == 1)
+    return custom(x_min, x_max, [&](float) { return values[0]; });
+  const float valueStep = (x_max - x_min) / float(values.size() - 1);
+  std::vector<std::pair<float, float>> points;
+  for (size_t i = 0; i < values.size(); ++i)
+    points.emplace_back(x_min + valueStep * float(i), values[i]);
+  return piecewise(points);
+}
+
+void ResponseCurve::accumulate(const float *x, float *out, size_t n) const
+{
+  size_t i = 0;
+#if RESPONSE_CURVE_SSE
+  // SSE2 has no gather, the clamp, the segment index and the interpolation are done four lanes
+  // at a time and only the two sample loads per lane are scalar
+  const __m128 lo = _mm_set1_ps(xMin);
+  const __m128 scale = _mm_set1_ps(invStep);
+  const __m128 zero = _mm_setzero_ps();
+  const __m128 tMax = _mm_set1_ps(float(num_segments));
+  const __m128 segMax = _mm_set1_ps(float(num_segments - 1));
+  alignas(16) int32_t seg[4];
+  for (; i + 4 <= n; i += 4)
+  {
+    // maxps returns its second operand for NaN lanes, matching the scalar clamp
+    const __m128 t = _mm_min_ps(_mm_max_ps(_mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(x + i), lo), scale), zero), tMax);
+    const __m128i segIdx = _mm_cvttps_epi32(_mm_min_ps(t, segMax));
+    _mm_store_si128(reinterpret_cast<__m128i *>(seg), segIdx);
+    const __m128 from = _mm_setr_ps(samples[seg[0]], samples[seg[1]], samples[seg[2]], samples[seg[3]]);
+    const __m128 to = _mm_setr_ps(samples[seg[0] + 1], samples[seg[1] + 1], samples[seg[2] + 1], samples[seg[3] + 1]);
+    const __m128 frac = _mm_sub_ps(t, _mm_cvtepi32_ps(segIdx));
+    const __m128 value = _mm_add_ps(from, _mm_mul_ps(_mm_sub_ps(to, from), frac));
+    _mm_storeu_ps(out + i, _mm_add_ps(_mm_loadu_ps(out + i), value));
+  }
+#endif
+  for (; i < n; ++i)
+    out[i] += (*this)(x[i]);
+}
+
+static std::map<std::string, ResponseCurve> &curve_library()
+{
+  static std::map<std::string, ResponseCurve> curves; // nodes don't move, so pointers to curves stay valid
+  return curves;
+}
+
+const ResponseCurve *response_curve(const char *name, const ResponseCurve &default_curve)
+{
+  return &curve_library().try_emplace(name, default_curve).first->second;
+}
+
+static bool parse_curve(const std::string &type, std::istringstream &params, ResponseCurve &curve)
+{
+  std::vector<float> values;
+  float value = 0.f;
+  while (params >> value)
+    values.push_back(value);
+  if (!params.eof())
+    return false;
+
+  if (type == "linear" && values.size() == 4)
+    curve = ResponseCurve::linear(values[0], values[1], values[2], values[3]);
+  else if (type == "exponential" && values.size() == 5)
+    curve = ResponseCurve::exponential(values[0], values[1], values[2], values[3], values[4]);
+  else if (type == "logistic" && values.size() == 5)
+    curve = ResponseCurve::logistic(values[0], values[1], values[2], values[3], values[4]);
+  else if (type == "piecewise" && values.size() >= 2 && values.size() % 2 == 0)
+  {
+    std::vector<std::pair<float, float>> points;
+    for (size_t i = 0; i < values.size(); i += 2)
+      points.emplace_back(values[i], values[i + 1]);
+    std::sort(points.begin(), points.end());
+    curve = ResponseCurve::piecewise(points);
+  }
+  else if (type == "table" && values.size() >= 3)
+    curve = ResponseCurve::table(values[0], values[1], std::vector<float>(values.begin() + 2, values.end()));
+  else
+    return false;
+  return true;
+}
+
+bool load_response_curves(const char *path)
+{
+  std::ifstream file(path);
+  if (!file)
+    return false;
+
+  std::map<std::string, ResponseCurve> &curves = curve_library();
+  std::string line;
+  for (int lineNo = 1; std::getline(file, line); ++lineNo)
+  {
+    line = line.substr(0, line.find('#'));
+    std::istringstream params(line);
+    std::string name, type;
+    if (!(params >> name))
+      continue;
+    ResponseCurve curve;
+    if (!(params >> type) || !parse_curve(type, params, curve))
+    {
+      printf("%s:%d: can't parse curve '%s'\n", path, lineNo, name.c_str());
+      continue;
+    }
+    curves[name] = curve;
+  }
+  return true;
+}
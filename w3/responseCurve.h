@@ -0,0 +1,66 @@
+#pragma once
+
+#include <algorithm>
+#include <functional>
+#include <utility>
+#include <vector>
+
+// Response curves map an input (a distance, hitpoints) to a utility score.
+// Whatever their shape, they are sampled once into a small table over their domain
+// and evaluated as a lookup with linear interpolation, inputs outside are clamped.
+class ResponseCurve
+{
+public:
+  static constexpr size_t num_segments = 64;
+
+  ResponseCurve() = default;
+
+  // slope * x + offset
+  static ResponseCurve linear(float x_min, float x_max, float slope, float offset);
+  // scale * exp(slope * x + offset)
+  static ResponseCurve exponential(float x_min, float x_max, float scale, float slope, float offset);
+  // scale / (1 + exp(-steepness * (x - midpoint)))
+  static ResponseCurve logistic(float x_min, float x_max, float scale, float steepness, float midpoint);
+  // straight lines between (x, y) points sorted by x, the domain is from the first to the last one
+  static ResponseCurve piecewise(const std::vector<std::pair<float, float>> &points);
+  // values evenly spaced over the domain
+  static ResponseCurve table(float x_min, float x_max, const std::vector<float> &values);
+  static ResponseCurve custom(float x_min, float x_max, const std::function<float(float)> &func);
+
+  // clamped with min/max rather than branches, NaN inputs land on the first sample
+  float operator()(float x) const
+  {
+    const float t = std::min(std::max(0.f, (x - xMin) * invStep), float(num_segments));
+    const size_t i = size_t(std::min(t, float(num_segments - 1)));
+    return samples[i] + (samples[i + 1] - samples[i]) * (t - float(i));
+  }
+
+  // out[i] += (*this)(x[i]), four inputs at a time with SSE2 where it's available
+  void accumulate(const float *x, float *out, size_t n) const;
+
+  float minValue() const { return minSample; }
+  float maxValue() const { return maxSample; }
+
+private:
+  float xMin = 0.f;
+  float invStep = 0.f;
+  float minSample = 0.f;
+  float maxSample = 0.f;
+  float samples[num_segments + 1] = {};
+};
+
+constexpr const char *utility_curves_path = "w3/assets/utility_curves.txt"; // reloaded on F5
+
+// Named curves, defined in code and overridden by the data file.
+// Returns the curve loaded under that name, or registers the default for it.
+// Pointers stay valid and see the values of later reloads.
+const ResponseCurve *response_curve(const char *name, const ResponseCurve &default_curve);
+
+// Lines are `name type params...`, `#` starts a comment:
+//   name linear x_min x_max slope offset
+//   name exponential x_min x_max scale slope offset
+//   name logistic x_min x_max scale steepness midpoint
+//   name piecewise x0 y0 x1 y1 ...
+//   name table x_min x_max v0 v1 ...
+// Returns false if the file can't be read, malformed lines are reported and skipped.
+bool load_response_curves(const char *path);
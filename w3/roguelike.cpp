@@ -6,49 +6,44 @@
 #include "aiUtils.h"
 #include "blackboard.h"
 #include "math.h"
+#include "spatialHash.h"
+#include "tileOccupancy.h"
+#include <algorithm>
 
 static void create_fuzzy_monster_beh(flecs::entity e)
 {
-  e.set(Blackboard{});
+  static BlackboardLayout layout;
+  static UtilityScorer scorer;
+  e.set(Blackboard{&layout});
   BehNode *root =
-    utility_selector({
+    best_utility_selector(e, scorer, {
       std::make_pair(
         sequence({
           find_enemy(e, 4.f, "flee_enemy"),
           flee(e, "flee_enemy")
         }),
-        [](Blackboard &bb)
-        {
-          const float hp = bb.get<float>("hp");
-          const float enemyDist = bb.get<float>("enemyDist");
-          return (100.f - hp) * 5.f - 50.f * enemyDist;
-        }
+        // (100 - hp) * 5 - 50 * enemyDist
+        UtilityOption{curve_utility(bb_key<float, "hp">(),
+                                    response_curve("monster_flee_hp", ResponseCurve::linear(0.f, 100.f, -5.f, 500.f))),
+                      curve_utility(bb_key<float, "enemyDist">(),
+                                    response_curve("monster_flee_enemy_dist", ResponseCurve::linear(0.f, 100.f, -50.f, 0.f)))}
       ),
       std::make_pair(
         sequence({
           find_enemy(e, 3.f, "attack_enemy"),
           move_to_entity(e, "attack_enemy")
         }),
-        [](Blackboard &bb)
-        {
-          const float enemyDist = bb.get<float>("enemyDist");
-          return 100.f - 10.f * enemyDist;
-        }
+        UtilityOption{curve_utility(bb_key<float, "enemyDist">(),
+                                    response_curve("monster_attack_enemy_dist", ResponseCurve::linear(0.f, 100.f, -10.f, 100.f)))}
       ),
       std::make_pair(
         patrol(e, 2.f, "patrol_pos"),
-        [](Blackboard &)
-        {
-          return 50.f;
-        }
+        UtilityOption{constant_utility(50.f)}
       ),
       std::make_pair(
         patch_up(100.f),
-        [](Blackboard &bb)
-        {
-          const float hp = bb.get<float>("hp");
-          return 140.f - hp;
-        }
+        UtilityOption{curve_utility(bb_key<float, "hp">(),
+                                    response_curve("monster_patch_up_hp", ResponseCurve::linear(0.f, 100.f, -1.f, 140.f)))}
       )
     });
   e.add<WorldInfoGatherer>();
@@ -57,51 +52,41 @@ static void create_fuzzy_monster_beh(flecs::entity e)
 
 static void create_fuzzy_research_beh(flecs::entity e, Position base_pos)
 {
-  Blackboard bb{};
-  size_t idx = bb.regName<Position>("base_position");
-  bb.set<Position>(idx, base_pos);
+  static BlackboardLayout layout;
+  static UtilityScorer scorer;
+  Blackboard bb{&layout};
+  bb.set(bb_key<Position, "base_position">(), base_pos);
   e.set(Blackboard(bb));
   BehNode *root =
-    utility_selector({
+    utility_selector(e, scorer, {
       std::make_pair(
         sequence({
           random_move()
         }),
-        [](Blackboard &bb)
-        {
-          const float allyDist = bb.get<float>("allyDist");
-          return 3.*exp(5. - allyDist);
-        }
+        // 3 * exp(5 - allyDist)
+        UtilityOption{curve_utility(bb_key<float, "allyDist">(),
+                                    response_curve("research_spread_ally_dist", ResponseCurve::exponential(0.f, 20.f, 3.f, -1.f, 5.f)))}
       ),
       std::make_pair(
         move_to_position(e, "base_position"),
-        [](Blackboard &bb)
-        {
-          const float baseDist = bb.get<float>("baseDist");
-          return exp(baseDist - 9.);
-        }
+        UtilityOption{curve_utility(bb_key<float, "baseDist">(),
+                                    response_curve("research_return_base_dist", ResponseCurve::exponential(0.f, 30.f, 1.f, 1.f, -9.f)))}
       ),
       std::make_pair(
         sequence({
           find_enemy(e, 10.f, "attack_enemy"),
           move_to_entity(e, "attack_enemy")
         }),
-        [](Blackboard &bb)
-        {
-          const float enemyDist = bb.get<float>("enemyDist");
-          return 2.0*exp(3. - enemyDist);
-        }
+        UtilityOption{curve_utility(bb_key<float, "enemyDist">(),
+                                    response_curve("research_attack_enemy_dist", ResponseCurve::exponential(0.f, 20.f, 2.f, -1.f, 3.f)))}
       ),
       std::make_pair(
         sequence({
           closest_enemy_to(e, "base_position", "attack_enemy"),
           move_to_entity(e, "attack_enemy")
         }),
-        [](Blackboard &bb)
-        {
-          const float baseEnemyDist = bb.get<float>("baseEnemyDist");
-          return 5.*exp(6. - baseEnemyDist);
-        }
+        UtilityOption{curve_utility(bb_key<float, "baseEnemyDist">(),
+                                    response_curve("research_defend_base_enemy_dist", ResponseCurve::exponential(0.f, 20.f, 5.f, -1.f, 6.f)))}
       )
     });
   e.add<WorldInfoGatherer>();
@@ -111,7 +96,8 @@ static void create_fuzzy_research_beh(flecs::entity e, Position base_pos)
 
 static void create_minotaur_beh(flecs::entity e)
 {
-  e.set(Blackboard{});
+  static BlackboardLayout layout;
+  e.set(Blackboard{&layout});
   BehNode *root =
     selector({
       sequence({
@@ -237,16 +223,30 @@ static void register_roguelike_systems(flecs::world &ecs)
 }
 
 
-void init_roguelike(flecs::world &ecs)
+// researchers gather around the base, offsets of the default set
+static const Position default_research_spawns[num_default_monsters] = {
+  {-1, -1}, {1, 1}, {-1, 1}, {1, -1}, {-1, 0}, {0, -1}, {0, 1}, {1, 0}
+};
+
+void init_roguelike(flecs::world &ecs, int num_monsters)
 {
   register_roguelike_systems(ecs);
-
-  ecs.entity("swordsman_tex")
-    .set(Texture2D{LoadTexture("w3/assets/swordsman.png")});
-  ecs.entity("minotaur_tex")
-    .set(Texture2D{LoadTexture("w3/assets/minotaur.png")});
-  ecs.entity("zombie_tex")
-    .set(Texture2D{LoadTexture("w3/assets/zombie.png")});
+  register_spatial_hash(ecs);
+  ecs.entity("tile_occupancy")
+    .set(TileOccupancy{});
+  // before behaviours are created, the file overrides curves defined in code
+  load_response_curves(utility_curves_path);
+
+  // no window means a headless simulation, nothing will be rendered
+  if (IsWindowReady())
+  {
+    ecs.entity("swordsman_tex")
+      .set(Texture2D{LoadTexture("w3/assets/swordsman.png")});
+    ecs.entity("minotaur_tex")
+      .set(Texture2D{LoadTexture("w3/assets/minotaur.png")});
+    ecs.entity("zombie_tex")
+      .set(Texture2D{LoadTexture("w3/assets/zombie.png")});
+  }
 
   ecs.observer<Texture2D>()
     .event(flecs::OnRemove)
@@ -261,14 +261,14 @@ void init_roguelike(flecs::world &ecs)
   // create_fuzzy_monster_beh(create_monster(ecs, -5, 5, Color{0xff, 0xff, 0xff, 0xff}, "minotaur_tex"));
 
   Position base{-3, -3};
-  create_fuzzy_research_beh(create_monster(ecs, -4, -4, Color{0xff, 0xff, 0xff, 0xff}, "zombie_tex", 2), base);
-  create_fuzzy_research_beh(create_monster(ecs, -2, -2, Color{0xff, 0xff, 0xff, 0xff}, "zombie_tex", 2), base);
-  create_fuzzy_research_beh(create_monster(ecs, -4, -2, Color{0xff, 0xff, 0xff, 0xff}, "zombie_tex", 2), base);
-  create_fuzzy_research_beh(create_monster(ecs, -2, -4, Color{0xff, 0xff, 0xff, 0xff}, "zombie_tex", 2), base);
-  create_fuzzy_research_beh(create_monster(ecs, -4, -3, Color{0xff, 0xff, 0xff, 0xff}, "zombie_tex", 2), base);
-  create_fuzzy_research_beh(create_monster(ecs, -3, -4, Color{0xff, 0xff, 0xff, 0xff}, "zombie_tex", 2), base);
-  create_fuzzy_research_beh(create_monster(ecs, -3, -2, Color{0xff, 0xff, 0xff, 0xff}, "zombie_tex", 2), base);
-  create_fuzzy_research_beh(create_monster(ecs, -2, -3, Color{0xff, 0xff, 0xff, 0xff}, "zombie_tex", 2), base);
+  // monsters past the default set are scattered at random around the base, keeping about the same density
+  const int spawnRadius = std::max(1, int(sqrtf(float(num_monsters)) * 0.5f));
+  for (int i = 0; i < num_monsters; ++i)
+  {
+    const Position offset = i < num_default_monsters ? default_research_spawns[i] :
+                            Position{GetRandomValue(-spawnRadius, spawnRadius), GetRandomValue(-spawnRadius, spawnRadius)};
+    create_fuzzy_research_beh(create_monster(ecs, base.x + offset.x, base.y + offset.y, Color{0xff, 0xff, 0xff, 0xff}, "zombie_tex", 2), base);
+  }
   create_base(ecs, base.x, base.y);
 
   create_player(ecs, 0, 0, "swordsman_tex");
@@ -321,11 +321,12 @@ static Position move_pos(Position pos, int action)
   return pos;
 }
 
-static void process_actions(flecs::world &ecs)
+static void process_actions(flecs::world &ecs, const AIContext &ctx)
 {
   static auto processActions = ecs.query<Action, Position, MovePos, const MeleeDamage, const Team>();
   static auto processHeals = ecs.query<Action, Hitpoints>();
   static auto checkAttacks = ecs.query<const MovePos, Hitpoints, const Team>();
+  static auto tileOccupancy = ecs.query<TileOccupancy>();
   // Process all actions
   ecs.defer([&]
   {
@@ -334,36 +335,53 @@ static void process_actions(flecs::world &ecs)
       if (a.action != EA_HEAL_SELF)
         return;
       a.action = EA_NOP;
-      push_to_log(ecs, "Monster healed itself");
+      push_to_log(ctx, "Monster healed itself");
       hp.hitpoints += 10.f;
 
     });
-    processActions.each([&](flecs::entity entity, Action &a, Position &pos, MovePos &mpos, const MeleeDamage &dmg, const Team &team)
+    // moves are resolved in query order: the first one to step on a tile claims it,
+    // everyone coming later is blocked by whoever is there (and hits them if they are enemies)
+    tileOccupancy.each([&](TileOccupancy &occ)
     {
-      Position nextPos = move_pos(pos, a.action);
-      bool blocked = false;
-      checkAttacks.each([&](flecs::entity enemy, const MovePos &epos, Hitpoints &hp, const Team &enemy_team)
+      occ.clear();
+      checkAttacks.each([&](flecs::entity e, const MovePos &epos, Hitpoints &hp, const Team &t)
       {
-        if (entity != enemy && epos == nextPos)
+        occ.addOccupant(epos.x, epos.y, e, hp, t.team);
+      });
+      processActions.each([&](flecs::entity entity, Action &a, Position &pos, MovePos &mpos, const MeleeDamage &dmg, const Team &team)
+      {
+        Position nextPos = move_pos(pos, a.action);
+        bool blocked = false;
+        for (const TileOccupancy::Occupant &occupant : occ.occupantsAt(nextPos.x, nextPos.y))
         {
+          if (occupant.entity == entity)
+            continue;
           blocked = true;
-          if (team.team != enemy_team.team)
+          if (team.team != occupant.team)
           {
-            push_to_log(ecs, "damaged entity");
-            hp.hitpoints -= dmg.damage;
+            push_to_log(ctx, "damaged entity");
+            occupant.hp->hitpoints -= dmg.damage;
           }
         }
+        if (blocked)
+          a.action = EA_NOP;
+        else
+        {
+          occ.moveOccupant(entity, mpos.x, mpos.y, nextPos.x, nextPos.y);
+          mpos = nextPos;
+        }
       });
-      if (blocked)
-        a.action = EA_NOP;
-      else
-        mpos = nextPos;
     });
     // now move
-    processActions.each([&](Action &a, Position &pos, MovePos &mpos, const MeleeDamage &, const Team&)
+    query_spatial_hash(ecs, [&](SpatialHash &hash)
     {
-      pos = mpos;
-      a.action = EA_NOP;
+      processActions.each([&](flecs::entity entity, Action &a, Position &pos, MovePos &mpos, const MeleeDamage &, const Team &team)
+      {
+        if (!(pos == mpos))
+          hash.update(entity, Position{mpos.x, mpos.y}, team.team);
+        pos = mpos;
+        a.action = EA_NOP;
+      });
     });
   });
 
@@ -382,81 +400,85 @@ static void process_actions(flecs::world &ecs)
   static auto powerupPickup = ecs.query<const Position, const PowerupAmount>();
   ecs.defer([&]
   {
-    playerPickup.each([&](const IsPlayer&, const Position &pos, Hitpoints &hp, MeleeDamage &dmg)
+    tileOccupancy.each([&](TileOccupancy &occ)
     {
-      healPickup.each([&](flecs::entity entity, const Position &ppos, const HealAmount &amt)
-      {
-        if (pos == ppos)
-        {
-          hp.hitpoints += amt.amount;
-          entity.destruct();
-        }
-      });
-      powerupPickup.each([&](flecs::entity entity, const Position &ppos, const PowerupAmount &amt)
+      occ.clear();
+      healPickup.each([&](flecs::entity e, const Position &ppos, const HealAmount &) { occ.addItem(ppos.x, ppos.y, e); });
+      powerupPickup.each([&](flecs::entity e, const Position &ppos, const PowerupAmount &) { occ.addItem(ppos.x, ppos.y, e); });
+      playerPickup.each([&](const IsPlayer&, const Position &pos, Hitpoints &hp, MeleeDamage &dmg)
       {
-        if (pos == ppos)
+        std::vector<flecs::entity> *items = occ.itemsAt(pos.x, pos.y);
+        if (!items)
+          return;
+        for (flecs::entity item : *items)
         {
-          dmg.damage += amt.amount;
-          entity.destruct();
+          if (const HealAmount *amt = item.get<HealAmount>())
+            hp.hitpoints += amt->amount;
+          if (const PowerupAmount *amt = item.get<PowerupAmount>())
+            dmg.damage += amt->amount;
+          item.destruct();
         }
+        items->clear();
       });
     });
   });
 }
 
-template<typename T>
-static void push_info_to_bb(Blackboard &bb, const char *name, const T &val)
-{
-  size_t idx = bb.regName<T>(name);
-  bb.set(idx, val);
-}
-
 // sensors
-static void gather_world_info(flecs::world &ecs)
+static void gather_world_info(flecs::world &ecs, const AIContext &ctx)
 {
   static auto gatherWorldInfo = ecs.query<Blackboard,
                                           const Position, const Hitpoints,
                                           const WorldInfoGatherer,
                                           const Team>();
-  static auto alliesQuery = ecs.query<const Position, const Team>();
+  if (!ctx.spatialHash)
+    return;
+  const SpatialHash &hash = *ctx.spatialHash;
   gatherWorldInfo.each([&](Blackboard &bb, const Position &pos, const Hitpoints &hp,
                            WorldInfoGatherer, const Team &team)
   {
-    // first gather all needed names (without cache)
-    push_info_to_bb(bb, "hp", hp.hitpoints);
+    // keys are interned once per call site, these are plain indexed stores
+    bb.set(bb_key<float, "hp">(), hp.hitpoints);
     float numAllies = 0; // note float
     float closestEnemyDist = 100.f;
     float closestAllyDist = 100.f;
     float closestBaseEnemyDist = 100.f;
 
-    Position base = bb.get<Position>("base_position");
-    alliesQuery.each([&](const Position &apos, const Team &ateam)
+    Position base = bb.get(bb_key<Position, "base_position">());
+    auto isAlly = [&](int t) { return t == team.team; };
+    auto isEnemy = [&](int t) { return t != team.team; };
+    constexpr float limitDist = 5.f;
+    hash.query_radius(pos, limitDist, isAlly, [&](const SpatialHash::Neighbour &ally)
     {
-      constexpr float limitDist = 5.f;
-      if (team.team == ateam.team && dist_sq(pos, apos) < sqr(limitDist))
+      if (ally.dist < limitDist)
         numAllies += 1.f;
-      if (team.team == ateam.team)
-      {
-        const float allyDist = dist(pos, apos);
-        if (allyDist < closestAllyDist)
-          closestAllyDist = allyDist;
-      }
-      if (team.team != ateam.team)
-      {
-        const float enemyDist = dist(pos, apos);
-        if (enemyDist < closestEnemyDist)
-          closestEnemyDist = enemyDist;
-        const float enemyBaseDist = dist(base, apos);
-        if (enemyBaseDist < closestBaseEnemyDist)
-          closestBaseEnemyDist = enemyBaseDist;
-      }
     });
-    push_info_to_bb(bb, "alliesNum", numAllies);
-    push_info_to_bb(bb, "allyDist", closestAllyDist);
-    push_info_to_bb(bb, "baseDist", dist(base, pos));
-    push_info_to_bb(bb, "enemyDist", closestEnemyDist);
-    push_info_to_bb(bb, "baseEnemyDist", closestBaseEnemyDist);
+    SpatialHash::Neighbour closest;
+    if (hash.nearest(pos, isAlly, closest))
+      closestAllyDist = std::min(closestAllyDist, closest.dist);
+    if (hash.nearest(pos, isEnemy, closest))
+      closestEnemyDist = std::min(closestEnemyDist, closest.dist);
+    if (hash.nearest(base, isEnemy, closest))
+      closestBaseEnemyDist = std::min(closestBaseEnemyDist, closest.dist);
+    bb.set(bb_key<float, "alliesNum">(), numAllies);
+    bb.set(bb_key<float, "allyDist">(), closestAllyDist);
+    bb.set(bb_key<float, "baseDist">(), dist(base, pos));
+    bb.set(bb_key<float, "enemyDist">(), closestEnemyDist);
+    bb.set(bb_key<float, "baseEnemyDist">(), closestBaseEnemyDist);
+  });
+}
+
+static AIContext make_ai_context(flecs::world &ecs)
+{
+  static auto worldSingletons = ecs.query<ActionLog, const TurnCounter>();
+  AIContext ctx;
+  worldSingletons.each([&](ActionLog &l, const TurnCounter &c)
+  {
+    ctx.actionLog = &l;
+    ctx.turnCounter = &c;
   });
+  query_spatial_hash(ecs, [&](const SpatialHash &hash) { ctx.spatialHash = &hash; });
+  return ctx;
 }
 
 void process_turn(flecs::world &ecs)
@@ -464,26 +486,30 @@ void process_turn(flecs::world &ecs)
   static auto stateMachineAct = ecs.query<StateMachine>();
   static auto behTreeUpdate = ecs.query<BehaviourTree, Blackboard>();
   static auto turnIncrementer = ecs.query<TurnCounter>();
+  if (IsKeyPressed(KEY_F5))
+    load_response_curves(utility_curves_path);
   if (is_player_acted(ecs))
   {
+    const AIContext ctx = make_ai_context(ecs);
     if (upd_player_actions_count(ecs))
     {
       // Plan action for NPCs
-      gather_world_info(ecs);
+      gather_world_info(ecs, ctx);
+      evaluate_utility_scorers();
       ecs.defer([&]
       {
         stateMachineAct.each([&](flecs::entity e, StateMachine &sm)
         {
-          sm.act(0.f, ecs, e);
+          sm.act(0.f, ecs, e, ctx);
         });
         behTreeUpdate.each([&](flecs::entity e, BehaviourTree &bt, Blackboard &bb)
         {
-          bt.update(ecs, e, bb);
+          bt.update(ecs, e, bb, ctx);
         });
       });
       turnIncrementer.each([](TurnCounter &tc) { tc.count++; });
     }
-    process_actions(ecs);
+    process_actions(ecs, ctx);
   }
 }
 
@@ -0,0 +1,303 @@
+#pragma once
+#include <vector>
+#include <algorithm>
+#include <unordered_map>
+#include <cfloat>
+#include <cstdint>
+#include <flecs.h>
+#include "ecsTypes.h"
+#include "math.h"
+
+// Uniform grid over integer positions, bucketed per team.
+// Cells are hashed, so the world doesn't need to be bounded.
+class SpatialHash
+{
+public:
+  struct Neighbour
+  {
+    flecs::entity entity;
+    Position pos;
+    int team = 0;
+    float dist = FLT_MAX;
+  };
+
+  SpatialHash(int cell_size = 8) : cellSize(cell_size) {}
+
+  void clear()
+  {
+    teams.clear();
+    locations.clear();
+  }
+
+  // inserts entity or moves it if it is already there
+  void update(flecs::entity e, const Position &pos, int team)
+  {
+    auto itf = locations.find(e.id());
+    if (itf != locations.end())
+    {
+      Location &loc = itf->second;
+      if (loc.team == team && cell_key(loc.pos) == cell_key(pos))
+      {
+        for (Entry &entry : get_grid(team).cells[cell_key(pos)])
+          if (entry.entity == e)
+            entry.pos = pos;
+        loc.pos = pos;
+        return;
+      }
+      erase_from_cell(e, loc);
+    }
+    TeamGrid &grid = get_grid(team);
+    const int cx = cell_coord(pos.x);
+    const int cy = cell_coord(pos.y);
+    if (grid.cells.empty())
+    {
+      grid.minX = grid.maxX = cx;
+      grid.minY = grid.maxY = cy;
+    }
+    grid.minX = std::min(grid.minX, cx);
+    grid.maxX = std::max(grid.maxX, cx);
+    grid.minY = std::min(grid.minY, cy);
+    grid.maxY = std::max(grid.maxY, cy);
+    grid.cells[cell_key(pos)].push_back(Entry{e, pos});
+    locations[e.id()] = Location{pos, team};
+  }
+
+  void remove(flecs::entity e)
+  {
+    auto itf = locations.find(e.id());
+    if (itf == locations.end())
+      return;
+    erase_from_cell(e, itf->second);
+    locations.erase(itf);
+  }
+
+  // up to k closest entities further than min_dist from pos, sorted by distance (ties by id)
+  template<typename TeamPred>
+  size_t k_nearest(const Position &pos, TeamPred accept_team, Neighbour *out, size_t k, float min_dist = -1.f) const
+  {
+    size_t count = 0;
+    if (k == 0)
+      return 0;
+    const int cx = cell_coord(pos.x);
+    const int cy = cell_coord(pos.y);
+    const int maxRing = max_ring(cx, cy, accept_team);
+    for (int ring = 0; ring <= maxRing; ++ring)
+    {
+      // nothing in this ring or further could be closer than what we have
+      if (count == k && ring_min_dist(ring) > out[k - 1].dist)
+        break;
+      for_ring_cells(cx, cy, ring, [&](int x, int y)
+      {
+        const uint64_t key = cell_key_xy(x, y);
+        for (size_t t = 0; t < teams.size(); ++t)
+        {
+          if (teams[t].cells.empty() || !accept_team(int(t)))
+            continue;
+          auto itf = teams[t].cells.find(key);
+          if (itf == teams[t].cells.end())
+            continue;
+          for (const Entry &entry : itf->second)
+          {
+            const float curDist = dist(entry.pos, pos);
+            if (curDist <= min_dist)
+              continue;
+            Neighbour nb{entry.entity, entry.pos, int(t), curDist};
+            size_t idx = count;
+            if (count == k)
+            {
+              if (!closer(nb, out[k - 1]))
+                continue;
+              idx--;
+            }
+            else
+              count++;
+            for (; idx > 0 && closer(nb, out[idx - 1]); --idx)
+              out[idx] = out[idx - 1];
+            out[idx] = nb;
+          }
+        }
+      });
+    }
+    return count;
+  }
+
+  template<typename TeamPred>
+  bool nearest(const Position &pos, TeamPred accept_team, Neighbour &out, float min_dist = -1.f) const
+  {
+    return k_nearest(pos, accept_team, &out, 1, min_dist) > 0;
+  }
+
+  // calls c(const Neighbour &) for every entity within radius, order is unspecified
+  template<typename TeamPred, typename Callable>
+  void query_radius(const Position &pos, float radius, TeamPred accept_team, Callable c) const
+  {
+    const int r = int(radius);
+    const int minX = cell_coord(pos.x - r);
+    const int maxX = cell_coord(pos.x + r);
+    const int minY = cell_coord(pos.y - r);
+    const int maxY = cell_coord(pos.y + r);
+    for (size_t t = 0; t < teams.size(); ++t)
+    {
+      const TeamGrid &grid = teams[t];
+      if (grid.cells.empty() || !accept_team(int(t)))
+        continue;
+      for (int y = std::max(minY, grid.minY); y <= std::min(maxY, grid.maxY); ++y)
+        for (int x = std::max(minX, grid.minX); x <= std::min(maxX, grid.maxX); ++x)
+        {
+          auto itf = grid.cells.find(cell_key_xy(x, y));
+          if (itf == grid.cells.end())
+            continue;
+          for (const Entry &entry : itf->second)
+          {
+            const float curDist = dist(entry.pos, pos);
+            if (curDist <= radius)
+              c(Neighbour{entry.entity, entry.pos, int(t), curDist});
+          }
+        }
+    }
+  }
+
+private:
+  struct Entry
+  {
+    flecs::entity entity;
+    Position pos;
+  };
+
+  struct TeamGrid
+  {
+    std::unordered_map<uint64_t, std::vector<Entry>> cells;
+    // bounds of all cells ever touched, only grow
+    int minX = 0;
+    int maxX = 0;
+    int minY = 0;
+    int maxY = 0;
+  };
+
+  struct Location
+  {
+    Position pos;
+    int team = 0;
+  };
+
+  int cellSize = 8;
+  std::vector<TeamGrid> teams;
+  std::unordered_map<flecs::entity_t, Location> locations;
+
+  static bool closer(const Neighbour &lhs, const Neighbour &rhs)
+  {
+    return lhs.dist < rhs.dist || (lhs.dist == rhs.dist && lhs.entity.id() < rhs.entity.id());
+  }
+
+  int cell_coord(int v) const
+  {
+    return v >= 0 ? v / cellSize : -((-v + cellSize - 1) / cellSize);
+  }
+
+  static uint64_t cell_key_xy(int x, int y)
+  {
+    return (uint64_t(uint32_t(x)) << 32) | uint64_t(uint32_t(y));
+  }
+
+  uint64_t cell_key(const Position &pos) const
+  {
+    return cell_key_xy(cell_coord(pos.x), cell_coord(pos.y));
+  }
+
+  // lower bound of distance from any tile of the center cell to any tile of a ring
+  float ring_min_dist(int ring) const
+  {
+    return ring == 0 ? 0.f : float((ring - 1) * cellSize + 1);
+  }
+
+  TeamGrid &get_grid(int team)
+  {
+    if (size_t(team) >= teams.size())
+      teams.resize(size_t(team) + 1);
+    return teams[size_t(team)];
+  }
+
+  template<typename TeamPred>
+  int max_ring(int cx, int cy, TeamPred accept_team) const
+  {
+    int res = -1;
+    for (size_t t = 0; t < teams.size(); ++t)
+    {
+      const TeamGrid &grid = teams[t];
+      if (grid.cells.empty() || !accept_team(int(t)))
+        continue;
+      res = std::max(res, std::max(std::max(cx - grid.minX, grid.maxX - cx),
+                                   std::max(cy - grid.minY, grid.maxY - cy)));
+    }
+    return res;
+  }
+
+  template<typename Callable>
+  static void for_ring_cells(int cx, int cy, int ring, Callable c)
+  {
+    if (ring == 0)
+    {
+      c(cx, cy);
+      return;
+    }
+    for (int x = cx - ring; x <= cx + ring; ++x)
+    {
+      c(x, cy - ring);
+      c(x, cy + ring);
+    }
+    for (int y = cy - ring + 1; y <= cy + ring - 1; ++y)
+    {
+      c(cx - ring, y);
+      c(cx + ring, y);
+    }
+  }
+
+  void erase_from_cell(flecs::entity e, const Location &loc)
+  {
+    TeamGrid &grid = get_grid(loc.team);
+    auto itf = grid.cells.find(cell_key(loc.pos));
+    if (itf == grid.cells.end())
+      return;
+    std::vector<Entry> &entries = itf->second;
+    for (size_t i = 0; i < entries.size(); ++i)
+      if (entries[i].entity == e)
+      {
+        entries[i] = entries.back();
+        entries.pop_back();
+        break;
+      }
+    if (entries.empty())
+      grid.cells.erase(itf);
+  }
+};
+
+// ecs may be a stage, so it is safe to call from worker threads while the world is readonly
+// once the query is created (register_spatial_hash does it)
+template<typename Callable>
+inline void query_spatial_hash(flecs::world &ecs, Callable c)
+{
+  static auto spatialHashQuery = ecs.query<SpatialHash>();
+
+  spatialHashQuery.iter(ecs).each(c);
+}
+
+// keeps spatial hash in sync with Position/Team of all characters,
+// moves done directly on components should call SpatialHash::update
+inline void register_spatial_hash(flecs::world &ecs)
+{
+  ecs.entity("spatial_hash")
+    .set(SpatialHash{});
+  query_spatial_hash(ecs, [](SpatialHash &) {});
+  ecs.observer<const Position, const Team>()
+    .event(flecs::OnSet)
+    .each([&](flecs::entity e, const Position &pos, const Team &team)
+    {
+      query_spatial_hash(ecs, [&](SpatialHash &hash) { hash.update(e, pos, team.team); });
+    });
+  ecs.observer<const Position, const Team>()
+    .event(flecs::OnRemove)
+    .each([&](flecs::entity e, const Position &, const Team &)
+    {
+      query_spatial_hash(ecs, [&](SpatialHash &hash) { hash.remove(e); });
+    });
+}
@@ -11,19 +11,19 @@ StateMachine::~StateMachine()
   transitions.clear();
 }
 
-void StateMachine::act(float dt, flecs::world &ecs, flecs::entity entity)
+void StateMachine::act(float dt, flecs::world &ecs, flecs::entity entity, const AIContext &ctx)
 {
   if (curStateIdx < states.size())
   {
     for (const std::pair<StateTransition*, int> &transition : transitions[curStateIdx])
-      if (transition.first->isAvailable(ecs, entity))
+      if (transition.first->isAvailable(ecs, entity, ctx))
       {
         states[curStateIdx]->exit();
         curStateIdx = size_t(transition.second);
         states[curStateIdx]->enter();
         break;
       }
-    states[curStateIdx]->act(dt, ecs, entity);
+    states[curStateIdx]->act(dt, ecs, entity, ctx);
   }
   else
     curStateIdx = 0;
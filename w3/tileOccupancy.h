@@ -0,0 +1,97 @@
+#pragma once
+#include <vector>
+#include <unordered_map>
+#include <cstdint>
+#include <flecs.h>
+#include "ecsTypes.h"
+
+// Who stands on which tile and what lies there, rebuilt once per turn so moves, attacks
+// and pickups look up a tile instead of scanning every entity.
+// The world isn't bounded, so tiles are hashed. Emptied buckets are kept and reused,
+// only the ones touched since the last clear() are emptied.
+class TileOccupancy
+{
+public:
+  // hp points into the Hitpoints column, valid while the actions of a turn are processed
+  struct Occupant
+  {
+    flecs::entity entity;
+    Hitpoints *hp = nullptr;
+    int team = 0;
+  };
+
+  void clear()
+  {
+    for (uint64_t key : usedTiles)
+    {
+      Tile &tile = tiles[key];
+      tile.occupants.clear();
+      tile.items.clear();
+    }
+    usedTiles.clear();
+  }
+
+  void addOccupant(int x, int y, flecs::entity e, Hitpoints &hp, int team)
+  {
+    getTile(x, y).occupants.push_back(Occupant{e, &hp, team});
+  }
+
+  // does nothing for entities that weren't added at from
+  void moveOccupant(flecs::entity e, int from_x, int from_y, int to_x, int to_y)
+  {
+    auto itf = tiles.find(tile_key(from_x, from_y));
+    if (itf == tiles.end())
+      return;
+    std::vector<Occupant> &occupants = itf->second.occupants;
+    for (size_t i = 0; i < occupants.size(); ++i)
+      if (occupants[i].entity == e)
+      {
+        const Occupant occupant = occupants[i];
+        occupants[i] = occupants.back();
+        occupants.pop_back();
+        getTile(to_x, to_y).occupants.push_back(occupant);
+        return;
+      }
+  }
+
+  const std::vector<Occupant> &occupantsAt(int x, int y) const
+  {
+    static const std::vector<Occupant> none;
+    auto itf = tiles.find(tile_key(x, y));
+    return itf == tiles.end() ? none : itf->second.occupants;
+  }
+
+  void addItem(int x, int y, flecs::entity e)
+  {
+    getTile(x, y).items.push_back(e);
+  }
+
+  // nullptr if nothing was ever put on the tile
+  std::vector<flecs::entity> *itemsAt(int x, int y)
+  {
+    auto itf = tiles.find(tile_key(x, y));
+    return itf == tiles.end() ? nullptr : &itf->second.items;
+  }
+
+private:
+  struct Tile
+  {
+    std::vector<Occupant> occupants;
+    std::vector<flecs::entity> items;
+  };
+
+  std::unordered_map<uint64_t, Tile> tiles;
+  std::vector<uint64_t> usedTiles;
+
+  static uint64_t tile_key(int x, int y)
+  {
+    return (uint64_t(uint32_t(x)) << 32) | uint64_t(uint32_t(y));
+  }
+
+  Tile &getTile(int x, int y)
+  {
+    const uint64_t key = tile_key(x, y);
+    usedTiles.push_back(key);
+    return tiles[key];
+  }
+};
@@ -0,0 +1,113 @@
+#include "utilityScorer.h"
+#include <algorithm>
+#include <cassert>
+
+static std::vector<UtilityScorer*> &all_scorers()
+{
+  static std::vector<UtilityScorer*> scorers;
+  return scorers;
+}
+
+UtilityScorer::UtilityScorer()
+{
+  all_scorers().push_back(this);
+}
+
+UtilityScorer::~UtilityScorer()
+{
+  std::vector<UtilityScorer*> &scorers = all_scorers();
+  scorers.erase(std::remove(scorers.begin(), scorers.end(), this), scorers.end());
+}
+
+void UtilityScorer::setOptions(const std::vector<UtilityOption> &in_options, bool in_batched)
+{
+  if (!options.empty())
+  {
+    assert(options.size() == in_options.size() && batched == in_batched && "selectors sharing a scorer differ");
+    return;
+  }
+  batched = in_batched;
+  assert(in_options.size() <= max_utility_options && "too many utility options");
+  options = in_options;
+  for (const UtilityOption &option : options)
+  {
+    std::vector<size_t> &columns = inputColumns.emplace_back();
+    for (const UtilityConsideration &cons : option)
+    {
+      auto itf = std::find(inputKeys.begin(), inputKeys.end(), cons.input.idx);
+      if (cons.curve && itf == inputKeys.end())
+        itf = inputKeys.insert(inputKeys.end(), cons.input.idx);
+      columns.push_back(cons.curve ? size_t(itf - inputKeys.begin()) : 0);
+    }
+  }
+  reserve(capacity);
+}
+
+void UtilityScorer::reserve(size_t num_rows)
+{
+  capacity = num_rows;
+  inputs.assign(inputKeys.size() * capacity, 0.f);
+  scores.assign(options.size() * capacity, 0.f);
+}
+
+size_t UtilityScorer::addRow(flecs::entity entity)
+{
+  if (!freeRows.empty())
+  {
+    const size_t row = freeRows.back();
+    freeRows.pop_back();
+    rows[row] = entity;
+    return row;
+  }
+  rows.push_back(entity);
+  if (rows.size() > capacity)
+    reserve(std::max<size_t>(16, capacity * 2));
+  return rows.size() - 1;
+}
+
+void UtilityScorer::removeRow(size_t row)
+{
+  rows[row] = flecs::entity();
+  freeRows.push_back(row);
+}
+
+// constants are a plain loop the compiler vectorises at -O3, curves have their own SSE2 batch
+static void accumulate(const UtilityConsideration &cons, const float *x, float *out, size_t n)
+{
+  if (cons.curve)
+  {
+    cons.curve->accumulate(x, out, n);
+    return;
+  }
+  const float value = cons.value;
+  for (size_t i = 0; i < n; ++i)
+    out[i] += value;
+}
+
+void UtilityScorer::evaluate()
+{
+  const size_t n = rows.size();
+  if (n == 0 || options.empty() || !batched)
+    return;
+
+  for (size_t row = 0; row < n; ++row)
+  {
+    const Blackboard *bb = rows[row].is_alive() ? rows[row].get<Blackboard>() : nullptr;
+    for (size_t input = 0; input < inputKeys.size(); ++input)
+      inputs[input * capacity + row] = bb ? bb->get<float>(inputKeys[input]) : 0.f;
+  }
+
+  std::fill(scores.begin(), scores.end(), 0.f);
+  for (size_t option = 0; option < options.size(); ++option)
+  {
+    float *out = scores.data() + option * capacity;
+    for (size_t i = 0; i < options[option].size(); ++i)
+      accumulate(options[option][i], inputs.data() + inputColumns[option][i] * capacity, out, n);
+  }
+}
+
+void evaluate_utility_scorers()
+{
+  for (UtilityScorer *scorer : all_scorers())
+    scorer->evaluate();
+}
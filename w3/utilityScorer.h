@@ -0,0 +1,93 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include <flecs.h>
+#include "blackboard.h"
+#include "responseCurve.h"
+
+constexpr size_t max_utility_options = 8;
+
+// One term of an option's utility, a response curve over a float blackboard variable,
+// or a constant if there is no curve
+struct UtilityConsideration
+{
+  BlackboardKey<float> input;
+  const ResponseCurve *curve = nullptr;
+  float value = 0.f;
+
+  float evaluate(const Blackboard &bb) const { return curve ? (*curve)(bb.get(input)) : value; }
+  // no input can score higher, without looking at the blackboard
+  float upperBound() const { return curve ? curve->maxValue() : value; }
+};
+
+inline UtilityConsideration constant_utility(float value)
+{
+  return UtilityConsideration{BlackboardKey<float>{}, nullptr, value};
+}
+
+inline UtilityConsideration curve_utility(BlackboardKey<float> input, const ResponseCurve *curve)
+{
+  return UtilityConsideration{input, curve, 0.f};
+}
+
+// utility of an option is the sum of its considerations
+using UtilityOption = std::vector<UtilityConsideration>;
+
+// Scores the options of a utility selector for all entities sharing it in one batch.
+// Every entity is a row; inputs are gathered from the blackboards into one column per
+// variable, then every consideration runs as a flat loop over a column and adds into the
+// score column of its option. Buffers only grow when rows are added, not per evaluation.
+class UtilityScorer
+{
+public:
+  UtilityScorer();
+  ~UtilityScorer();
+  UtilityScorer(const UtilityScorer &) = delete;
+  UtilityScorer &operator=(const UtilityScorer &) = delete;
+
+  // options are set by the first selector using the scorer, the rest must match.
+  // Unbatched scorers are not evaluated per turn, their selectors score options on demand.
+  void setOptions(const std::vector<UtilityOption> &in_options, bool in_batched);
+  size_t numOptions() const { return options.size(); }
+
+  float upperBound(size_t option) const
+  {
+    float res = 0.f;
+    for (const UtilityConsideration &cons : options[option])
+      res += cons.upperBound();
+    return res;
+  }
+
+  float scoreOption(const Blackboard &bb, size_t option) const
+  {
+    float res = 0.f;
+    for (const UtilityConsideration &cons : options[option])
+      res += cons.evaluate(bb);
+    return res;
+  }
+
+  size_t addRow(flecs::entity entity);
+  void removeRow(size_t row);
+
+  // as of the last evaluate()
+  float score(size_t row, size_t option) const { return scores[option * capacity + row]; }
+
+  void evaluate();
+
+private:
+  void reserve(size_t num_rows);
+
+  std::vector<UtilityOption> options;
+  bool batched = true;
+  std::vector<size_t> inputKeys; // distinct inputs, considerations refer to their columns
+  std::vector<std::vector<size_t>> inputColumns; // per option, per consideration
+  std::vector<flecs::entity> rows;
+  std::vector<size_t> freeRows;
+  size_t capacity = 0;
+  std::vector<float> inputs; // [input][row]
+  std::vector<float> scores; // [option][row]
+};
+
+// runs the batch of every scorer, after sensors have filled blackboards for this turn
+void evaluate_utility_scorers();
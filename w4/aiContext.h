@@ -0,0 +1,40 @@
+#pragma once
+
+struct TurnCounter;
+struct ActionLog;
+struct DungeonData;
+struct DijkstraMapData;
+class SpatialHash;
+
+// Dijkstra maps built by the dmap pipeline, DmapWeights and the AI context index them by id
+enum DmapId
+{
+  DMAP_APPROACH,
+  DMAP_VISION,
+  DMAP_FLEE,
+  DMAP_ARCHER,
+  DMAP_HIVE,
+  NUM_DMAPS
+};
+
+// name of the entity a map lives on
+inline const char *dmap_name(DmapId id)
+{
+  static const char *names[NUM_DMAPS] = {"approach_map", "vision_map", "flee_map", "archer_map", "hive_map"};
+  return names[id];
+}
+
+// World singletons AI reads every turn, gathered once per turn in process_turn
+// and passed down to states, transitions and behaviour nodes instead of querying them on every call.
+struct AIContext
+{
+  const TurnCounter *turnCounter = nullptr;
+  ActionLog *actionLog = nullptr; // only written outside of the think phase
+  const DungeonData *dungeon = nullptr;
+  const SpatialHash *spatialHash = nullptr;
+
+  // owned by the dmap pipeline, they stay where they are for its whole life
+  const DijkstraMapData *dmaps[NUM_DMAPS] = {};
+
+  const DijkstraMapData *find_dmap(DmapId id) const { return dmaps[id]; }
+};
@@ -4,13 +4,14 @@
 #include "raylib.h"
 #include "math.h"
 #include "aiUtils.h"
+#include "thinkPhase.h"
 
 class AttackEnemyState : public State
 {
 public:
   void enter() const override {}
   void exit() const override {}
-  void act(float/* dt*/, flecs::world &/*ecs*/, flecs::entity /*entity*/) const override {}
+  void act(float/* dt*/, flecs::world &/*ecs*/, flecs::entity /*entity*/, const AIContext &/*ctx*/) const override {}
 };
 
 class MoveToEnemyState : public State
@@ -18,9 +19,9 @@ class MoveToEnemyState : public State
 public:
   void enter() const override {}
   void exit() const override {}
-  void act(float/* dt*/, flecs::world &ecs, flecs::entity entity) const override
+  void act(float/* dt*/, flecs::world &ecs, flecs::entity entity, const AIContext &ctx) const override
   {
-    on_closest_enemy_pos(ecs, entity, [&](Action &a, const Position &pos, const Position &enemy_pos)
+    on_closest_enemy_pos(ctx, entity, [&](Action &a, const Position &pos, const Position &enemy_pos)
     {
       a.action = move_towards(pos, enemy_pos);
     });
@@ -33,9 +34,9 @@ public:
   FleeFromEnemyState() {}
   void enter() const override {}
   void exit() const override {}
-  void act(float/* dt*/, flecs::world &ecs, flecs::entity entity) const override
+  void act(float/* dt*/, flecs::world &ecs, flecs::entity entity, const AIContext &ctx) const override
   {
-    on_closest_enemy_pos(ecs, entity, [&](Action &a, const Position &pos, const Position &enemy_pos)
+    on_closest_enemy_pos(ctx, entity, [&](Action &a, const Position &pos, const Position &enemy_pos)
     {
       a.action = inverse_move(move_towards(pos, enemy_pos));
     });
@@ -49,7 +50,7 @@ public:
   PatrolState(float dist) : patrolDist(dist) {}
   void enter() const override {}
   void exit() const override {}
-  void act(float/* dt*/, flecs::world &, flecs::entity entity) const override
+  void act(float/* dt*/, flecs::world &, flecs::entity entity, const AIContext &/*ctx*/) const override
   {
     entity.set([&](const Position &pos, const PatrolPos &ppos, Action &a)
     {
@@ -58,7 +59,7 @@ public:
       else
       {
         // do a random walk
-        a.action = GetRandomValue(EA_MOVE_START, EA_MOVE_END - 1);
+        a.action = think_random_value(EA_MOVE_START, EA_MOVE_END - 1);
       }
     });
   }
@@ -69,7 +70,7 @@ class NopState : public State
 public:
   void enter() const override {}
   void exit() const override {}
-  void act(float/* dt*/, flecs::world &, flecs::entity) const override {}
+  void act(float/* dt*/, flecs::world &, flecs::entity, const AIContext &/*ctx*/) const override {}
 };
 
 class EnemyAvailableTransition : public StateTransition
@@ -77,20 +78,19 @@ class EnemyAvailableTransition : public StateTransition
   float triggerDist;
 public:
   EnemyAvailableTransition(float in_dist) : triggerDist(in_dist) {}
-  bool isAvailable(flecs::world &ecs, flecs::entity entity) const override
+  bool isAvailable(flecs::world &ecs, flecs::entity entity, const AIContext &ctx) const override
   {
-    static auto enemiesQuery = ecs.query<const Position, const Team>();
     bool enemiesFound = false;
-    entity.get([&](const Position &pos, const Team &t)
+    if (ctx.spatialHash)
     {
-      enemiesQuery.each([&](const Position &epos, const Team &et)
+      const SpatialHash &hash = *ctx.spatialHash;
+      entity.get([&](const Position &pos, const Team &t)
       {
-        if (t.team == et.team)
-          return;
-        float curDist = dist(epos, pos);
-        enemiesFound |= curDist <= triggerDist;
+        SpatialHash::Neighbour enemy;
+        enemiesFound = hash.nearest(pos, [&](int team) { return team != t.team; }, enemy) &&
+                       enemy.dist <= triggerDist;
       });
-    });
+    }
     return enemiesFound;
   }
 };
@@ -100,7 +100,7 @@ class HitpointsLessThanTransition : public StateTransition
   float threshold;
 public:
   HitpointsLessThanTransition(float in_thres) : threshold(in_thres) {}
-  bool isAvailable(flecs::world &, flecs::entity entity) const override
+  bool isAvailable(flecs::world &, flecs::entity entity, const AIContext &/*ctx*/) const override
   {
     bool hitpointsThresholdReached = false;
     entity.get([&](const Hitpoints &hp)
@@ -114,7 +114,7 @@ public:
 class EnemyReachableTransition : public StateTransition
 {
 public:
-  bool isAvailable(flecs::world &, flecs::entity) const override
+  bool isAvailable(flecs::world &, flecs::entity, const AIContext &/*ctx*/) const override
   {
     return false;
   }
@@ -127,9 +127,9 @@ public:
   NegateTransition(const StateTransition *in_trans) : transition(in_trans) {}
   ~NegateTransition() override { delete transition; }
 
-  bool isAvailable(flecs::world &ecs, flecs::entity entity) const override
+  bool isAvailable(flecs::world &ecs, flecs::entity entity, const AIContext &ctx) const override
   {
-    return !transition->isAvailable(ecs, entity);
+    return !transition->isAvailable(ecs, entity, ctx);
   }
 };
 
@@ -145,9 +145,9 @@ public:
     delete rhs;
   }
 
-  bool isAvailable(flecs::world &ecs, flecs::entity entity) const override
+  bool isAvailable(flecs::world &ecs, flecs::entity entity, const AIContext &ctx) const override
   {
-    return lhs->isAvailable(ecs, entity) && rhs->isAvailable(ecs, entity);
+    return lhs->isAvailable(ecs, entity, ctx) && rhs->isAvailable(ecs, entity, ctx);
   }
 };
 
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <flecs.h>
+#include "aiContext.h"
 #include <memory>
 #include "blackboard.h"
 
@@ -14,7 +15,7 @@ enum BehResult
 struct BehNode
 {
   virtual ~BehNode() {}
-  virtual BehResult update(flecs::world &ecs, flecs::entity entity, Blackboard &bb) = 0;
+  virtual BehResult update(flecs::world &ecs, flecs::entity entity, Blackboard &bb, const AIContext &ctx) = 0;
 };
 
 struct BehaviourTree
@@ -32,9 +33,9 @@ struct BehaviourTree
 
   ~BehaviourTree() = default;
 
-  void update(flecs::world &ecs, flecs::entity entity, Blackboard &bb)
+  void update(flecs::world &ecs, flecs::entity entity, Blackboard &bb, const AIContext &ctx)
   {
-    root->update(ecs, entity, bb);
+    root->update(ecs, entity, bb, ctx);
   }
 };
 
@@ -0,0 +1,286 @@
+#pragma once
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstdint>
+#include <functional>
+#include <utility>
+#include <vector>
+#include "ecsTypes.h"
+#include "dungeonUtils.h"
+
+// Dijkstra map flood fill over the floor tiles of a dungeon, 4-connected.
+// The algorithm is picked at compile time by the cost model of the cost functor:
+//  - Unit: every step costs 1, a plain BFS over a ring buffer
+//  - SmallInt: every step costs an integer in [1, max_step], Dial's bucket queue
+//  - General: anything else, a binary heap
+// Seeds that aren't whole steps apart can't be bucketed, those floods fall back to the heap.
+// Cost functors are called as cost(from_x, from_y, from_val, to_x, to_y) and return the value of `to`.
+// Their call is a template parameter so it inlines into the loop.
+namespace dmaps
+{
+  constexpr float invalid_tile_value = 1e5f; // unreachable tiles
+
+  enum class CostModel
+  {
+    Unit,
+    SmallInt,
+    General
+  };
+
+  struct UnitCost
+  {
+    static constexpr CostModel model = CostModel::Unit;
+    static constexpr int max_step = 1;
+    float operator()(int, int, float val, int, int) const { return val + 1.f; }
+  };
+
+  // wraps any callable, e.g. a lambda reading other tiles of the map being built
+  template<typename Callable>
+  struct GeneralCost
+  {
+    static constexpr CostModel model = CostModel::General;
+    Callable func;
+    float operator()(int from_x, int from_y, float val, int to_x, int to_y) const
+    {
+      return func(from_x, from_y, val, to_x, to_y);
+    }
+  };
+
+  template<typename Callable>
+  GeneralCost<Callable> general_cost(Callable func) { return GeneralCost<Callable>{func}; }
+
+  struct DmapSeed
+  {
+    size_t idx; // y * width + x
+    float value = 0.f;
+  };
+
+  // Buffers of the flood fill, kept between calls so a flood allocates nothing once they've grown.
+  // One scratch can't be used by two floods at the same time.
+  struct DijkstraScratch
+  {
+    std::vector<uint32_t> ring;
+    std::vector<std::vector<uint32_t>> buckets;
+    std::vector<DmapSeed> seeds;
+    std::vector<std::pair<float, uint32_t>> heap;
+    std::vector<uint32_t> settled; // heap only, tile is settled if it holds the current stamp
+    uint32_t stamp = 0;
+  };
+
+  template<typename Visit>
+  inline void for_each_floor_neighbour(const DungeonData &dd, size_t x, size_t y, Visit visit)
+  {
+    const size_t idx = y * dd.width + x;
+    if (x > 0 && dd.tiles[idx - 1] == dungeon::floor)
+      visit(x - 1, y, idx - 1);
+    if (x + 1 < dd.width && dd.tiles[idx + 1] == dungeon::floor)
+      visit(x + 1, y, idx + 1);
+    if (y > 0 && dd.tiles[idx - dd.width] == dungeon::floor)
+      visit(x, y - 1, idx - dd.width);
+    if (y + 1 < dd.height && dd.tiles[idx + dd.width] == dungeon::floor)
+      visit(x, y + 1, idx + dd.width);
+  }
+
+  struct NoLowerObserver
+  {
+    void operator()(size_t, float) const {}
+  };
+
+  namespace detail
+  {
+    // unit costs from seeds of the same value, the first time a tile is reached is the shortest,
+    // so every tile is queued at most once and the ring never holds more than all tiles
+    template<typename Cost, typename OnLower>
+    void flood_bfs(std::vector<float> &map, const DungeonData &dd, const DmapSeed *seeds, size_t num_seeds,
+                   const Cost &cost, DijkstraScratch &scratch, const OnLower &on_lower)
+    {
+      size_t capacity = 1;
+      while (capacity < map.size() + 1)
+        capacity <<= 1;
+      if (scratch.ring.size() < capacity)
+        scratch.ring.resize(capacity);
+      const size_t mask = scratch.ring.size() - 1;
+      uint32_t *ring = scratch.ring.data();
+      size_t head = 0;
+      size_t tail = 0;
+
+      for (size_t i = 0; i < num_seeds; ++i)
+        if (seeds[i].value < map[seeds[i].idx])
+        {
+          on_lower(seeds[i].idx, map[seeds[i].idx]);
+          map[seeds[i].idx] = seeds[i].value;
+          ring[tail++ & mask] = uint32_t(seeds[i].idx);
+        }
+
+      while (head != tail)
+      {
+        const size_t idx = ring[head++ & mask];
+        const size_t x = idx % dd.width;
+        const size_t y = idx / dd.width;
+        const float curVal = map[idx];
+        for_each_floor_neighbour(dd, x, y, [&](size_t nx, size_t ny, size_t nidx)
+        {
+          const float val = cost(int(x), int(y), curVal, int(nx), int(ny));
+          if (val < map[nidx])
+          {
+            on_lower(nidx, map[nidx]);
+            map[nidx] = val;
+            ring[tail++ & mask] = uint32_t(nidx);
+          }
+        });
+      }
+    }
+
+    // integer steps of at most max_step: pending tiles are always within max_step levels of the
+    // current one, so max_step + 1 buckets used as a ring are enough. Seeds are sorted and enter
+    // when the sweep reaches their level, their values must be whole steps apart.
+    template<typename Cost, typename OnLower>
+    void flood_dial(std::vector<float> &map, const DungeonData &dd, const DmapSeed *seeds, size_t num_seeds,
+                    const Cost &cost, DijkstraScratch &scratch, const OnLower &on_lower)
+    {
+      constexpr size_t num_buckets = size_t(Cost::max_step) + 1;
+      if (scratch.buckets.size() < num_buckets)
+        scratch.buckets.resize(num_buckets);
+      for (std::vector<uint32_t> &bucket : scratch.buckets)
+        bucket.clear();
+      scratch.seeds.assign(seeds, seeds + num_seeds);
+      std::sort(scratch.seeds.begin(), scratch.seeds.end(),
+                [](const DmapSeed &lhs, const DmapSeed &rhs) { return lhs.value < rhs.value; });
+
+      const float base = scratch.seeds.front().value;
+      auto levelOf = [&](float val) { return int64_t(val - base + 0.5f); };
+      size_t nextSeed = 0;
+      size_t pending = 0;
+      for (int64_t level = 0; pending > 0 || nextSeed < num_seeds; ++level)
+      {
+        if (pending == 0)
+          level = levelOf(scratch.seeds[nextSeed].value);
+        std::vector<uint32_t> &bucket = scratch.buckets[size_t(level) % num_buckets];
+        for (; nextSeed < num_seeds && levelOf(scratch.seeds[nextSeed].value) <= level; ++nextSeed)
+        {
+          const DmapSeed &seed = scratch.seeds[nextSeed];
+          assert(float(levelOf(seed.value)) + base == seed.value && "seeds must be whole steps apart");
+          if (seed.value < map[seed.idx])
+          {
+            on_lower(seed.idx, map[seed.idx]);
+            map[seed.idx] = seed.value;
+            bucket.push_back(uint32_t(seed.idx));
+            pending++;
+          }
+        }
+
+        const float levelVal = base + float(level);
+        // steps are at least 1, so nothing is pushed into the bucket being processed
+        for (size_t i = 0; i < bucket.size(); ++i)
+        {
+          const size_t idx = bucket[i];
+          if (map[idx] != levelVal) // improved after it was queued
+            continue;
+          const size_t x = idx % dd.width;
+          const size_t y = idx / dd.width;
+          for_each_floor_neighbour(dd, x, y, [&](size_t nx, size_t ny, size_t nidx)
+          {
+            const float val = cost(int(x), int(y), levelVal, int(nx), int(ny));
+            if (val < map[nidx])
+            {
+              const int64_t valLevel = levelOf(val);
+              assert(valLevel > level && valLevel - level <= Cost::max_step && "step is out of the cost model");
+              on_lower(nidx, map[nidx]);
+              map[nidx] = val;
+              scratch.buckets[size_t(valLevel) % num_buckets].push_back(uint32_t(nidx));
+              pending++;
+            }
+          });
+        }
+        pending -= bucket.size();
+        bucket.clear();
+      }
+    }
+
+    template<typename Cost, typename OnLower>
+    void flood_heap(std::vector<float> &map, const DungeonData &dd, const DmapSeed *seeds, size_t num_seeds,
+                    const Cost &cost, DijkstraScratch &scratch, const OnLower &on_lower)
+    {
+      using HeapEntry = std::pair<float, uint32_t>;
+      std::vector<HeapEntry> &heap = scratch.heap;
+      const std::greater<HeapEntry> cmp;
+      if (scratch.settled.size() != map.size() || ++scratch.stamp == 0)
+      {
+        scratch.settled.assign(map.size(), 0);
+        scratch.stamp = 1;
+      }
+      std::vector<uint32_t> &settled = scratch.settled;
+      const uint32_t stamp = scratch.stamp;
+
+      heap.clear();
+      for (size_t i = 0; i < num_seeds; ++i)
+        if (seeds[i].value < map[seeds[i].idx])
+        {
+          on_lower(seeds[i].idx, map[seeds[i].idx]);
+          map[seeds[i].idx] = seeds[i].value;
+          heap.push_back({seeds[i].value, uint32_t(seeds[i].idx)});
+        }
+      std::make_heap(heap.begin(), heap.end(), cmp);
+
+      while (!heap.empty())
+      {
+        std::pop_heap(heap.begin(), heap.end(), cmp);
+        const auto [curVal, idx] = heap.back();
+        heap.pop_back();
+        if (settled[idx] == stamp)
+          continue;
+        settled[idx] = stamp;
+
+        const size_t x = idx % dd.width;
+        const size_t y = idx / dd.width;
+        for_each_floor_neighbour(dd, x, y, [&](size_t nx, size_t ny, size_t nidx)
+        {
+          if (settled[nidx] == stamp)
+            return;
+          const float val = cost(int(x), int(y), curVal, int(nx), int(ny));
+          if (val < map[nidx])
+          {
+            on_lower(nidx, map[nidx]);
+            map[nidx] = val;
+            heap.push_back({val, uint32_t(nidx)});
+            std::push_heap(heap.begin(), heap.end(), cmp);
+          }
+        });
+      }
+    }
+  };
+
+  // Lowers map values reachable from the seeds, tiles already lower than what the seeds give are kept.
+  // on_lower(idx, old_value) is called before every write. map has to be dd.width * dd.height.
+  template<typename Cost, typename OnLower = NoLowerObserver>
+  void flood(std::vector<float> &map, const DungeonData &dd, const DmapSeed *seeds, size_t num_seeds,
+             const Cost &cost, DijkstraScratch &scratch, const OnLower &on_lower = OnLower())
+  {
+    if (num_seeds == 0)
+      return;
+    if constexpr (Cost::model == CostModel::General)
+      detail::flood_heap(map, dd, seeds, num_seeds, cost, scratch, on_lower);
+    else
+    {
+      const float first = seeds[0].value;
+      const bool sameSeeds = std::all_of(seeds, seeds + num_seeds,
+                                         [&](const DmapSeed &seed) { return seed.value == first; });
+      // bucket levels are whole steps from the lowest seed
+      const bool wholeSteps = std::all_of(seeds, seeds + num_seeds,
+                                          [&](const DmapSeed &seed) { return std::floor(seed.value - first) == seed.value - first; });
+      if (Cost::model == CostModel::Unit && sameSeeds)
+        detail::flood_bfs(map, dd, seeds, num_seeds, cost, scratch, on_lower);
+      else if (wholeSteps)
+        detail::flood_dial(map, dd, seeds, num_seeds, cost, scratch, on_lower);
+      else
+        detail::flood_heap(map, dd, seeds, num_seeds, cost, scratch, on_lower);
+    }
+  }
+
+  template<typename Cost>
+  void flood(std::vector<float> &map, const DungeonData &dd, DmapSeed seed, const Cost &cost, DijkstraScratch &scratch)
+  {
+    flood(map, dd, &seed, 1, cost, scratch);
+  }
+};
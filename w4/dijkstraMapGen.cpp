@@ -1,11 +1,9 @@
 #include "dijkstraMapGen.h"
 #include "ecsTypes.h"
 #include "dungeonUtils.h"
-#include <queue>
+#include "dijkstraEngine.h"
+#include "dijkstraSweep.h"
 #include <cmath>
-#include <functional>
-
-using dijkstra_tail = std::pair<float, std::pair<size_t, size_t>>;
 
 template<typename Callable>
 static void query_dungeon_data(flecs::world &ecs, Callable c)
@@ -23,7 +21,7 @@ static void query_characters_positions(flecs::world &ecs, Callable c)
   characterPositionQuery.each(c);
 }
 
-constexpr float invalid_tile_value = 1e5f;
+using dmaps::invalid_tile_value;
 
 static void init_tiles(std::vector<float> &map, const DungeonData &dd)
 {
@@ -32,191 +30,130 @@ static void init_tiles(std::vector<float> &map, const DungeonData &dd)
     v = invalid_tile_value;
 }
 
-// scan version, could be implemented as Dijkstra version as well
-static void process_dmap(std::vector<float> &map, const DungeonData &dd)
+// each map is generated by one thread at a time, buffers are reused by the next maps of that thread
+static dmaps::DijkstraScratch &flood_scratch()
 {
-  bool done = false;
-  auto getMapAt = [&](size_t x, size_t y, float def)
-  {
-    if (x < dd.width && y < dd.width && dd.tiles[y * dd.width + x] == dungeon::floor)
-      return map[y * dd.width + x];
-    return def;
-  };
-  auto getMinNei = [&](size_t x, size_t y)
+  static thread_local dmaps::DijkstraScratch scratch;
+  return scratch;
+}
+
+static dmaps::SweepScratch &sweep_scratch()
+{
+  static thread_local dmaps::SweepScratch scratch;
+  return scratch;
+}
+
+// sources gathered from the world for one map at a time, per thread like the flood scratch
+static std::vector<dmaps::DmapSeed> &sources_scratch()
+{
+  static thread_local std::vector<dmaps::DmapSeed> sources;
+  return sources;
+}
+
+void dmaps::gather_team_sources(flecs::world &ecs, const DungeonData &dd, int team, std::vector<DmapSeed> &sources)
+{
+  sources.clear();
+  query_characters_positions(ecs, [&](const Position &pos, const Team &t)
   {
-    float val = map[y * dd.width + x];
-    val = std::min(val, getMapAt(x - 1, y + 0, val));
-    val = std::min(val, getMapAt(x + 1, y + 0, val));
-    val = std::min(val, getMapAt(x + 0, y - 1, val));
-    val = std::min(val, getMapAt(x + 0, y + 1, val));
-    return val;
-  };
-  while (!done)
+    if (t.team == team)
+      sources.push_back(DmapSeed{size_t(pos.y) * dd.width + size_t(pos.x)});
+  });
+}
+
+void dmaps::gather_hive_sources(flecs::world &ecs, const DungeonData &dd, std::vector<DmapSeed> &sources)
+{
+  static auto hiveQuery = ecs.query<const Position, const Hive>();
+  sources.clear();
+  hiveQuery.each([&](const Position &pos, const Hive &)
   {
-    done = true;
-    for (size_t y = 0; y < dd.height; ++y)
-      for (size_t x = 0; x < dd.width; ++x)
-      {
-        const size_t i = y * dd.width + x;
-        if (dd.tiles[i] != dungeon::floor)
-          continue;
-        const float myVal = getMapAt(x, y, invalid_tile_value);
-        const float minVal = getMinNei(x, y);
-        if (minVal < myVal - 1.f)
-        {
-          map[i] = minVal + 1.f;
-          done = false;
-        }
-      }
-  }
+    sources.push_back(DmapSeed{size_t(pos.y) * dd.width + size_t(pos.x)});
+  });
 }
 
-float linear_update(int, int, float val, int, int) {
-  return val + 1;
+void dmaps::gen_source_map(const DungeonData &dd, const std::vector<DmapSeed> &sources, std::vector<float> &map)
+{
+  init_tiles(map, dd);
+  flood_uniform(map, dd, sources.data(), sources.size(), flood_scratch(), sweep_scratch());
 }
 
-static void update_map(std::vector<float> &map, const DungeonData &dd, size_t x, size_t y, 
-                       std::function<float(int, int, float, int, int)> neigh_map = linear_update) {
-  //dijkstra
-  std::priority_queue<dijkstra_tail, std::vector<dijkstra_tail>, std::greater<dijkstra_tail>> queue;
-  std::vector<bool> visited(map.size(), false);
-  queue.push({0., {x, y}});
+void dmaps::gen_player_approach_map(flecs::world &ecs, std::vector<float> &map)
+{
+  query_dungeon_data(ecs, [&](const DungeonData &dd)
+  {
+    gather_team_sources(ecs, dd, 0, sources_scratch()); // player team hardcode
+    gen_source_map(dd, sources_scratch(), map);
+  });
+}
 
-  while (!queue.empty()) 
+void dmaps::gen_vision_map(const DungeonData &dd, const std::vector<DmapSeed> &sources, std::vector<float> &map)
+{
+  init_tiles(map, dd);
+  for (const DmapSeed &seed : sources)
   {
-    auto [cur_map, position] = queue.top();
-    auto [cur_x, cur_y] = position;
-    queue.pop();
-
-    if (visited[cur_y * dd.width + cur_x])
-      continue;
-    
-    visited[cur_y * dd.width + cur_x] = true;
-    map[cur_y * dd.width + cur_x] = cur_map;
-
-    if (cur_x > 0 && 
-        !visited[cur_y * dd.width + (cur_x - 1)] && 
-        dd.tiles[cur_y * dd.width + (cur_x - 1)] == dungeon::floor) {
-      float val = neigh_map(cur_x, cur_y, cur_map, cur_x - 1, cur_y);
-      if (map[cur_y * dd.width + cur_x - 1] > val) {
-        map[cur_y * dd.width + cur_x - 1] = val;  
-        queue.push({val, {cur_x - 1, cur_y}});
-      }
-    }
-
-    if (cur_x < dd.width - 1 && 
-        !visited[cur_y * dd.width + (cur_x + 1)] &&
-        dd.tiles[cur_y * dd.width + (cur_x + 1)] == dungeon::floor) {
-      float val = neigh_map(cur_x, cur_y, cur_map, cur_x + 1, cur_y);
-      if (map[cur_y * dd.width + cur_x + 1] > val) {
-        map[cur_y * dd.width + cur_x + 1] = val;  
-        queue.push({val, {cur_x + 1, cur_y}});
+    const Position pos{int(seed.idx % dd.width), int(seed.idx / dd.width)};
+    flood(map, dd, seed, general_cost([&](int /*prev_x*/, int /*prev_y*/, float /*val*/, int new_x, int new_y) {
+      float dir_x = 2 * (pos.x > new_x) - 1;
+      float dir_y = 2 * (pos.y > new_y) - 1;
+      float new_val = 0;
+      if (abs(pos.x - new_x) > abs(pos.y - new_y)) {
+        new_val = map[new_y * dd.width + (new_x + dir_x)] + 1 + 
+                  (dd.tiles[pos.y * dd.width + (pos.x - dir_x)] == dungeon::wall) * invalid_tile_value;
       }
-    }
-
-    if (cur_y > 0 && 
-        !visited[(cur_y - 1) * dd.width + cur_x] &&
-        dd.tiles[(cur_y - 1) * dd.width + cur_x] == dungeon::floor) {
-      float val = neigh_map(cur_x, cur_y, cur_map, cur_x, cur_y - 1);
-      if (map[(cur_y - 1) * dd.width + cur_x] > val) {
-        map[(cur_y - 1) * dd.width + cur_x] = val;  
-        queue.push({val, {cur_x, cur_y - 1}});
+      else if (abs(pos.x - new_x) == abs(pos.y - new_y)) {
+        new_val = map[(new_y + dir_y) * dd.width + (new_x + dir_x)] + 2 +
+                  (dd.tiles[(pos.y - dir_y) * dd.width + (pos.x - dir_x)] == dungeon::wall) * invalid_tile_value;
       }
-    }
-
-    if (cur_y < dd.height - 1 && 
-        !visited[(cur_y + 1) * dd.width + cur_x] &&
-        dd.tiles[(cur_y + 1) * dd.width + cur_x] == dungeon::floor) {
-      float val = neigh_map(cur_x, cur_y, cur_map, cur_x, cur_y + 1);
-      if (map[(cur_y + 1) * dd.width + cur_x] > val) {
-        map[(cur_y + 1) * dd.width + cur_x] = val;  
-        queue.push({val, {cur_x, cur_y + 1}});
+      else {
+        new_val = map[(new_y + dir_y) * dd.width + new_x] + 1 +
+                  (dd.tiles[(pos.y - dir_y) * dd.width + pos.x] == dungeon::wall) * invalid_tile_value;
       }
-    }
+      return std::min(new_val, invalid_tile_value);
+    }), flood_scratch());
   }
 }
 
-void dmaps::gen_player_approach_map(flecs::world &ecs, std::vector<float> &map)
+void dmaps::gen_player_vision_map(flecs::world &ecs, std::vector<float> &map)
 {
   query_dungeon_data(ecs, [&](const DungeonData &dd)
   {
-    init_tiles(map, dd);
-    query_characters_positions(ecs, [&](const Position &pos, const Team &t)
-    {
-      if (t.team == 0) // player team hardcode
-      {
-        map[pos.y * dd.width + pos.x] = 0.f;
-        update_map(map, dd, pos.x, pos.y, linear_update);
-      }
-    });
+    gather_team_sources(ecs, dd, 0, sources_scratch()); // player team hardcode
+    gen_vision_map(dd, sources_scratch(), map);
   });
 }
 
-void dmaps::gen_player_vision_map(flecs::world &ecs, std::vector<float> &map)
+float dmaps::flee_value(float approach)
 {
-  query_dungeon_data(ecs, [&](const DungeonData &dd)
-  {
-    init_tiles(map, dd);
-    query_characters_positions(ecs, [&](const Position &pos, const Team &t)
-    {
-      if (t.team == 0) // player team hardcode
-      {
-        map[pos.y * dd.width + pos.x] = 0.f;
-        update_map(map, dd, pos.x, pos.y, 
-        [&](int /*prev_x*/, int /*prev_y*/, float /*val*/, int new_x, int new_y) {
-          float dir_x = 2 * (pos.x > new_x) - 1;
-          float dir_y = 2 * (pos.y > new_y) - 1;
-          float new_val = 0;
-          if (abs(pos.x - new_x) > abs(pos.y - new_y)) {
-            new_val = map[new_y * dd.width + (new_x + dir_x)] + 1 + 
-                      (dd.tiles[pos.y * dd.width + (pos.x - dir_x)] == dungeon::wall) * invalid_tile_value;
-          }
-          else if (abs(pos.x - new_x) == abs(pos.y - new_y)) {
-            new_val = map[(new_y + dir_y) * dd.width + (new_x + dir_x)] + 2 +
-                      (dd.tiles[(pos.y - dir_y) * dd.width + (pos.x - dir_x)] == dungeon::wall) * invalid_tile_value;
-          }
-          else {
-            new_val = map[(new_y + dir_y) * dd.width + new_x] + 1 +
-                      (dd.tiles[(pos.y - dir_y) * dd.width + pos.x] == dungeon::wall) * invalid_tile_value;
-          }
-          return std::min(new_val, invalid_tile_value);
-        });
-      }
-    });
-  });
+  return approach < invalid_tile_value ? approach * -1.2f : approach;
+}
+
+float dmaps::archer_value(float approach)
+{
+  return approach < invalid_tile_value ? std::abs(approach - 4) : approach;// + (v > 4) * 2;
 }
 
 void dmaps::gen_player_flee_map(flecs::world &ecs, std::vector<float> &map)
 {
-  ecs.entity("approach_map").get([&](const DijkstraMapData &dmap) {
-    map = dmap.map;
+  ecs.entity(dmap_name(DMAP_APPROACH)).get([&](const DijkstraMapData &dmap) {
+    map = dmap.map();
   });
   for (float &v : map)
-    if (v < invalid_tile_value)
-      v *= -1.2f;
+    v = flee_value(v);
 }
 
 void dmaps::gen_archer_map(flecs::world &ecs, std::vector<float> &map)
 {
-  ecs.entity("approach_map").get([&](const DijkstraMapData &dmap) {
-    map = dmap.map;
+  ecs.entity(dmap_name(DMAP_APPROACH)).get([&](const DijkstraMapData &dmap) {
+    map = dmap.map();
   });
   for (float &v : map)
-    if (v < invalid_tile_value)
-      v = abs(v - 4);// + (v > 4) * 2;
+    v = archer_value(v);
 }
 
 void dmaps::gen_hive_pack_map(flecs::world &ecs, std::vector<float> &map)
 {
-  static auto hiveQuery = ecs.query<const Position, const Hive>();
   query_dungeon_data(ecs, [&](const DungeonData &dd)
   {
-    init_tiles(map, dd);
-    hiveQuery.each([&](const Position &pos, const Hive &)
-    {
-      map[pos.y * dd.width + pos.x] = 0.f;
-      update_map(map, dd, pos.x, pos.y);
-    });
+    gather_hive_sources(ecs, dd, sources_scratch());
+    gen_source_map(dd, sources_scratch(), map);
   });
 }
-
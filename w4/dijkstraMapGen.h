@@ -1,13 +1,27 @@
 #pragma once
 #include <vector>
 #include <flecs.h>
+#include "dijkstraEngine.h"
 
 namespace dmaps
 {
+  // Floods once from all sources, each starting at its own value, so the cost doesn't grow
+  // with the number of sources. A tile gets the lowest value any source gives it.
+  // Sources which aren't whole steps apart may be swept, see flood_uniform().
+  void gen_source_map(const DungeonData &dd, const std::vector<DmapSeed> &sources, std::vector<float> &map);
+  // how far tiles are from being seen, costs are relative to every source so it floods once per source
+  void gen_vision_map(const DungeonData &dd, const std::vector<DmapSeed> &sources, std::vector<float> &map);
+  // flee and archer maps are made tile by tile from the approach map
+  float flee_value(float approach);
+  float archer_value(float approach);
+
   void gen_player_approach_map(flecs::world &ecs, std::vector<float> &map);
   void gen_player_vision_map(flecs::world &ecs, std::vector<float> &map);
   void gen_player_flee_map(flecs::world &ecs, std::vector<float> &map);
   void gen_archer_map(flecs::world &ecs, std::vector<float> &map);
   void gen_hive_pack_map(flecs::world &ecs, std::vector<float> &map);
-};
 
+  // seeds of value 0 under every character of the team and under hives
+  void gather_team_sources(flecs::world &ecs, const DungeonData &dd, int team, std::vector<DmapSeed> &sources);
+  void gather_hive_sources(flecs::world &ecs, const DungeonData &dd, std::vector<DmapSeed> &sources);
+};
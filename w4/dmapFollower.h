@@ -1,5 +1,6 @@
 #pragma once
 #include <flecs.h>
+#include "aiContext.h"
 
-void process_dmap_followers(flecs::world &ecs);
+void process_dmap_followers(flecs::world &ecs, const AIContext &ctx);
 
@@ -0,0 +1,135 @@
+#include "dmapPipeline.h"
+#include "dijkstraMapGen.h"
+#include <algorithm>
+#include <cstdio>
+
+DmapPipeline::DmapPipeline(int num_threads) : graph(num_threads)
+{
+  for (int id = 0; id < NUM_DMAPS; ++id)
+    maps[id] = DijkstraMapData{&buffers[id]};
+  const size_t approachJob = graph.add([this] { buildApproach(); });
+  graph.add([this] { buildVision(); });
+  graph.add([this] { buildDerived(DMAP_FLEE, flee, dmaps::flee_value); }, {approachJob});
+  graph.add([this] { buildDerived(DMAP_ARCHER, archer, dmaps::archer_value); }, {approachJob});
+  graph.add([this] { buildHive(); });
+}
+
+void DmapPipeline::init(flecs::world &ecs)
+{
+  for (int id = 0; id < NUM_DMAPS; ++id)
+    ecs.entity(dmap_name(DmapId(id)))
+      .set(maps[id]);
+  start(ecs);
+  wait(ecs);
+}
+
+void DmapPipeline::start(flecs::world &ecs)
+{
+  static auto dungeonDataQuery = ecs.query<const DungeonData>();
+  graph.wait();
+  dungeonDataQuery.each([&](const DungeonData &dd)
+  {
+    tilesChanged = dungeon.width != dd.width || dungeon.height != dd.height || dungeon.tiles != dd.tiles;
+    if (tilesChanged)
+    {
+      dungeon.tiles.assign(dd.tiles.begin(), dd.tiles.end());
+      dungeon.width = dd.width;
+      dungeon.height = dd.height;
+    }
+    dmaps::gather_team_sources(ecs, dd, 0, playerSources); // player team hardcode
+    dmaps::gather_hive_sources(ecs, dd, hiveSources);
+  });
+  graph.start();
+}
+
+static size_t count_mismatches(const char *name, const std::vector<float> &published, const std::vector<float> &full)
+{
+  if (published.size() != full.size())
+  {
+    printf("dmap verification: %s has %zu tiles instead of %zu\n", name, published.size(), full.size());
+    return std::max(published.size(), full.size());
+  }
+  size_t mismatches = 0;
+  for (size_t i = 0; i < full.size(); ++i)
+    if (published[i] != full[i])
+    {
+      if (mismatches == 0)
+        printf("dmap verification: %s at tile %zu is %f instead of %f\n", name, i, double(published[i]), double(full[i]));
+      mismatches++;
+    }
+  return mismatches;
+}
+
+void DmapPipeline::wait(flecs::world &ecs)
+{
+  graph.wait();
+  if (!verify)
+    return;
+
+  // derived maps are regenerated from the published approach map
+  std::vector<float> full;
+  dmaps::gen_player_approach_map(ecs, full);
+  verifyMismatches += count_mismatches(dmap_name(DMAP_APPROACH), buffers[DMAP_APPROACH].front(), full);
+  dmaps::gen_player_vision_map(ecs, full);
+  verifyMismatches += count_mismatches(dmap_name(DMAP_VISION), buffers[DMAP_VISION].front(), full);
+  dmaps::gen_player_flee_map(ecs, full);
+  verifyMismatches += count_mismatches(dmap_name(DMAP_FLEE), buffers[DMAP_FLEE].front(), full);
+  dmaps::gen_archer_map(ecs, full);
+  verifyMismatches += count_mismatches(dmap_name(DMAP_ARCHER), buffers[DMAP_ARCHER].front(), full);
+  dmaps::gen_hive_pack_map(ecs, full);
+  verifyMismatches += count_mismatches(dmap_name(DMAP_HIVE), buffers[DMAP_HIVE].front(), full);
+}
+
+void DmapPipeline::publish(DmapId id, const std::vector<float> &map)
+{
+  // the back buffer was the front one before the last publish, so it has the size already
+  buffers[id].back().assign(map.begin(), map.end());
+  buffers[id].publish();
+}
+
+void DmapPipeline::buildApproach()
+{
+  approach.setSources(playerSources);
+  approachChanged = approach.update(dungeon);
+  if (approachChanged)
+    publish(DMAP_APPROACH, approach.getMap());
+}
+
+void DmapPipeline::buildVision()
+{
+  // vision costs depend on where the player stands, so it can't be repaired locally
+  if (!tilesChanged && !vision.empty() && visionSources.size() == playerSources.size() &&
+      std::equal(visionSources.begin(), visionSources.end(), playerSources.begin(),
+                 [](const dmaps::DmapSeed &lhs, const dmaps::DmapSeed &rhs)
+                 {
+                   return lhs.idx == rhs.idx && lhs.value == rhs.value;
+                 }))
+    return;
+  visionSources.assign(playerSources.begin(), playerSources.end());
+  dmaps::gen_vision_map(dungeon, playerSources, vision);
+  publish(DMAP_VISION, vision);
+}
+
+void DmapPipeline::buildDerived(DmapId id, std::vector<float> &map, float (*value)(float))
+{
+  if (!approachChanged)
+    return;
+  const std::vector<float> &approachMap = approach.getMap();
+  if (approach.wasRebuilt() || map.size() != approachMap.size())
+  {
+    map.resize(approachMap.size());
+    for (size_t i = 0; i < map.size(); ++i)
+      map[i] = value(approachMap[i]);
+  }
+  else
+    for (uint32_t idx : approach.getChangedTiles())
+      map[idx] = value(approachMap[idx]);
+  publish(id, map);
+}
+
+void DmapPipeline::buildHive()
+{
+  hive.setSources(hiveSources);
+  if (hive.update(dungeon))
+    publish(DMAP_HIVE, hive.getMap());
+}
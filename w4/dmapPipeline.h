@@ -0,0 +1,67 @@
+#pragma once
+#include <memory>
+#include <vector>
+#include <flecs.h>
+#include "ecsTypes.h"
+#include "dijkstraEngine.h"
+#include "dynamicDmap.h"
+#include "jobGraph.h"
+
+// Builds the dijkstra maps of a turn on worker threads, in the background.
+// start() copies the dungeon and the sources on the calling thread, so jobs never touch the world.
+// Approach, vision and hive maps are built at the same time, flee and archer maps wait for approach.
+// Every map is published to its DmapBuffers as soon as it is done, until then AI and rendering
+// read the previous one. Maps are repaired incrementally where they can be and all buffers
+// keep their size, so nothing is allocated once the first maps are built.
+class DmapPipeline
+{
+public:
+  explicit DmapPipeline(int num_threads);
+
+  // points DijkstraMapData of the map entities to the buffers, builds the first maps and waits for them
+  void init(flecs::world &ecs);
+  void start(flecs::world &ecs);
+  // all maps of the last start() are published after it
+  void wait(flecs::world &ecs);
+
+  // compare every map with a full regeneration in wait(), on the calling thread
+  void setVerify(bool in_verify) { verify = in_verify; }
+  size_t getVerifyMismatches() const { return verifyMismatches; }
+
+  const DijkstraMapData *getMap(DmapId id) const { return &maps[id]; }
+
+private:
+  void publish(DmapId id, const std::vector<float> &map);
+  void buildApproach();
+  void buildVision();
+  void buildDerived(DmapId id, std::vector<float> &map, float (*value)(float));
+  void buildHive();
+
+  DmapBuffers buffers[NUM_DMAPS];
+  DijkstraMapData maps[NUM_DMAPS]; // point to the buffers
+
+  // inputs, written by start() only while no jobs run
+  DungeonData dungeon = {};
+  bool tilesChanged = true;
+  std::vector<dmaps::DmapSeed> playerSources;
+  std::vector<dmaps::DmapSeed> hiveSources;
+
+  DynamicDmap approach;
+  bool approachChanged = false;
+  DynamicDmap hive;
+  std::vector<dmaps::DmapSeed> visionSources; // the vision map was built for
+  std::vector<float> vision;
+  std::vector<float> flee;
+  std::vector<float> archer;
+
+  bool verify = false;
+  size_t verifyMismatches = 0;
+
+  JobGraph graph;
+};
+
+// component of the world entity, the pipeline owns threads so it is shared instead of copied
+struct DmapPipelineRef
+{
+  std::shared_ptr<DmapPipeline> pipeline;
+};
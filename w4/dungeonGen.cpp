@@ -11,6 +11,12 @@
 
 
 void gen_drunk_dungeon(char *tiles, size_t w, size_t h)
+{
+  unsigned seed = unsigned(std::chrono::system_clock::now().time_since_epoch().count() % std::numeric_limits<int>::max());
+  gen_drunk_dungeon(tiles, w, h, seed);
+}
+
+void gen_drunk_dungeon(char *tiles, size_t w, size_t h, unsigned seed)
 {
   //constexpr char wall = '#';
   //constexpr char flr = ' ';
@@ -18,7 +24,6 @@ void gen_drunk_dungeon(char *tiles, size_t w, size_t h)
   memset(tiles, dungeon::wall, w * h);
 
   // generator
-  unsigned seed = unsigned(std::chrono::system_clock::now().time_since_epoch().count() % std::numeric_limits<int>::max());
   std::default_random_engine seedGenerator(seed);
   std::default_random_engine widthGenerator(seedGenerator());
   std::default_random_engine heightGenerator(seedGenerator());
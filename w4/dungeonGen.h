@@ -2,3 +2,4 @@
 #include <cstddef> // size_t
 
 void gen_drunk_dungeon(char *tiles, size_t w, size_t h);
+void gen_drunk_dungeon(char *tiles, size_t w, size_t h, unsigned seed);
@@ -27,11 +27,16 @@ bool dungeon::is_tile_walkable(flecs::world &ecs, Position pos)
   bool res = false;
   dungeonDataQuery.each([&](const DungeonData &dd)
   {
-    if (pos.x < 0 || pos.x >= int(dd.width) ||
-        pos.y < 0 || pos.y >= int(dd.height))
-      return;
-    res = dd.tiles[size_t(pos.y) * dd.width + size_t(pos.x)] == dungeon::floor;
+    res = is_tile_walkable(dd, pos);
   });
   return res;
 }
 
+bool dungeon::is_tile_walkable(const DungeonData &dd, Position pos)
+{
+  if (pos.x < 0 || pos.x >= int(dd.width) ||
+      pos.y < 0 || pos.y >= int(dd.height))
+    return false;
+  return dd.tiles[size_t(pos.y) * dd.width + size_t(pos.x)] == dungeon::floor;
+}
+
@@ -0,0 +1,214 @@
+#include "dynamicDmap.h"
+#include <algorithm>
+#include <cstring>
+#include <functional>
+#include "dungeonUtils.h"
+#include "dijkstraSweep.h"
+
+using dmaps::invalid_tile_value;
+
+void DynamicDmap::setSources(const std::vector<dmaps::DmapSeed> &in_sources)
+{
+  std::vector<dmaps::DmapSeed> &next = nextSources;
+  next.assign(in_sources.begin(), in_sources.end());
+  auto byTile = [](const dmaps::DmapSeed &lhs, const dmaps::DmapSeed &rhs)
+  {
+    return lhs.idx < rhs.idx || (lhs.idx == rhs.idx && lhs.value < rhs.value);
+  };
+  std::sort(next.begin(), next.end(), byTile);
+  // the lowest value wins if several sources share a tile
+  next.erase(std::unique(next.begin(), next.end(),
+                         [](const dmaps::DmapSeed &lhs, const dmaps::DmapSeed &rhs) { return lhs.idx == rhs.idx; }),
+             next.end());
+
+  auto prev = sources.begin();
+  for (const dmaps::DmapSeed &seed : next)
+  {
+    for (; prev != sources.end() && prev->idx < seed.idx; ++prev)
+      clearSeed(prev->idx);
+    if (prev != sources.end() && prev->idx == seed.idx)
+    {
+      if (prev->value != seed.value)
+        setSeed(seed.idx, seed.value);
+      ++prev;
+    }
+    else
+      setSeed(seed.idx, seed.value);
+  }
+  for (; prev != sources.end(); ++prev)
+    clearSeed(prev->idx);
+  std::swap(sources, next);
+}
+
+void DynamicDmap::setSeed(size_t idx, float value)
+{
+  if (idx >= seedValues.size())
+    seedValues.resize(idx + 1, invalid_tile_value);
+  if (seedValues[idx] == value)
+    return;
+  seedValues[idx] = value;
+  dirty.push_back(uint32_t(idx));
+}
+
+void DynamicDmap::clearSeed(size_t idx)
+{
+  setSeed(idx, invalid_tile_value);
+}
+
+void DynamicDmap::clearSeeds()
+{
+  seedValues.clear();
+  sources.clear();
+  dirty.clear();
+  forceRebuild = true;
+}
+
+void DynamicDmap::rebuild(const DungeonData &dd)
+{
+  map.assign(dd.width * dd.height, invalid_tile_value);
+  repairSeeds.clear();
+  for (size_t i = 0; i < map.size(); ++i)
+    if (seedValues[i] < invalid_tile_value)
+      repairSeeds.push_back(dmaps::DmapSeed{i, seedValues[i]});
+  dmaps::flood_uniform(map, dd, repairSeeds.data(), repairSeeds.size(), scratch, sweepScratch);
+  changed.clear();
+  dirty.clear();
+  forceRebuild = false;
+  rebuilt = true;
+}
+
+// some seed or neighbour still gives the tile its current value
+bool DynamicDmap::isSupported(size_t idx) const
+{
+  const float value = map[idx];
+  if (seedValues[idx] == value)
+    return true;
+  if (tiles[idx] != dungeon::floor)
+    return false;
+  const size_t x = idx % width;
+  const size_t y = idx / width;
+  return (x > 0 && map[idx - 1] + 1.f == value) ||
+         (x + 1 < width && map[idx + 1] + 1.f == value) ||
+         (y > 0 && map[idx - width] + 1.f == value) ||
+         (y + 1 < height && map[idx + width] + 1.f == value);
+}
+
+// best value the tile can take from its seed and its neighbours as they are now
+float DynamicDmap::repairValue(size_t idx) const
+{
+  float value = seedValues[idx];
+  if (tiles[idx] != dungeon::floor)
+    return value;
+  const size_t x = idx % width;
+  const size_t y = idx / width;
+  if (x > 0)
+    value = std::min(value, map[idx - 1] + 1.f);
+  if (x + 1 < width)
+    value = std::min(value, map[idx + 1] + 1.f);
+  if (y > 0)
+    value = std::min(value, map[idx - width] + 1.f);
+  if (y + 1 < height)
+    value = std::min(value, map[idx + width] + 1.f);
+  return value;
+}
+
+void DynamicDmap::touch(size_t idx, float old_value)
+{
+  if (touchStamps[idx] == stamp)
+    return;
+  touchStamps[idx] = stamp;
+  touched.emplace_back(uint32_t(idx), old_value);
+}
+
+bool DynamicDmap::update(const DungeonData &dd)
+{
+  rebuilt = false;
+  changed.clear();
+  const size_t numTiles = dd.width * dd.height;
+  seedValues.resize(std::max(seedValues.size(), numTiles), invalid_tile_value);
+  if (forceRebuild || width != dd.width || height != dd.height)
+  {
+    width = dd.width;
+    height = dd.height;
+    tiles = dd.tiles;
+    rebuild(dd);
+    return true;
+  }
+
+  if (memcmp(tiles.data(), dd.tiles.data(), numTiles) != 0)
+    for (size_t i = 0; i < numTiles; ++i)
+      if (tiles[i] != dd.tiles[i])
+      {
+        tiles[i] = dd.tiles[i];
+        dirty.push_back(uint32_t(i));
+      }
+  if (dirty.empty())
+    return false;
+
+  touchStamps.resize(numTiles, 0);
+  if (++stamp == 0)
+  {
+    std::fill(touchStamps.begin(), touchStamps.end(), 0);
+    stamp = 1;
+  }
+  touched.clear();
+
+  // tiles lose their value in increasing value order, so when one is checked, all tiles
+  // it could lean on were already checked and invalidated if they had to be
+  const std::greater<std::pair<float, uint32_t>> cmp;
+  raiseHeap.clear();
+  for (uint32_t idx : dirty)
+    if (map[idx] < invalid_tile_value)
+      raiseHeap.emplace_back(map[idx], idx);
+  std::make_heap(raiseHeap.begin(), raiseHeap.end(), cmp);
+  invalidated.clear();
+  while (!raiseHeap.empty())
+  {
+    std::pop_heap(raiseHeap.begin(), raiseHeap.end(), cmp);
+    const auto [value, idx] = raiseHeap.back();
+    raiseHeap.pop_back();
+    if (map[idx] != value || isSupported(idx))
+      continue;
+    touch(idx, value);
+    map[idx] = invalid_tile_value;
+    invalidated.push_back(idx);
+    if (invalidated.size() > numTiles / 2)
+    {
+      rebuild(dd);
+      return true;
+    }
+
+    // neighbours which could have got their value through this tile
+    const size_t x = idx % width;
+    const size_t y = idx / width;
+    dmaps::for_each_floor_neighbour(dd, x, y, [&](size_t, size_t, size_t nidx)
+    {
+      if (map[nidx] == value + 1.f)
+      {
+        raiseHeap.emplace_back(map[nidx], uint32_t(nidx));
+        std::push_heap(raiseHeap.begin(), raiseHeap.end(), cmp);
+      }
+    });
+  }
+
+  // flood the holes back from what is left around them and from the lowered seeds
+  repairSeeds.clear();
+  auto addRepairSeed = [&](size_t idx)
+  {
+    const float value = repairValue(idx);
+    if (value < map[idx])
+      repairSeeds.push_back(dmaps::DmapSeed{idx, value});
+  };
+  for (uint32_t idx : invalidated)
+    addRepairSeed(idx);
+  for (uint32_t idx : dirty)
+    addRepairSeed(idx);
+  dmaps::flood(map, dd, repairSeeds.data(), repairSeeds.size(), dmaps::UnitCost{}, scratch,
+               [&](size_t idx, float old_value) { touch(idx, old_value); });
+  dirty.clear();
+
+  for (const auto &[idx, oldValue] : touched)
+    if (map[idx] != oldValue)
+      changed.push_back(idx);
+  return !changed.empty();
+}
@@ -1,10 +1,13 @@
 #pragma once
 
+#include <atomic>
+#include <cstdint>
 #include <string>
 #include <vector>
 #include <unordered_map>
 #include <functional>
 #include <flecs.h>
+#include "aiContext.h"
 
 // TODO: make a lot of seprate files
 struct Position;
@@ -138,6 +141,17 @@ struct TurnCounter
   int count = 0;
 };
 
+// wall time spent in process_turn phases, in seconds, accumulated over all turns
+struct TurnTimings
+{
+  int turns = 0;
+  double sensors = 0.0;
+  double think = 0.0;
+  double followers = 0.0;
+  double actions = 0.0;
+  double dmaps = 0.0;
+};
+
 struct ActionLog
 {
   std::vector<std::string> log;
@@ -153,9 +167,40 @@ struct DungeonData
   size_t height;
 };
 
+// who stands on which tile (by MovePos) and what lies there, lives next to DungeonData
+struct DungeonOccupancy
+{
+  // hp points into the Hitpoints column, valid while the actions of a turn are processed
+  struct Occupant
+  {
+    flecs::entity entity;
+    Hitpoints *hp = nullptr;
+    int team = 0;
+  };
+  std::vector<std::vector<Occupant>> occupants; // several entities can share a tile
+  std::vector<std::vector<flecs::entity>> items;
+  std::vector<size_t> usedTiles; // to clean up only touched tiles on rebuild
+};
+
+// Map built on a worker thread while everyone reads the previous one: the new map is written
+// to back() and publish() swaps the buffers. They keep their size, so rebuilding doesn't allocate.
+class DmapBuffers
+{
+public:
+  const std::vector<float> &front() const { return buffers[frontIdx.load(std::memory_order_acquire)]; }
+  std::vector<float> &back() { return buffers[1 - frontIdx.load(std::memory_order_relaxed)]; }
+  void publish() { frontIdx.store(1 - frontIdx.load(std::memory_order_relaxed), std::memory_order_release); }
+
+private:
+  std::vector<float> buffers[2];
+  std::atomic<uint32_t> frontIdx = 0;
+};
+
 struct DijkstraMapData
 {
-  std::vector<float> map;
+  const DmapBuffers *buffers = nullptr; // owned by the dmap pipeline
+
+  const std::vector<float> &map() const { return buffers->front(); }
 };
 
 struct VisualiseMap {};
@@ -167,7 +212,7 @@ struct DmapWeights
     float mult = 1.f;
     float pow = 1.f;
   };
-  std::unordered_map<std::string, std::function<float(flecs::entity e, float value)>> weights;
+  std::unordered_map<DmapId, std::function<float(flecs::entity e, float value)>> weights;
 };
 
 struct Hive {};
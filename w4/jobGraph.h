@@ -0,0 +1,47 @@
+#pragma once
+#include <condition_variable>
+#include <functional>
+#include <initializer_list>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// A fixed set of jobs with dependencies between them, run on a pool of worker threads.
+// Jobs are added once, then the whole graph is started as many times as needed;
+// a job is queued as soon as all jobs it depends on have finished.
+// Starting and running the graph doesn't allocate.
+class JobGraph
+{
+public:
+  explicit JobGraph(int num_threads);
+  ~JobGraph();
+  JobGraph(const JobGraph &) = delete;
+  JobGraph &operator=(const JobGraph &) = delete;
+
+  // dependencies have to be added before the job, returns the id of the job
+  size_t add(std::function<void()> func, std::initializer_list<size_t> dependencies = {});
+
+  // returns right away, jobs run on the workers
+  void start();
+  void wait();
+
+private:
+  void workerLoop();
+
+  struct Job
+  {
+    std::function<void()> func;
+    std::vector<size_t> dependents;
+    size_t numDependencies = 0;
+    size_t remaining = 0;
+  };
+
+  std::vector<Job> jobs;
+  std::vector<size_t> ready;
+  size_t unfinished = 0;
+  bool stopping = false;
+  std::mutex mutex;
+  std::condition_variable workAvailable;
+  std::condition_variable allDone;
+  std::vector<std::thread> workers;
+};
@@ -5,13 +5,20 @@
 #include "aiLibrary.h"
 #include "blackboard.h"
 #include "math.h"
+#include "spatialHash.h"
 #include "dungeonUtils.h"
 #include "dijkstraMapGen.h"
+#include "dmapPipeline.h"
 #include "dmapFollower.h"
+#include "thinkPhase.h"
+#include <thread>
+#include <chrono>
+#include <algorithm>
+#include <memory>
 
 static flecs::entity create_player_approacher(flecs::entity e)
 {
-  e.set(DmapWeights{{{"approach_map", 
+  e.set(DmapWeights{{{DMAP_APPROACH, 
                       [](flecs::entity, float value) {
                         return value;
                       } 
@@ -21,7 +28,7 @@ static flecs::entity create_player_approacher(flecs::entity e)
 
 static flecs::entity create_player_fleer(flecs::entity e)
 {
-  e.set(DmapWeights{{{"flee_map",
+  e.set(DmapWeights{{{DMAP_FLEE,
                       [](flecs::entity, float value) {
                         return value;
                       }
@@ -31,7 +38,7 @@ static flecs::entity create_player_fleer(flecs::entity e)
 
 static flecs::entity create_hive_follower(flecs::entity e)
 {
-  e.set(DmapWeights{{{"hive_map", 
+  e.set(DmapWeights{{{DMAP_HIVE, 
                       [](flecs::entity, float value) {
                         return value;
                       }
@@ -41,7 +48,7 @@ static flecs::entity create_hive_follower(flecs::entity e)
 
 static flecs::entity create_hive_monster(flecs::entity e)
 {
-  e.set(DmapWeights{{{"hive_map", 
+  e.set(DmapWeights{{{DMAP_HIVE, 
                       [](flecs::entity e, float value) {
                         bool low_hp = false; 
                         e.get([&](const Hitpoints hp) {
@@ -49,7 +56,7 @@ static flecs::entity create_hive_monster(flecs::entity e)
                         });
                         return value * (low_hp ? 3.0 : 1.0);
                       }}, 
-                     {"approach_map", 
+                     {DMAP_APPROACH, 
                       [](flecs::entity, float value) {
                         if (value < 1e5) { return powf(value * 1.8, 0.8); } 
                         return value;
@@ -60,10 +67,10 @@ static flecs::entity create_hive_monster(flecs::entity e)
 static flecs::entity create_archer_monster(flecs::entity e)
 {
   e.set(ShootDamage{10.f});
-  e.set(DmapWeights{{{"vision_map", [](flecs::entity, float value) {
+  e.set(DmapWeights{{{DMAP_VISION, [](flecs::entity, float value) {
                         return value;
                       }}, 
-                      {"archer_map", 
+                      {DMAP_ARCHER, 
                       [](flecs::entity, float value) {
                         if (value < 1e5) { return 3.0f * value; }
                         return value;
@@ -80,7 +87,8 @@ static flecs::entity create_hive(flecs::entity e)
 
 static void create_fuzzy_monster_beh(flecs::entity e)
 {
-  e.set(Blackboard{});
+  static BlackboardLayout layout;
+  e.set(Blackboard{&layout});
   BehNode *root =
     utility_selector({
       std::make_pair(
@@ -90,8 +98,8 @@ static void create_fuzzy_monster_beh(flecs::entity e)
         }),
         [](Blackboard &bb)
         {
-          const float hp = bb.get<float>("hp");
-          const float enemyDist = bb.get<float>("enemyDist");
+          const float hp = bb.get(bb_key<float, "hp">());
+          const float enemyDist = bb.get(bb_key<float, "enemyDist">());
           return (100.f - hp) * 5.f - 50.f * enemyDist;
         }
       ),
@@ -102,7 +110,7 @@ static void create_fuzzy_monster_beh(flecs::entity e)
         }),
         [](Blackboard &bb)
         {
-          const float enemyDist = bb.get<float>("enemyDist");
+          const float enemyDist = bb.get(bb_key<float, "enemyDist">());
           return 100.f - 10.f * enemyDist;
         }
       ),
@@ -117,7 +125,7 @@ static void create_fuzzy_monster_beh(flecs::entity e)
         patch_up(100.f),
         [](Blackboard &bb)
         {
-          const float hp = bb.get<float>("hp");
+          const float hp = bb.get(bb_key<float, "hp">());
           return 140.f - hp;
         }
       )
@@ -128,7 +136,8 @@ static void create_fuzzy_monster_beh(flecs::entity e)
 
 static void create_minotaur_beh(flecs::entity e)
 {
-  e.set(Blackboard{});
+  static BlackboardLayout layout;
+  e.set(Blackboard{&layout});
   BehNode *root =
     selector({
       sequence({
@@ -299,9 +308,9 @@ static void register_roguelike_systems(flecs::world &ecs)
             float sum = 0.f;
             for (const auto &pair : wt.weights)
             {
-              ecs.entity(pair.first.c_str()).get([&](const DijkstraMapData &dmap)
+              ecs.entity(dmap_name(pair.first)).get([&](const DijkstraMapData &dmap)
               {
-                float v = dmap.map[y * dd.width + x];
+                float v = dmap.map()[y * dd.width + x];
                 sum += pair.second(e, v);
               });
             }
@@ -320,7 +329,7 @@ static void register_roguelike_systems(flecs::world &ecs)
         for (size_t y = 0; y < dd.height; ++y)
           for (size_t x = 0; x < dd.width; ++x)
           {
-            const float val = dmap.map[y * dd.width + x];
+            const float val = dmap.map()[y * dd.width + x];
             if (val < 1e5f)
               DrawText(TextFormat("%.1f", val),
                   (float(x) + 0.2f) * tile_size, (float(y) + 0.5f) * tile_size, 150, WHITE);
@@ -330,16 +339,43 @@ static void register_roguelike_systems(flecs::world &ecs)
 }
 
 
-void init_roguelike(flecs::world &ecs)
+// monster kinds are spawned in turns, the first num_monster_kinds make the default set
+static void create_monster_of_kind(flecs::world &ecs, int idx)
+{
+  switch (idx % num_monster_kinds)
+  {
+    case 0:
+    case 1:
+      create_hive_monster(create_monster(ecs, Color{0xee, 0x00, 0xee, 0xff}, "minotaur_tex"));
+      break;
+    case 2:
+      create_hive_monster(create_monster(ecs, Color{0x11, 0x11, 0x11, 0xff}, "minotaur_tex"));
+      break;
+    case 3:
+      create_hive(create_player_fleer(create_monster(ecs, Color{0, 255, 0, 255}, "minotaur_tex")));
+      break;
+    case 4:
+      create_archer_monster(create_monster(ecs, Color{0xff, 0xff, 0xff, 0xff}, "archer_tex"));
+      break;
+  }
+}
+
+void init_roguelike(flecs::world &ecs, int num_monsters)
 {
   register_roguelike_systems(ecs);
+  register_spatial_hash(ecs);
+  init_think_phase(ecs, int(std::thread::hardware_concurrency()));
 
-  ecs.entity("swordsman_tex")
-    .set(Texture2D{LoadTexture("w4/assets/swordsman.png")});
-  ecs.entity("minotaur_tex")
-    .set(Texture2D{LoadTexture("w4/assets/minotaur.png")});
-  ecs.entity("archer_tex")
-    .set(Texture2D{LoadTexture("w4/assets/archer.png")});
+  // no window means a headless simulation, nothing will be rendered
+  if (IsWindowReady())
+  {
+    ecs.entity("swordsman_tex")
+      .set(Texture2D{LoadTexture("w4/assets/swordsman.png")});
+    ecs.entity("minotaur_tex")
+      .set(Texture2D{LoadTexture("w4/assets/minotaur.png")});
+    ecs.entity("archer_tex")
+      .set(Texture2D{LoadTexture("w4/assets/archer.png")});
+  }
 
   ecs.observer<Texture2D>()
     .event(flecs::OnRemove)
@@ -348,34 +384,59 @@ void init_roguelike(flecs::world &ecs)
         UnloadTexture(texture);
       });
 
-  create_hive_monster(create_monster(ecs, Color{0xee, 0x00, 0xee, 0xff}, "minotaur_tex"));
-  create_hive_monster(create_monster(ecs, Color{0xee, 0x00, 0xee, 0xff}, "minotaur_tex"));
-  create_hive_monster(create_monster(ecs, Color{0x11, 0x11, 0x11, 0xff}, "minotaur_tex"));
-  create_hive(create_player_fleer(create_monster(ecs, Color{0, 255, 0, 255}, "minotaur_tex")));
-
-  create_archer_monster(create_monster(ecs, Color{0xff, 0xff, 0xff, 0xff}, "archer_tex"));
+  for (int i = 0; i < num_monsters; ++i)
+    create_monster_of_kind(ecs, i);
 
   create_player(ecs, "swordsman_tex");
 
+  // approach, vision and hive maps are the most that are built at the same time
+  const int numDmapThreads = std::clamp(int(std::thread::hardware_concurrency()), 1, 3);
+  std::shared_ptr<DmapPipeline> dmapPipeline = std::make_shared<DmapPipeline>(numDmapThreads);
   ecs.entity("world")
     .set(TurnCounter{})
-    .set(ActionLog{});
+    .set(TurnTimings{})
+    .set(ActionLog{})
+    .set(DmapPipelineRef{dmapPipeline});
+  dmapPipeline->init(ecs);
+
+  ecs.entity("hive_follower_sum")
+    .set(DmapWeights{{{DMAP_HIVE, 
+                      [](flecs::entity e, float value) {
+                        bool low_hp = false; 
+                        e.get([&](const Hitpoints hp) {
+                          if (hp.hitpoints < 70.0f) low_hp = true;
+                        });
+                        return value * (low_hp ? 3.0 : 1.0);
+                      }},
+                      {DMAP_APPROACH, 
+                      [](flecs::entity, float value) {
+                        if (value < 1e5) { return powf(value * 1.8, 0.8); }
+                        return value;
+                      }}}}).add<VisualiseMap>();
+
 }
 
 void init_dungeon(flecs::world &ecs, char *tiles, size_t w, size_t h)
 {
-  flecs::entity wallTex = ecs.entity("wall_tex")
-    .set(Texture2D{LoadTexture("w4/assets/wall.png")});
-  flecs::entity floorTex = ecs.entity("floor_tex")
-    .set(Texture2D{LoadTexture("w4/assets/floor.png")});
+  flecs::entity wallTex = ecs.entity("wall_tex");
+  flecs::entity floorTex = ecs.entity("floor_tex");
+  if (IsWindowReady())
+  {
+    wallTex.set(Texture2D{LoadTexture("w4/assets/wall.png")});
+    floorTex.set(Texture2D{LoadTexture("w4/assets/floor.png")});
+  }
 
   std::vector<char> dungeonData;
   dungeonData.resize(w * h);
   for (size_t y = 0; y < h; ++y)
     for (size_t x = 0; x < w; ++x)
       dungeonData[y * w + x] = tiles[y * w + x];
+  DungeonOccupancy occupancy;
+  occupancy.occupants.resize(w * h);
+  occupancy.items.resize(w * h);
   ecs.entity("dungeon")
-    .set(DungeonData{dungeonData, w, h});
+    .set(DungeonData{dungeonData, w, h})
+    .set(occupancy);
 
   for (size_t y = 0; y < h; ++y)
     for (size_t x = 0; x < w; ++x)
@@ -429,22 +490,60 @@ static Position move_pos(Position pos, int action)
   return pos;
 }
 
-static void push_to_log(flecs::world &ecs, const char *msg)
+static void push_to_log(const AIContext &ctx, const char *msg)
 {
-  static auto queryLog = ecs.query<ActionLog, const TurnCounter>();
-  queryLog.each([&](ActionLog &l, const TurnCounter &c)
+  if (!ctx.actionLog || !ctx.turnCounter)
+    return;
+  ActionLog &l = *ctx.actionLog;
+  l.log.push_back(std::to_string(ctx.turnCounter->count) + ": " + msg);
+  if (l.log.size() > l.capacity)
+    l.log.erase(l.log.begin());
+}
+
+static void fill_occupancy(flecs::world &ecs, const DungeonData &dd, DungeonOccupancy &occ)
+{
+  static auto occupantsQuery = ecs.query<const MovePos, Hitpoints, const Team>();
+  static auto healsQuery = ecs.query<const Position, const HealAmount>();
+  static auto powerupsQuery = ecs.query<const Position, const PowerupAmount>();
+
+  for (size_t idx : occ.usedTiles)
+  {
+    occ.occupants[idx].clear();
+    occ.items[idx].clear();
+  }
+  occ.usedTiles.clear();
+
+  auto tileIdx = [&](int x, int y) -> size_t
+  {
+    if (x < 0 || x >= int(dd.width) || y < 0 || y >= int(dd.height))
+      return size_t(-1);
+    return size_t(y) * dd.width + size_t(x);
+  };
+  occupantsQuery.each([&](flecs::entity e, const MovePos &mpos, Hitpoints &hp, const Team &team)
   {
-    l.log.push_back(std::to_string(c.count) + ": " + msg);
-    if (l.log.size() > l.capacity)
-      l.log.erase(l.log.begin());
+    const size_t idx = tileIdx(mpos.x, mpos.y);
+    if (idx == size_t(-1))
+      return;
+    occ.occupants[idx].push_back(DungeonOccupancy::Occupant{e, &hp, team.team});
+    occ.usedTiles.push_back(idx);
   });
+  auto addItem = [&](flecs::entity e, const Position &pos)
+  {
+    const size_t idx = tileIdx(pos.x, pos.y);
+    if (idx == size_t(-1))
+      return;
+    occ.items[idx].push_back(e);
+    occ.usedTiles.push_back(idx);
+  };
+  healsQuery.each([&](flecs::entity e, const Position &pos, const HealAmount &) { addItem(e, pos); });
+  powerupsQuery.each([&](flecs::entity e, const Position &pos, const PowerupAmount &) { addItem(e, pos); });
 }
 
-static void process_actions(flecs::world &ecs)
+static void process_actions(flecs::world &ecs, const AIContext &ctx)
 {
   static auto processActions = ecs.query<Action, Position, MovePos, const MeleeDamage, const Team>();
   static auto processHeals = ecs.query<Action, Hitpoints>();
-  static auto checkAttacks = ecs.query<const MovePos, Hitpoints, const Team>();
+  static auto dungeonOccupancy = ecs.query<const DungeonData, DungeonOccupancy>();
   static auto processShoot = ecs.query<Action, const Position, const ShootDamage, const Team>();
   static auto checkShoot = ecs.query<const Position, Hitpoints, const Team>();
   // Process all actions
@@ -466,36 +565,65 @@ static void process_actions(flecs::world &ecs)
       if (a.action != EA_HEAL_SELF)
         return;
       a.action = EA_NOP;
-      push_to_log(ecs, "Monster healed itself");
+      push_to_log(ctx, "Monster healed itself");
       hp.hitpoints += 10.f;
 
     });
-    processActions.each([&](flecs::entity entity, Action &a, Position &pos, MovePos &mpos, const MeleeDamage &dmg, const Team &team)
+    // moves are resolved in query order: the first one to step on a tile claims it,
+    // everyone coming later is blocked by whoever is there (and hits them if they are enemies)
+    dungeonOccupancy.each([&](const DungeonData &dd, DungeonOccupancy &occ)
     {
-      Position nextPos = move_pos(pos, a.action);
-      bool blocked = !dungeon::is_tile_walkable(ecs, nextPos);
-      checkAttacks.each([&](flecs::entity enemy, const MovePos &epos, Hitpoints &hp, const Team &enemy_team)
+      fill_occupancy(ecs, dd, occ);
+      processActions.each([&](flecs::entity entity, Action &a, Position &pos, MovePos &mpos, const MeleeDamage &dmg, const Team &team)
       {
-        if (entity != enemy && epos == nextPos)
+        Position nextPos = move_pos(pos, a.action);
+        if (!dungeon::is_tile_walkable(dd, nextPos))
         {
+          a.action = EA_NOP;
+          return;
+        }
+        const size_t nextIdx = size_t(nextPos.y) * dd.width + size_t(nextPos.x);
+        bool blocked = false;
+        for (const DungeonOccupancy::Occupant &occupant : occ.occupants[nextIdx])
+        {
+          if (occupant.entity == entity)
+            continue;
           blocked = true;
-          if (team.team != enemy_team.team)
+          if (team.team != occupant.team)
           {
-            push_to_log(ecs, "damaged entity");
-            hp.hitpoints -= dmg.damage;
+            push_to_log(ctx, "damaged entity");
+            occupant.hp->hitpoints -= dmg.damage;
           }
         }
-      });
-      if (blocked)
-        a.action = EA_NOP;
-      else
+        if (blocked)
+        {
+          a.action = EA_NOP;
+          return;
+        }
+        const size_t curIdx = size_t(mpos.y) * dd.width + size_t(mpos.x);
+        std::vector<DungeonOccupancy::Occupant> &here = occ.occupants[curIdx];
+        for (size_t i = 0; i < here.size(); ++i)
+          if (here[i].entity == entity)
+          {
+            occ.occupants[nextIdx].push_back(here[i]);
+            occ.usedTiles.push_back(nextIdx);
+            here[i] = here.back();
+            here.pop_back();
+            break;
+          }
         mpos = nextPos;
+      });
     });
     // now move
-    processActions.each([&](Action &a, Position &pos, MovePos &mpos, const MeleeDamage &, const Team&)
+    query_spatial_hash(ecs, [&](SpatialHash &hash)
     {
-      pos = mpos;
-      a.action = EA_NOP;
+      processActions.each([&](flecs::entity entity, Action &a, Position &pos, MovePos &mpos, const MeleeDamage &, const Team &team)
+      {
+        if (!(pos == mpos))
+          hash.update(entity, Position{mpos.x, mpos.y}, team.team);
+        pos = mpos;
+        a.action = EA_NOP;
+      });
     });
   });
 
@@ -510,142 +638,145 @@ static void process_actions(flecs::world &ecs)
   });
 
   static auto playerPickup = ecs.query<const IsPlayer, const Position, Hitpoints, MeleeDamage>();
-  static auto healPickup = ecs.query<const Position, const HealAmount>();
-  static auto powerupPickup = ecs.query<const Position, const PowerupAmount>();
   ecs.defer([&]
   {
-    playerPickup.each([&](const IsPlayer&, const Position &pos, Hitpoints &hp, MeleeDamage &dmg)
+    dungeonOccupancy.each([&](const DungeonData &dd, DungeonOccupancy &occ)
     {
-      healPickup.each([&](flecs::entity entity, const Position &ppos, const HealAmount &amt)
-      {
-        if (pos == ppos)
-        {
-          hp.hitpoints += amt.amount;
-          entity.destruct();
-        }
-      });
-      powerupPickup.each([&](flecs::entity entity, const Position &ppos, const PowerupAmount &amt)
+      playerPickup.each([&](const IsPlayer&, const Position &pos, Hitpoints &hp, MeleeDamage &dmg)
       {
-        if (pos == ppos)
+        if (!dungeon::is_tile_walkable(dd, pos))
+          return;
+        std::vector<flecs::entity> &items = occ.items[size_t(pos.y) * dd.width + size_t(pos.x)];
+        for (flecs::entity item : items)
         {
-          dmg.damage += amt.amount;
-          entity.destruct();
+          if (const HealAmount *amt = item.get<HealAmount>())
+            hp.hitpoints += amt->amount;
+          if (const PowerupAmount *amt = item.get<PowerupAmount>())
+            dmg.damage += amt->amount;
+          item.destruct();
         }
+        items.clear();
       });
     });
   });
 }
 
-template<typename T>
-static void push_info_to_bb(Blackboard &bb, const char *name, const T &val)
-{
-  size_t idx = bb.regName<T>(name);
-  bb.set(idx, val);
-}
-
 // sensors
-static void gather_world_info(flecs::world &ecs)
+static void gather_world_info(flecs::world &ecs, const AIContext &ctx)
 {
   static auto gatherWorldInfo = ecs.query<Blackboard,
                                           const Position, const Hitpoints,
                                           const WorldInfoGatherer,
                                           const Team>();
-  static auto alliesQuery = ecs.query<const Position, const Team>();
+  if (!ctx.spatialHash)
+    return;
+  const SpatialHash &hash = *ctx.spatialHash;
   gatherWorldInfo.each([&](Blackboard &bb, const Position &pos, const Hitpoints &hp,
                            WorldInfoGatherer, const Team &team)
   {
-    // first gather all needed names (without cache)
-    push_info_to_bb(bb, "hp", hp.hitpoints);
+    // keys are interned once per call site, these are plain indexed stores
+    bb.set(bb_key<float, "hp">(), hp.hitpoints);
     float numAllies = 0; // note float
     float closestEnemyDist = 100.f;
-    alliesQuery.each([&](const Position &apos, const Team &ateam)
+    constexpr float limitDist = 5.f;
+    hash.query_radius(pos, limitDist, [&](int t) { return t == team.team; }, [&](const SpatialHash::Neighbour &ally)
     {
-      constexpr float limitDist = 5.f;
-      if (team.team == ateam.team && dist_sq(pos, apos) < sqr(limitDist))
+      if (ally.dist < limitDist)
         numAllies += 1.f;
-      if (team.team != ateam.team)
-      {
-        const float enemyDist = dist(pos, apos);
-        if (enemyDist < closestEnemyDist)
-          closestEnemyDist = enemyDist;
-      }
     });
-    push_info_to_bb(bb, "alliesNum", numAllies);
-    push_info_to_bb(bb, "enemyDist", closestEnemyDist);
+    SpatialHash::Neighbour enemy;
+    if (hash.nearest(pos, [&](int t) { return t != team.team; }, enemy))
+      closestEnemyDist = std::min(closestEnemyDist, enemy.dist);
+    bb.set(bb_key<float, "alliesNum">(), numAllies);
+    bb.set(bb_key<float, "enemyDist">(), closestEnemyDist);
   });
 }
 
+template<typename Callable>
+static double timed(Callable c)
+{
+  const auto start = std::chrono::steady_clock::now();
+  c();
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+static DmapPipeline *get_dmap_pipeline(flecs::world &ecs)
+{
+  static auto dmapPipelineQuery = ecs.query<const DmapPipelineRef>();
+  DmapPipeline *pipeline = nullptr;
+  dmapPipelineQuery.each([&](const DmapPipelineRef &ref) { pipeline = ref.pipeline.get(); });
+  return pipeline;
+}
+
+static AIContext make_ai_context(flecs::world &ecs, const DmapPipeline &dmap_pipeline)
+{
+  static auto worldSingletons = ecs.query<ActionLog, const TurnCounter>();
+  static auto dungeonDataQuery = ecs.query<const DungeonData>();
+  AIContext ctx;
+  worldSingletons.each([&](ActionLog &l, const TurnCounter &c)
+  {
+    ctx.actionLog = &l;
+    ctx.turnCounter = &c;
+  });
+  dungeonDataQuery.each([&](const DungeonData &dd) { ctx.dungeon = &dd; });
+  query_spatial_hash(ecs, [&](const SpatialHash &hash) { ctx.spatialHash = &hash; });
+  for (int id = 0; id < NUM_DMAPS; ++id)
+    ctx.dmaps[id] = dmap_pipeline.getMap(DmapId(id));
+  return ctx;
+}
+
 void process_turn(flecs::world &ecs)
 {
-  static auto stateMachineAct = ecs.query<StateMachine>();
-  static auto behTreeUpdate = ecs.query<BehaviourTree, Blackboard>();
   static auto turnIncrementer = ecs.query<TurnCounter>();
+  static auto turnTimings = ecs.query<TurnTimings>();
   if (is_player_acted(ecs))
   {
+    TurnTimings timings;
+    DmapPipeline *dmapPipeline = get_dmap_pipeline(ecs);
+    // maps started at the end of the last turn
+    timings.dmaps = timed([&] { dmapPipeline->wait(ecs); });
+    const AIContext ctx = make_ai_context(ecs, *dmapPipeline);
     if (upd_player_actions_count(ecs))
     {
       // Plan action for NPCs
-      gather_world_info(ecs);
-      ecs.defer([&]
+      timings.sensors = timed([&] { gather_world_info(ecs, ctx); });
+      timings.think = timed([&] { process_think_phase(ecs, ctx); });
+      timings.followers = timed([&]
       {
-        stateMachineAct.each([&](flecs::entity e, StateMachine &sm)
-        {
-          sm.act(0.f, ecs, e);
-        });
-        behTreeUpdate.each([&](flecs::entity e, BehaviourTree &bt, Blackboard &bb)
+        ecs.defer([&]
         {
-          bt.update(ecs, e, bb);
+          process_dmap_followers(ecs, ctx);
         });
-        process_dmap_followers(ecs);
       });
       turnIncrementer.each([](TurnCounter &tc) { tc.count++; });
     }
-    process_actions(ecs);
-
-    std::vector<float> approachMap;
-    dmaps::gen_player_approach_map(ecs, approachMap);
-    ecs.entity("approach_map")
-      .set(DijkstraMapData{approachMap});
-
-    std::vector<float> visionMap;
-    dmaps::gen_player_vision_map(ecs, visionMap);
-    ecs.entity("vision_map")
-      .set(DijkstraMapData{visionMap});
-
-    std::vector<float> fleeMap;
-    dmaps::gen_player_flee_map(ecs, fleeMap);
-    ecs.entity("flee_map")
-      .set(DijkstraMapData{fleeMap});
-
-    std::vector<float> archMap;
-    dmaps::gen_archer_map(ecs, archMap);
-    ecs.entity("archer_map")
-      .set(DijkstraMapData{archMap});
-
-    std::vector<float> hiveMap;
-    dmaps::gen_hive_pack_map(ecs, hiveMap);
-    ecs.entity("hive_map")
-      .set(DijkstraMapData{hiveMap});
-
-    ecs.entity("hive_follower_sum")
-      .set(DmapWeights{{{"hive_map", 
-                        [](flecs::entity e, float value) {
-                          bool low_hp = false; 
-                          e.get([&](const Hitpoints hp) {
-                            if (hp.hitpoints < 70.0f) low_hp = true;
-                          });
-                          return value * (low_hp ? 3.0 : 1.0);
-                        }},
-                        {"approach_map", 
-                        [](flecs::entity, float value) {
-                          if (value < 1e5) { return powf(value * 1.8, 0.8); }
-                          return value;
-                        }}}}).add<VisualiseMap>();
-
-    //.add<VisualiseMap>()
+    timings.actions = timed([&] { process_actions(ecs, ctx); });
+    timings.dmaps += timed([&] { dmapPipeline->start(ecs); });
+
+    turnTimings.each([&](TurnTimings &acc)
+    {
+      acc.turns++;
+      acc.sensors += timings.sensors;
+      acc.think += timings.think;
+      acc.followers += timings.followers;
+      acc.actions += timings.actions;
+      acc.dmaps += timings.dmaps;
+    });
   }
 }
 
+void set_dmap_verification(flecs::world &ecs, bool verify)
+{
+  get_dmap_pipeline(ecs)->setVerify(verify);
+}
+
+size_t get_dmap_verification_mismatches(flecs::world &ecs)
+{
+  DmapPipeline *pipeline = get_dmap_pipeline(ecs);
+  pipeline->wait(ecs);
+  return pipeline->getVerifyMismatches();
+}
+
 void print_stats(flecs::world &ecs)
 {
   static auto playerStatsQuery = ecs.query<const IsPlayer, const Hitpoints, const MeleeDamage>();
@@ -3,8 +3,12 @@
 #include <flecs.h>
 
 constexpr float tile_size = 512.f;
+constexpr int num_monster_kinds = 5;
 
-void init_roguelike(flecs::world &ecs);
+void init_roguelike(flecs::world &ecs, int num_monsters = num_monster_kinds);
 void init_dungeon(flecs::world &ecs, char *tiles, size_t w, size_t h);
 void process_turn(flecs::world &ecs);
+// checks incrementally maintained dijkstra maps against full regeneration after every update
+void set_dmap_verification(flecs::world &ecs, bool verify);
+size_t get_dmap_verification_mismatches(flecs::world &ecs);
 void print_stats(flecs::world &ecs);
@@ -1,6 +1,7 @@
 #pragma once
 #include <vector>
 #include <flecs.h>
+#include "aiContext.h"
 
 class State
 {
@@ -8,14 +9,14 @@ public:
   virtual ~State() {}
   virtual void enter() const = 0;
   virtual void exit() const = 0;
-  virtual void act(float dt, flecs::world &ecs, flecs::entity entity) const = 0;
+  virtual void act(float dt, flecs::world &ecs, flecs::entity entity, const AIContext &ctx) const = 0;
 };
 
 class StateTransition
 {
 public:
   virtual ~StateTransition() {}
-  virtual bool isAvailable(flecs::world &ecs, flecs::entity entity) const = 0;
+  virtual bool isAvailable(flecs::world &ecs, flecs::entity entity, const AIContext &ctx) const = 0;
 };
 
 class StateMachine
@@ -34,7 +35,7 @@ public:
   StateMachine &operator=(StateMachine &&sm) = default;
 
 
-  void act(float dt, flecs::world &ecs, flecs::entity entity);
+  void act(float dt, flecs::world &ecs, flecs::entity entity, const AIContext &ctx);
 
   int addState(State *st);
   void addTransition(StateTransition *trans, int from, int to);
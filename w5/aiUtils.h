@@ -3,6 +3,8 @@
 #include "blackboard.h"
 #include <float.h>
 #include "math.h"
+#include "spatialHash.h"
+#include "aiContext.h"
 
 template<typename T, typename U>
 inline int move_towards(const T &from, const U &to)
@@ -23,29 +25,18 @@ inline int inverse_move(int move)
 }
 
 template<typename Callable>
-inline void on_closest_enemy_pos(flecs::world &ecs, flecs::entity entity, Callable c)
+inline void on_closest_enemy_pos(const AIContext &ctx, flecs::entity entity, Callable c)
 {
-  static auto enemiesQuery = ecs.query<const Position, const Team>();
-  entity.set([&](const Position &pos, const Team &t, Action &a)
+  if (ctx.spatialHash)
   {
-    flecs::entity closestEnemy;
-    float closestDist = FLT_MAX;
-    Position closestPos;
-    enemiesQuery.each([&](flecs::entity enemy, const Position &epos, const Team &et)
+    const SpatialHash &hash = *ctx.spatialHash;
+    entity.set([&](const Position &pos, const Team &t, Action &a)
     {
-      if (t.team == et.team)
-        return;
-      float curDist = dist(epos, pos);
-      if (curDist < closestDist)
-      {
-        closestDist = curDist;
-        closestPos = epos;
-        closestEnemy = enemy;
-      }
+      SpatialHash::Neighbour enemy;
+      if (hash.nearest(pos, [&](int team) { return team != t.team; }, enemy))
+        c(a, pos, enemy.pos);
     });
-    if (ecs.is_valid(closestEnemy))
-      c(a, pos, closestPos);
-  });
+  }
 }
 
 template<typename T>
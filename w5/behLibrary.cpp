@@ -1,6 +1,7 @@
 #include "aiLibrary.h"
 #include "ecsTypes.h"
 #include "aiUtils.h"
+#include "thinkPhase.h"
 #include "math.h"
 #include "raylib.h"
 #include "blackboard.h"
@@ -26,11 +27,11 @@ struct CompoundNode : public BehNode
 
 struct Sequence : public CompoundNode
 {
-  BehResult update(flecs::world &ecs, flecs::entity entity, Blackboard &bb) override
+  BehResult update(flecs::world &ecs, flecs::entity entity, Blackboard &bb, const AIContext &ctx) override
   {
     for (BehNode *node : nodes)
     {
-      BehResult res = node->update(ecs, entity, bb);
+      BehResult res = node->update(ecs, entity, bb, ctx);
       if (res != BEH_SUCCESS)
         return res;
     }
@@ -40,11 +41,11 @@ struct Sequence : public CompoundNode
 
 struct Selector : public CompoundNode
 {
-  BehResult update(flecs::world &ecs, flecs::entity entity, Blackboard &bb) override
+  BehResult update(flecs::world &ecs, flecs::entity entity, Blackboard &bb, const AIContext &ctx) override
   {
     for (BehNode *node : nodes)
     {
-      BehResult res = node->update(ecs, entity, bb);
+      BehResult res = node->update(ecs, entity, bb, ctx);
       if (res != BEH_FAIL)
         return res;
     }
@@ -56,7 +57,7 @@ struct UtilitySelector : public BehNode
 {
   std::vector<std::pair<BehNode*, utility_function>> utilityNodes;
 
-  BehResult update(flecs::world &ecs, flecs::entity entity, Blackboard &bb) override
+  BehResult update(flecs::world &ecs, flecs::entity entity, Blackboard &bb, const AIContext &ctx) override
   {
     std::vector<std::pair<float, size_t>> utilityScores;
     for (size_t i = 0; i < utilityNodes.size(); ++i)
@@ -71,7 +72,7 @@ struct UtilitySelector : public BehNode
     for (const std::pair<float, size_t> &node : utilityScores)
     {
       size_t nodeIdx = node.second;
-      BehResult res = utilityNodes[nodeIdx].first->update(ecs, entity, bb);
+      BehResult res = utilityNodes[nodeIdx].first->update(ecs, entity, bb, ctx);
       if (res != BEH_FAIL)
         return res;
     }
@@ -87,7 +88,7 @@ struct MoveToEntity : public BehNode
     entityBb = reg_entity_blackboard_var<flecs::entity>(entity, bb_name);
   }
 
-  BehResult update(flecs::world &, flecs::entity entity, Blackboard &bb) override
+  BehResult update(flecs::world &, flecs::entity entity, Blackboard &bb, const AIContext &/*ctx*/) override
   {
     BehResult res = BEH_RUNNING;
     entity.set([&](Action &a, const Position &pos)
@@ -118,7 +119,7 @@ struct IsLowHp : public BehNode
   float threshold = 0.f;
   IsLowHp(float thres) : threshold(thres) {}
 
-  BehResult update(flecs::world &, flecs::entity entity, Blackboard &) override
+  BehResult update(flecs::world &, flecs::entity entity, Blackboard &, const AIContext &/*ctx*/) override
   {
     BehResult res = BEH_SUCCESS;
     entity.get([&](const Hitpoints &hp)
@@ -137,33 +138,22 @@ struct FindEnemy : public BehNode
   {
     entityBb = reg_entity_blackboard_var<flecs::entity>(entity, bb_name);
   }
-  BehResult update(flecs::world &ecs, flecs::entity entity, Blackboard &bb) override
+  BehResult update(flecs::world &ecs, flecs::entity entity, Blackboard &bb, const AIContext &ctx) override
   {
     BehResult res = BEH_FAIL;
-    static auto enemiesQuery = ecs.query<const Position, const Team>();
-    entity.set([&](const Position &pos, const Team &t)
+    if (ctx.spatialHash)
     {
-      flecs::entity closestEnemy;
-      float closestDist = FLT_MAX;
-      Position closestPos;
-      enemiesQuery.each([&](flecs::entity enemy, const Position &epos, const Team &et)
+      const SpatialHash &hash = *ctx.spatialHash;
+      entity.set([&](const Position &pos, const Team &t)
       {
-        if (t.team == et.team)
-          return;
-        float curDist = dist(epos, pos);
-        if (curDist < closestDist)
+        SpatialHash::Neighbour enemy;
+        if (hash.nearest(pos, [&](int team) { return team != t.team; }, enemy) && enemy.dist <= distance)
         {
-          closestDist = curDist;
-          closestPos = epos;
-          closestEnemy = enemy;
+          bb.set<flecs::entity>(entityBb, enemy.entity);
+          res = BEH_SUCCESS;
         }
       });
-      if (ecs.is_valid(closestEnemy) && closestDist <= distance)
-      {
-        bb.set<flecs::entity>(entityBb, closestEnemy);
-        res = BEH_SUCCESS;
-      }
-    });
+    }
     return res;
   }
 };
@@ -176,7 +166,7 @@ struct Flee : public BehNode
     entityBb = reg_entity_blackboard_var<flecs::entity>(entity, bb_name);
   }
 
-  BehResult update(flecs::world &, flecs::entity entity, Blackboard &bb) override
+  BehResult update(flecs::world &, flecs::entity entity, Blackboard &bb, const AIContext &/*ctx*/) override
   {
     BehResult res = BEH_RUNNING;
     entity.set([&](Action &a, const Position &pos)
@@ -210,7 +200,7 @@ struct Patrol : public BehNode
     });
   }
 
-  BehResult update(flecs::world &, flecs::entity entity, Blackboard &bb) override
+  BehResult update(flecs::world &, flecs::entity entity, Blackboard &bb, const AIContext &/*ctx*/) override
   {
     BehResult res = BEH_RUNNING;
     entity.set([&](Action &a, const Position &pos)
@@ -219,7 +209,7 @@ struct Patrol : public BehNode
       if (dist(pos, patrolPos) > patrolDist)
         a.action = move_towards(pos, patrolPos);
       else
-        a.action = GetRandomValue(EA_MOVE_START, EA_MOVE_END - 1); // do a random walk
+        a.action = think_random_value(EA_MOVE_START, EA_MOVE_END - 1); // do a random walk
     });
     return res;
   }
@@ -230,7 +220,7 @@ struct PatchUp : public BehNode
   float hpThreshold = 100.f;
   PatchUp(float threshold) : hpThreshold(threshold) {}
 
-  BehResult update(flecs::world &, flecs::entity entity, Blackboard &) override
+  BehResult update(flecs::world &, flecs::entity entity, Blackboard &, const AIContext &/*ctx*/) override
   {
     BehResult res = BEH_SUCCESS;
     entity.set([&](Action &a, Hitpoints &hp)
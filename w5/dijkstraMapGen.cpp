@@ -1,6 +1,8 @@
 #include "dijkstraMapGen.h"
 #include "ecsTypes.h"
 #include "dungeonUtils.h"
+#include "dijkstraSweep.h"
+#include <algorithm>
 
 template<typename Callable>
 static void query_dungeon_data(flecs::world &ecs, Callable c)
@@ -18,7 +20,7 @@ static void query_characters_positions(flecs::world &ecs, Callable c)
   characterPositionQuery.each(c);
 }
 
-constexpr float invalid_tile_value = 1e5f;
+using dmaps::invalid_tile_value;
 
 static void init_tiles(std::vector<float> &map, const DungeonData &dd)
 {
@@ -27,82 +29,85 @@ static void init_tiles(std::vector<float> &map, const DungeonData &dd)
     v = invalid_tile_value;
 }
 
-// scan version, could be implemented as Dijkstra version as well
-static void process_dmap(std::vector<float> &map, const DungeonData &dd)
+// each map is generated by one thread at a time, buffers are reused by the next maps of that thread
+static dmaps::DijkstraScratch &flood_scratch()
 {
-  bool done = false;
-  auto getMapAt = [&](size_t x, size_t y, float def)
-  {
-    if (x < dd.width && y < dd.width && dd.tiles[y * dd.width + x] == dungeon::floor)
-      return map[y * dd.width + x];
-    return def;
-  };
-  auto getMinNei = [&](size_t x, size_t y)
+  static thread_local dmaps::DijkstraScratch scratch;
+  return scratch;
+}
+
+static dmaps::SweepScratch &sweep_scratch()
+{
+  static thread_local dmaps::SweepScratch scratch;
+  return scratch;
+}
+
+// sources gathered from the world for one map at a time, per thread like the flood scratch
+static std::vector<dmaps::DmapSeed> &sources_scratch()
+{
+  static thread_local std::vector<dmaps::DmapSeed> sources;
+  return sources;
+}
+
+void dmaps::gather_team_sources(flecs::world &ecs, const DungeonData &dd, int team, std::vector<DmapSeed> &sources)
+{
+  sources.clear();
+  query_characters_positions(ecs, [&](const Position &pos, const Team &t)
   {
-    float val = map[y * dd.width + x];
-    val = std::min(val, getMapAt(x - 1, y + 0, val));
-    val = std::min(val, getMapAt(x + 1, y + 0, val));
-    val = std::min(val, getMapAt(x + 0, y - 1, val));
-    val = std::min(val, getMapAt(x + 0, y + 1, val));
-    return val;
-  };
-  while (!done)
+    if (t.team == team)
+      sources.push_back(DmapSeed{size_t(pos.y) * dd.width + size_t(pos.x)});
+  });
+}
+
+void dmaps::gather_hive_sources(flecs::world &ecs, const DungeonData &dd, std::vector<DmapSeed> &sources)
+{
+  static auto hiveQuery = ecs.query<const Position, const Hive>();
+  sources.clear();
+  hiveQuery.each([&](const Position &pos, const Hive &)
   {
-    done = true;
-    for (size_t y = 0; y < dd.height; ++y)
-      for (size_t x = 0; x < dd.width; ++x)
-      {
-        const size_t i = y * dd.width + x;
-        if (dd.tiles[i] != dungeon::floor)
-          continue;
-        const float myVal = getMapAt(x, y, invalid_tile_value);
-        const float minVal = getMinNei(x, y);
-        if (minVal < myVal - 1.f)
-        {
-          map[i] = minVal + 1.f;
-          done = false;
-        }
-      }
-  }
+    sources.push_back(DmapSeed{size_t(pos.y) * dd.width + size_t(pos.x)});
+  });
+}
+
+void dmaps::gen_source_map(const DungeonData &dd, const std::vector<DmapSeed> &sources, std::vector<float> &map)
+{
+  init_tiles(map, dd);
+  flood_uniform(map, dd, sources.data(), sources.size(), flood_scratch(), sweep_scratch());
 }
 
 void dmaps::gen_player_approach_map(flecs::world &ecs, std::vector<float> &map)
 {
   query_dungeon_data(ecs, [&](const DungeonData &dd)
   {
-    init_tiles(map, dd);
-    query_characters_positions(ecs, [&](const Position &pos, const Team &t)
-    {
-      if (t.team == 0) // player team hardcode
-        map[pos.y * dd.width + pos.x] = 0.f;
-    });
-    process_dmap(map, dd);
+    gather_team_sources(ecs, dd, 0, sources_scratch()); // player team hardcode
+    gen_source_map(dd, sources_scratch(), map);
   });
 }
 
+float dmaps::flee_seed_value(float approach)
+{
+  return approach < invalid_tile_value ? approach * -1.2f : approach;
+}
+
 void dmaps::gen_player_flee_map(flecs::world &ecs, std::vector<float> &map)
 {
   gen_player_approach_map(ecs, map);
-  for (float &v : map)
-    if (v < invalid_tile_value)
-      v *= -1.2f;
+  std::vector<DmapSeed> &sources = sources_scratch();
+  sources.clear();
+  for (size_t i = 0; i < map.size(); ++i)
+    if (map[i] < invalid_tile_value)
+      sources.push_back(DmapSeed{i, flee_seed_value(map[i])});
   query_dungeon_data(ecs, [&](const DungeonData &dd)
   {
-    process_dmap(map, dd);
+    gen_source_map(dd, sources, map);
   });
 }
 
 void dmaps::gen_hive_pack_map(flecs::world &ecs, std::vector<float> &map)
 {
-  static auto hiveQuery = ecs.query<const Position, const Hive>();
   query_dungeon_data(ecs, [&](const DungeonData &dd)
   {
-    init_tiles(map, dd);
-    hiveQuery.each([&](const Position &pos, const Hive &)
-    {
-      map[pos.y * dd.width + pos.x] = 0.f;
-    });
-    process_dmap(map, dd);
+    gather_hive_sources(ecs, dd, sources_scratch());
+    gen_source_map(dd, sources_scratch(), map);
   });
 }
-
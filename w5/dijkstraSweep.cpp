@@ -0,0 +1,206 @@
+#include "dijkstraSweep.h"
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include "dungeonUtils.h"
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define DMAP_SWEEP_SSE 1
+#endif
+
+using dmaps::invalid_tile_value;
+
+static constexpr size_t lanes = 4;
+
+static size_t pad_to_lanes(size_t n) { return (n + lanes - 1) / lanes * lanes; }
+static size_t mask_words(size_t bits) { return (bits + 63) / 64; }
+
+static void build_masks(const DungeonData &dd, dmaps::SweepScratch &sc)
+{
+  if (sc.width == dd.width && sc.height == dd.height && sc.tiles == dd.tiles)
+    return;
+  sc.width = dd.width;
+  sc.height = dd.height;
+  sc.paddedWidth = pad_to_lanes(dd.width);
+  sc.paddedHeight = pad_to_lanes(dd.height);
+  sc.tiles.assign(dd.tiles.begin(), dd.tiles.end());
+  const size_t rowWords = mask_words(sc.paddedWidth);
+  const size_t colWords = mask_words(sc.paddedHeight);
+  sc.rowMask.assign(sc.paddedHeight * rowWords, 0);
+  sc.colMask.assign(sc.paddedWidth * colWords, 0);
+  sc.numFloor = 0;
+  for (size_t y = 0; y < dd.height; ++y)
+    for (size_t x = 0; x < dd.width; ++x)
+      if (dd.tiles[y * dd.width + x] == dungeon::floor)
+      {
+        ++sc.numFloor;
+        sc.rowMask[y * rowWords + x / 64] |= uint64_t(1) << (x % 64);
+        sc.colMask[x * colWords + y / 64] |= uint64_t(1) << (y % 64);
+      }
+  // padding is never written, it holds values nothing can improve on
+  sc.rows.assign(sc.paddedWidth * sc.paddedHeight, invalid_tile_value);
+  sc.cols.assign(sc.paddedWidth * sc.paddedHeight, invalid_tile_value);
+}
+
+#if DMAP_SWEEP_SSE
+// lanes of a 4 bit walkability nibble, all ones where the tile is floor
+struct LaneMasks
+{
+  __m128 masks[16];
+  LaneMasks()
+  {
+    for (int bits = 0; bits < 16; ++bits)
+      masks[bits] = _mm_castsi128_ps(_mm_set_epi32(-((bits >> 3) & 1), -((bits >> 2) & 1), -((bits >> 1) & 1), -(bits & 1)));
+  }
+};
+static const LaneMasks lane_masks;
+#endif
+
+// cur = min(cur, prev + 1) on the floor tiles of the line, returns whether anything was lowered
+static bool relax_line(float *cur, const float *prev, const uint64_t *mask, size_t len)
+{
+#if DMAP_SWEEP_SSE
+  const __m128 one = _mm_set1_ps(1.f);
+  int lowered = 0;
+  for (size_t x = 0; x < len; x += lanes)
+  {
+    const unsigned bits = unsigned(mask[x / 64] >> (x % 64)) & 0xF;
+    if (bits == 0)
+      continue;
+    const __m128 curVal = _mm_loadu_ps(cur + x);
+    const __m128 cand = _mm_add_ps(_mm_loadu_ps(prev + x), one);
+    const __m128 lower = _mm_and_ps(_mm_cmplt_ps(cand, curVal), lane_masks.masks[bits]);
+    lowered |= _mm_movemask_ps(lower);
+    _mm_storeu_ps(cur + x, _mm_or_ps(_mm_and_ps(lower, cand), _mm_andnot_ps(lower, curVal)));
+  }
+  return lowered != 0;
+#else
+  bool lowered = false;
+  for (size_t x = 0; x < len; ++x)
+  {
+    const float cand = prev[x] + 1.f;
+    if (cand < cur[x] && ((mask[x / 64] >> (x % 64)) & 1))
+    {
+      cur[x] = cand;
+      lowered = true;
+    }
+  }
+  return lowered;
+#endif
+}
+
+// relaxes every line from the one before it and then from the one after it
+static bool sweep_lines(float *data, const uint64_t *mask, size_t len, size_t count)
+{
+  const size_t words = mask_words(len);
+  bool lowered = false;
+  for (size_t i = 1; i < count; ++i)
+    lowered |= relax_line(data + i * len, data + (i - 1) * len, mask + i * words, len);
+  for (size_t i = count - 1; i-- > 0;)
+    lowered |= relax_line(data + i * len, data + (i + 1) * len, mask + i * words, len);
+  return lowered;
+}
+
+// dst is cols x rows, both are multiples of the lane count
+static void transpose(float *dst, const float *src, size_t rows, size_t cols)
+{
+  for (size_t y = 0; y < rows; y += lanes)
+    for (size_t x = 0; x < cols; x += lanes)
+    {
+#if DMAP_SWEEP_SSE
+      __m128 r0 = _mm_loadu_ps(src + (y + 0) * cols + x);
+      __m128 r1 = _mm_loadu_ps(src + (y + 1) * cols + x);
+      __m128 r2 = _mm_loadu_ps(src + (y + 2) * cols + x);
+      __m128 r3 = _mm_loadu_ps(src + (y + 3) * cols + x);
+      _MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+      _mm_storeu_ps(dst + (x + 0) * rows + y, r0);
+      _mm_storeu_ps(dst + (x + 1) * rows + y, r1);
+      _mm_storeu_ps(dst + (x + 2) * rows + y, r2);
+      _mm_storeu_ps(dst + (x + 3) * rows + y, r3);
+#else
+      for (size_t i = 0; i < lanes; ++i)
+        for (size_t j = 0; j < lanes; ++j)
+          dst[(x + j) * rows + y + i] = src[(y + i) * cols + x + j];
+#endif
+    }
+}
+
+bool dmaps::sweep_flood(std::vector<float> &map, const DungeonData &dd, const DmapSeed *seeds, size_t num_seeds,
+                        size_t max_rounds, SweepScratch &sc)
+{
+  if (map.empty())
+    return true;
+  build_masks(dd, sc);
+
+  const size_t pw = sc.paddedWidth;
+  const size_t ph = sc.paddedHeight;
+  for (size_t y = 0; y < dd.height; ++y)
+    std::copy_n(map.begin() + ptrdiff_t(y * dd.width), dd.width, sc.rows.begin() + ptrdiff_t(y * pw));
+  for (size_t i = 0; i < num_seeds; ++i)
+  {
+    float &val = sc.rows[seeds[i].idx / dd.width * pw + seeds[i].idx % dd.width];
+    val = std::min(val, seeds[i].value);
+  }
+
+  // rows hold the map during vertical passes, cols during horizontal ones,
+  // a pass that lowered nothing leaves the other layout up to date
+  bool rowsCurrent = true;
+  bool lastLowered = true;
+  size_t passes = 0;
+  for (bool vertical = true;; vertical = !vertical)
+  {
+    // a round is a vertical and a horizontal pass
+    if (passes++ == 2 * max_rounds)
+      return false;
+    bool lowered = false;
+    if (vertical)
+    {
+      if (!rowsCurrent)
+        transpose(sc.rows.data(), sc.cols.data(), pw, ph);
+      rowsCurrent = true;
+      lowered = sweep_lines(sc.rows.data(), sc.rowMask.data(), pw, ph);
+    }
+    else
+    {
+      if (rowsCurrent)
+        transpose(sc.cols.data(), sc.rows.data(), ph, pw);
+      rowsCurrent = false;
+      lowered = sweep_lines(sc.cols.data(), sc.colMask.data(), ph, pw);
+    }
+    // every tile is at its lowest once neither direction lowers anything
+    if (!lowered && !lastLowered)
+      break;
+    lastLowered = lowered;
+  }
+
+  if (!rowsCurrent)
+    transpose(sc.rows.data(), sc.cols.data(), pw, ph);
+  for (size_t y = 0; y < dd.height; ++y)
+    std::copy_n(sc.rows.begin() + ptrdiff_t(y * pw), dd.width, map.begin() + ptrdiff_t(y * dd.width));
+  return true;
+}
+
+// A heap tile costs about as much as sweeping this many tiles once, so sweeps get
+// the rounds the heap would take. Fewer than sweep_min_rounds rarely converge,
+// those maps go to the heap right away instead of paying for both.
+static constexpr size_t sweep_heap_tile_cost = 64;
+static constexpr size_t sweep_min_rounds = 16;
+
+void dmaps::flood_uniform(std::vector<float> &map, const DungeonData &dd, const DmapSeed *seeds, size_t num_seeds,
+                          DijkstraScratch &scratch, SweepScratch &sweep)
+{
+  if (num_seeds == 0)
+    return;
+  // whole steps apart the queue floods in one pass over the floor, which sweeps can't beat
+  const float first = seeds[0].value;
+  const bool wholeSteps = std::all_of(seeds, seeds + num_seeds,
+                                      [&](const DmapSeed &seed) { return std::floor(seed.value - first) == seed.value - first; });
+  if (!wholeSteps)
+  {
+    build_masks(dd, sweep);
+    const size_t maxRounds = sweep.numFloor * sweep_heap_tile_cost / map.size();
+    if (maxRounds >= sweep_min_rounds && sweep_flood(map, dd, seeds, num_seeds, maxRounds, sweep))
+      return;
+  }
+  flood(map, dd, seeds, num_seeds, UnitCost{}, scratch);
+}
@@ -0,0 +1,43 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+#include "ecsTypes.h"
+#include "dijkstraEngine.h"
+
+// Unit cost dijkstra maps relaxed by whole rows instead of tile by tile.
+// Every round sweeps the map down and up, each row taking min(row, neighbour row + 1) four
+// tiles at a time with SIMD, then does the same on a transposed copy for left and right.
+// Walkability is a packed bit mask, so a pair of rows is gated with one AND per 64 tiles.
+// Rounds stop as soon as a vertical and a horizontal pass in a row changed nothing.
+// Every round is a full pass over the map and a path needs a round per turn it takes, so only
+// small or open maps converge in a few rounds; winding corridors suit the queue better.
+namespace dmaps
+{
+  // Masks and padded copies of the map, rebuilt only when the dungeon changes.
+  // One scratch can't be used by two floods at the same time.
+  struct SweepScratch
+  {
+    size_t width = 0;
+    size_t height = 0;
+    size_t paddedWidth = 0; // multiples of the SIMD width
+    size_t paddedHeight = 0;
+    std::vector<char> tiles; // the masks were built from
+    size_t numFloor = 0;
+    std::vector<uint64_t> rowMask; // floor bits, paddedHeight rows of paddedWidth bits
+    std::vector<uint64_t> colMask; // the same, transposed
+    std::vector<float> rows;
+    std::vector<float> cols;
+  };
+
+  // Lowers map from the seeds to its fixpoint: floor tiles get min(own value, floor neighbour + 1),
+  // like the queue flood does from the same seeds.
+  // Returns false and leaves map as it was if it didn't converge in max_rounds rounds.
+  bool sweep_flood(std::vector<float> &map, const DungeonData &dd, const DmapSeed *seeds, size_t num_seeds,
+                   size_t max_rounds, SweepScratch &scratch);
+
+  // Lowers map from the seeds with unit costs. The queue flood by default; seeds that aren't whole
+  // steps apart, which the queue floods with a heap, are swept if the map is small or open enough
+  // for that to be cheaper, falling back to the heap if they take too many rounds.
+  void flood_uniform(std::vector<float> &map, const DungeonData &dd, const DmapSeed *seeds, size_t num_seeds,
+                     DijkstraScratch &scratch, SweepScratch &sweep);
+};
@@ -0,0 +1,120 @@
+#include "dmapPipeline.h"
+#include "dijkstraMapGen.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+
+DmapPipeline::DmapPipeline(int num_threads) : graph(num_threads)
+{
+  for (int id = 0; id < NUM_DMAPS; ++id)
+    maps[id] = DijkstraMapData{&buffers[id]};
+  const size_t approachJob = graph.add([this] { buildApproach(); });
+  graph.add([this] { buildFlee(); }, {approachJob});
+  graph.add([this] { buildHive(); });
+}
+
+void DmapPipeline::init(flecs::world &ecs)
+{
+  for (int id = 0; id < NUM_DMAPS; ++id)
+    ecs.entity(dmap_name(DmapId(id)))
+      .set(maps[id]);
+  start(ecs);
+  wait(ecs);
+}
+
+void DmapPipeline::start(flecs::world &ecs)
+{
+  static auto dungeonDataQuery = ecs.query<const DungeonData>();
+  graph.wait();
+  dungeonDataQuery.each([&](const DungeonData &dd)
+  {
+    if (dungeon.width != dd.width || dungeon.height != dd.height || dungeon.tiles != dd.tiles)
+    {
+      dungeon.tiles.assign(dd.tiles.begin(), dd.tiles.end());
+      dungeon.width = dd.width;
+      dungeon.height = dd.height;
+    }
+    dmaps::gather_team_sources(ecs, dd, 0, playerSources); // player team hardcode
+    dmaps::gather_hive_sources(ecs, dd, hiveSources);
+  });
+  graph.start();
+}
+
+// the scan relaxes in a different order than the flood, so fractional values like the flee map's
+// can end up a rounding error apart
+static bool same_dmap_value(float lhs, float rhs)
+{
+  return std::abs(lhs - rhs) <= 1e-5f * std::max(1.f, std::abs(rhs));
+}
+
+static size_t count_mismatches(const char *name, const std::vector<float> &published, const std::vector<float> &full)
+{
+  if (published.size() != full.size())
+  {
+    printf("dmap verification: %s has %zu tiles instead of %zu\n", name, published.size(), full.size());
+    return std::max(published.size(), full.size());
+  }
+  size_t mismatches = 0;
+  for (size_t i = 0; i < full.size(); ++i)
+    if (!same_dmap_value(published[i], full[i]))
+    {
+      if (mismatches == 0)
+        printf("dmap verification: %s at tile %zu is %f instead of %f\n", name, i, double(published[i]), double(full[i]));
+      mismatches++;
+    }
+  return mismatches;
+}
+
+void DmapPipeline::wait(flecs::world &ecs)
+{
+  graph.wait();
+  if (!verify)
+    return;
+
+  std::vector<float> full;
+  dmaps::gen_player_approach_map(ecs, full);
+  verifyMismatches += count_mismatches(dmap_name(DMAP_APPROACH), buffers[DMAP_APPROACH].front(), full);
+  dmaps::gen_player_flee_map(ecs, full);
+  verifyMismatches += count_mismatches(dmap_name(DMAP_FLEE), buffers[DMAP_FLEE].front(), full);
+  dmaps::gen_hive_pack_map(ecs, full);
+  verifyMismatches += count_mismatches(dmap_name(DMAP_HIVE), buffers[DMAP_HIVE].front(), full);
+}
+
+void DmapPipeline::publish(DmapId id, const std::vector<float> &map)
+{
+  // the back buffer was the front one before the last publish, so it has the size already
+  buffers[id].back().assign(map.begin(), map.end());
+  buffers[id].publish();
+}
+
+void DmapPipeline::buildApproach()
+{
+  approach.setSources(playerSources);
+  approachChanged = approach.update(dungeon);
+  if (approachChanged)
+    publish(DMAP_APPROACH, approach.getMap());
+}
+
+void DmapPipeline::buildFlee()
+{
+  // flee seeds follow the approach tiles which changed
+  const std::vector<float> &approachMap = approach.getMap();
+  if (approach.wasRebuilt())
+  {
+    flee.clearSeeds();
+    for (size_t i = 0; i < approachMap.size(); ++i)
+      flee.setSeed(i, dmaps::flee_seed_value(approachMap[i]));
+  }
+  else if (approachChanged)
+    for (uint32_t idx : approach.getChangedTiles())
+      flee.setSeed(idx, dmaps::flee_seed_value(approachMap[idx]));
+  if (flee.update(dungeon))
+    publish(DMAP_FLEE, flee.getMap());
+}
+
+void DmapPipeline::buildHive()
+{
+  hive.setSources(hiveSources);
+  if (hive.update(dungeon))
+    publish(DMAP_HIVE, hive.getMap());
+}
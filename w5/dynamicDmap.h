@@ -0,0 +1,59 @@
+#pragma once
+#include <cstdint>
+#include <utility>
+#include <vector>
+#include "ecsTypes.h"
+#include "dijkstraEngine.h"
+#include "dijkstraSweep.h"
+
+// A unit cost Dijkstra map kept up to date between turns instead of being regenerated.
+// Its value at every tile is the same as flooding the dungeon from all of its seeds at once.
+// Seeds and tiles that changed since the last update() are repaired in two passes:
+// tiles whose value depended on them are invalidated in increasing value order, then
+// the invalidated region is flooded again from its border and the lowered seeds.
+// Work is proportional to the tiles whose value changes, if that is most of the map
+// it is rebuilt from scratch instead.
+class DynamicDmap
+{
+public:
+  // replaces all seeds, only the difference with the previous set is applied
+  void setSources(const std::vector<dmaps::DmapSeed> &in_sources);
+  void setSeed(size_t idx, float value);
+  void clearSeed(size_t idx);
+  void clearSeeds();
+
+  // returns true if any value changed
+  bool update(const DungeonData &dd);
+
+  const std::vector<float> &getMap() const { return map; }
+  // tiles whose value changed in the last update(), if it wasn't a rebuild
+  const std::vector<uint32_t> &getChangedTiles() const { return changed; }
+  bool wasRebuilt() const { return rebuilt; }
+
+private:
+  void rebuild(const DungeonData &dd);
+  bool isSupported(size_t idx) const;
+  float repairValue(size_t idx) const;
+  void touch(size_t idx, float old_value);
+
+  std::vector<float> map;
+  std::vector<float> seedValues; // per tile, dmaps::invalid_tile_value if it isn't a seed
+  std::vector<dmaps::DmapSeed> sources; // last setSources(), sorted by tile
+  std::vector<dmaps::DmapSeed> nextSources;
+  std::vector<char> tiles; // dungeon as of the last update
+  size_t width = 0;
+  size_t height = 0;
+  bool forceRebuild = true;
+
+  std::vector<uint32_t> dirty; // seeds and tiles changed since the last update
+  std::vector<std::pair<float, uint32_t>> raiseHeap;
+  std::vector<uint32_t> invalidated;
+  std::vector<dmaps::DmapSeed> repairSeeds;
+  std::vector<std::pair<uint32_t, float>> touched; // tile and its value before the update
+  std::vector<uint32_t> touchStamps;
+  uint32_t stamp = 0;
+  std::vector<uint32_t> changed;
+  bool rebuilt = false;
+  dmaps::DijkstraScratch scratch;
+  dmaps::SweepScratch sweepScratch; // rebuilds only
+};
@@ -0,0 +1,86 @@
+#include "jobGraph.h"
+#include <algorithm>
+#include <cassert>
+
+JobGraph::JobGraph(int num_threads)
+{
+  for (int i = 0; i < std::max(num_threads, 1); ++i)
+    workers.emplace_back([this] { workerLoop(); });
+}
+
+JobGraph::~JobGraph()
+{
+  wait();
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    stopping = true;
+  }
+  workAvailable.notify_all();
+  for (std::thread &worker : workers)
+    worker.join();
+}
+
+size_t JobGraph::add(std::function<void()> func, std::initializer_list<size_t> dependencies)
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  assert(unfinished == 0 && "can't add jobs to a running graph");
+  const size_t id = jobs.size();
+  Job &job = jobs.emplace_back();
+  job.func = std::move(func);
+  for (size_t dependency : dependencies)
+  {
+    assert(dependency < id && "dependencies have to be added first");
+    jobs[dependency].dependents.push_back(id);
+    job.numDependencies++;
+  }
+  ready.reserve(jobs.size());
+  return id;
+}
+
+void JobGraph::start()
+{
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    assert(unfinished == 0 && "graph is already running");
+    unfinished = jobs.size();
+    for (size_t i = 0; i < jobs.size(); ++i)
+    {
+      jobs[i].remaining = jobs[i].numDependencies;
+      if (jobs[i].remaining == 0)
+        ready.push_back(i);
+    }
+  }
+  workAvailable.notify_all();
+}
+
+void JobGraph::wait()
+{
+  std::unique_lock<std::mutex> lock(mutex);
+  allDone.wait(lock, [this] { return unfinished == 0; });
+}
+
+void JobGraph::workerLoop()
+{
+  std::unique_lock<std::mutex> lock(mutex);
+  while (true)
+  {
+    workAvailable.wait(lock, [this] { return stopping || !ready.empty(); });
+    if (ready.empty())
+      return;
+    const size_t id = ready.back();
+    ready.pop_back();
+
+    lock.unlock();
+    jobs[id].func();
+    lock.lock();
+
+    for (size_t dependent : jobs[id].dependents)
+      if (--jobs[dependent].remaining == 0)
+      {
+        ready.push_back(dependent);
+        workAvailable.notify_one();
+      }
+    if (--unfinished == 0)
+      allDone.notify_all();
+  }
+}
@@ -0,0 +1,131 @@
+// Headless simulation: the same roguelike logic without a window, the player is driven by a bot.
+// Prints turns/sec and per-phase timings, meant for measuring AI throughput.
+#include "raylib.h"
+#include <flecs.h>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include "ecsTypes.h"
+#include "roguelike.h"
+#include "dungeonGen.h"
+#include "thinkPhase.h"
+
+struct SimSettings
+{
+  int numMonsters = num_monster_kinds;
+  size_t width = 50;
+  size_t height = 50;
+  int numTurns = 1000;
+  unsigned seed = 1;
+  int numThreads = 0; // 0 - as many as hardware can run
+  std::string bot = "random"; // or a script of l/r/u/d moves, repeated
+  bool verifyDmaps = false;
+};
+
+static void print_usage(const char *exe)
+{
+  printf("usage: %s [--monsters N] [--width W] [--height H] [--turns N] [--seed S] [--threads N]"
+         " [--bot random|<script of l,r,u,d>] [--verify-dmaps 0|1]\n", exe);
+}
+
+static bool parse_args(int argc, const char **argv, SimSettings &settings)
+{
+  for (int i = 1; i < argc; ++i)
+  {
+    const char *arg = argv[i];
+    if (i + 1 >= argc)
+      return false;
+    const char *val = argv[++i];
+    if (!strcmp(arg, "--monsters"))
+      settings.numMonsters = atoi(val);
+    else if (!strcmp(arg, "--width"))
+      settings.width = size_t(atoi(val));
+    else if (!strcmp(arg, "--height"))
+      settings.height = size_t(atoi(val));
+    else if (!strcmp(arg, "--turns"))
+      settings.numTurns = atoi(val);
+    else if (!strcmp(arg, "--seed"))
+      settings.seed = unsigned(strtoul(val, nullptr, 10));
+    else if (!strcmp(arg, "--threads"))
+      settings.numThreads = atoi(val);
+    else if (!strcmp(arg, "--bot"))
+      settings.bot = val;
+    else if (!strcmp(arg, "--verify-dmaps"))
+      settings.verifyDmaps = atoi(val) != 0;
+    else
+      return false;
+  }
+  return settings.width >= 3 && settings.height >= 3 && settings.numMonsters >= 0 && settings.numTurns >= 0;
+}
+
+static int bot_action(const SimSettings &settings, int turn)
+{
+  if (settings.bot == "random" || settings.bot.empty())
+    return GetRandomValue(EA_MOVE_START, EA_MOVE_END - 1);
+  const char move = settings.bot[size_t(turn) % settings.bot.size()];
+  return move == 'l' ? EA_MOVE_LEFT :
+         move == 'r' ? EA_MOVE_RIGHT :
+         move == 'u' ? EA_MOVE_UP : EA_MOVE_DOWN;
+}
+
+int main(int argc, const char **argv)
+{
+  SimSettings settings;
+  if (!parse_args(argc, argv, settings))
+  {
+    print_usage(argv[0]);
+    return 1;
+  }
+  SetTraceLogLevel(LOG_WARNING);
+  SetRandomSeed(settings.seed);
+
+  flecs::world ecs;
+  {
+    std::vector<char> tiles(settings.width * settings.height);
+    gen_drunk_dungeon(tiles.data(), settings.width, settings.height, settings.seed);
+    init_dungeon(ecs, tiles.data(), settings.width, settings.height);
+  }
+  init_roguelike(ecs, settings.numMonsters);
+  if (settings.numThreads > 0)
+    init_think_phase(ecs, settings.numThreads);
+  set_think_seed(settings.seed);
+  set_dmap_verification(ecs, settings.verifyDmaps);
+
+  static auto playerQuery = ecs.query<const IsPlayer, Action, Hitpoints>();
+  const auto start = std::chrono::steady_clock::now();
+  int turn = 0;
+  for (; turn < settings.numTurns; ++turn)
+  {
+    bool playerAlive = false;
+    playerQuery.each([&](const IsPlayer &, Action &a, Hitpoints &hp)
+    {
+      playerAlive = true;
+      a.action = bot_action(settings, turn);
+      // the bot can't die, so every run lasts the same number of turns
+      hp.hitpoints = 100.f;
+    });
+    if (!playerAlive)
+      break;
+    process_turn(ecs);
+  }
+  const double total = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+  printf("monsters: %d, map: %zux%zu, seed: %u, bot: %s\n",
+         settings.numMonsters, settings.width, settings.height, settings.seed, settings.bot.c_str());
+  printf("turns: %d in %.3f s, %.1f turns/sec\n", turn, total, total > 0.0 ? turn / total : 0.0);
+  static auto timingsQuery = ecs.query<const TurnTimings>();
+  timingsQuery.each([&](const TurnTimings &timings)
+  {
+    const double perTurn = timings.turns > 0 ? 1e3 / timings.turns : 0.0;
+    printf("per turn, ms: sensors %.4f, think %.4f, followers %.4f, actions %.4f, dmaps %.4f\n",
+           timings.sensors * perTurn, timings.think * perTurn, timings.followers * perTurn,
+           timings.actions * perTurn, timings.dmaps * perTurn);
+  });
+  if (settings.verifyDmaps)
+    printf("dmap verification: %zu mismatching tiles\n", get_dmap_verification_mismatches(ecs));
+
+  return 0;
+}
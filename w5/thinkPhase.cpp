@@ -0,0 +1,135 @@
+#include "thinkPhase.h"
+#include "ecsTypes.h"
+#include "stateMachine.h"
+#include "behaviourTree.h"
+#include "blackboard.h"
+#include "jobGraph.h"
+#include <algorithm>
+#include <memory>
+#include <vector>
+
+struct ThinkJob
+{
+  flecs::entity entity;
+  StateMachine *sm = nullptr;
+  BehaviourTree *bt = nullptr;
+  Blackboard *bb = nullptr;
+  uint32_t seed = 0;
+};
+
+// what the chunk jobs of the current turn work on, set before the graph starts
+struct ThinkBatch
+{
+  flecs::world *ecs = nullptr;
+  const AIContext *ctx = nullptr;
+  std::vector<ThinkJob> jobs;
+  size_t chunkSize = 0;
+};
+
+static int numThinkThreads = 1;
+static uint64_t thinkSeed = 0;
+static ThinkBatch batch;
+// chunk 0 is thought on the calling thread, the graph runs one job per other chunk
+static std::unique_ptr<JobGraph> thinkGraph;
+static thread_local uint32_t thinkRandomState = 1;
+
+static void think_chunk(size_t chunk);
+
+void init_think_phase(flecs::world &ecs, int num_threads)
+{
+  numThinkThreads = std::max(num_threads, 1);
+  ecs.set_stage_count(numThinkThreads);
+  thinkGraph.reset();
+  if (numThinkThreads <= 1)
+    return;
+  thinkGraph = std::make_unique<JobGraph>(numThinkThreads - 1);
+  for (size_t chunk = 1; chunk < size_t(numThinkThreads); ++chunk)
+    thinkGraph->add([chunk] { think_chunk(chunk); });
+}
+
+void set_think_seed(uint64_t seed)
+{
+  thinkSeed = seed;
+}
+
+static uint64_t splitmix64(uint64_t x)
+{
+  x += 0x9e3779b97f4a7c15ull;
+  x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ull;
+  x = (x ^ (x >> 27)) * 0x94d049bb133111ebull;
+  return x ^ (x >> 31);
+}
+
+static uint32_t think_seed(int turn, flecs::entity e)
+{
+  const uint64_t seed = splitmix64(splitmix64(splitmix64(thinkSeed) ^ uint64_t(turn)) ^ e.id());
+  return uint32_t(seed) | 1u; // xorshift state can't be 0
+}
+
+int think_random_value(int min, int max)
+{
+  if (min > max)
+    std::swap(min, max);
+  // xorshift32
+  thinkRandomState ^= thinkRandomState << 13;
+  thinkRandomState ^= thinkRandomState >> 17;
+  thinkRandomState ^= thinkRandomState << 5;
+  return min + int(thinkRandomState % uint32_t(max - min + 1));
+}
+
+static void think(flecs::world &stage, const ThinkJob &job, const AIContext &ctx)
+{
+  thinkRandomState = job.seed;
+  flecs::entity entity = job.entity.mut(stage);
+  if (job.sm)
+    job.sm->act(0.f, stage, entity, ctx);
+  if (job.bt)
+    job.bt->update(stage, entity, *job.bb, ctx);
+}
+
+static void think_chunk(size_t chunk)
+{
+  flecs::world stage = batch.ecs->get_stage(int32_t(chunk));
+  const size_t from = std::min(batch.jobs.size(), chunk * batch.chunkSize);
+  const size_t to = std::min(batch.jobs.size(), (chunk + 1) * batch.chunkSize);
+  for (size_t i = from; i < to; ++i)
+    think(stage, batch.jobs[i], *batch.ctx);
+}
+
+void process_think_phase(flecs::world &ecs, const AIContext &ctx)
+{
+  static auto stateMachineAct = ecs.query<StateMachine>();
+  static auto behTreeUpdate = ecs.query<BehaviourTree, Blackboard>();
+  std::vector<ThinkJob> &jobs = batch.jobs;
+  const int turn = ctx.turnCounter ? ctx.turnCounter->count : 0;
+
+  // components don't move while the world is readonly, so it is safe to keep pointers to them
+  jobs.clear();
+  stateMachineAct.each([&](flecs::entity e, StateMachine &sm)
+  {
+    jobs.push_back(ThinkJob{e, &sm, nullptr, nullptr, think_seed(turn, e)});
+  });
+  behTreeUpdate.each([&](flecs::entity e, BehaviourTree &bt, Blackboard &bb)
+  {
+    jobs.push_back(ThinkJob{e, nullptr, &bt, &bb, think_seed(turn, e)});
+  });
+
+  if (!thinkGraph || jobs.size() <= 1)
+  {
+    ecs.defer([&]
+    {
+      for (const ThinkJob &job : jobs)
+        think(ecs, job, ctx);
+    });
+    return;
+  }
+
+  batch.ecs = &ecs;
+  batch.ctx = &ctx;
+  batch.chunkSize = (jobs.size() + size_t(numThinkThreads) - 1) / size_t(numThinkThreads);
+  ecs.readonly_begin();
+  thinkGraph->start();
+  think_chunk(0);
+  thinkGraph->wait();
+  ecs.readonly_end(); // merges all stages
+}
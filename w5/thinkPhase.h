@@ -0,0 +1,20 @@
+#pragma once
+#include <flecs.h>
+#include <cstdint>
+#include "aiContext.h"
+
+// NPC decision making (state machines and behaviour trees) for one turn.
+// Entities are split in contiguous chunks between worker threads, each of them thinks through
+// its own flecs stage while the world is readonly, so everyone sees the world as it was
+// at the beginning of the turn and all writes are merged once everyone is done.
+// Every NPC only reads the world and writes its own components, so the result
+// is the same for any number of threads.
+// Worker threads are started once here and wait for the next turn between turns.
+void init_think_phase(flecs::world &ecs, int num_threads);
+void process_think_phase(flecs::world &ecs, const AIContext &ctx);
+
+// Random numbers for decision making, [min, max] like GetRandomValue.
+// The stream is seeded per entity each turn from the think seed, the turn and the entity id,
+// so it doesn't depend on which thread thinks for it or on anything else drawing random numbers.
+int think_random_value(int min, int max);
+void set_think_seed(uint64_t seed);